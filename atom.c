@@ -0,0 +1,230 @@
+/* atom --- interned identifier names                       2026-10-17 */
+/* Copyright (c) 2022 John Honniball. All rights reserved              */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "atom.h"
+
+#define MINATOMSLOTS  (256)   // Initial size of atom hash table; a power of two
+#define NAMEBLOCKSIZE (4096)  // Bytes of name text allocated at once
+
+#define EOS   ('\0')
+
+// Each distinct identifier becomes a small integer, its atom, which is
+// the index of its entry here. Atoms are numbered from zero in order of
+// first appearance, so other modules can use them to index arrays.
+struct Atom {
+   const char *name;          // EOS-terminated copy of the identifier
+   int len;
+   unsigned int hash;
+};
+
+// Storage for name text. Blocks are never moved, so the pointers
+// returned by AtomName() stay valid until the next AtomInit().
+struct NameBlock {
+   struct NameBlock *next;
+   int nUsed;
+   int size;
+   char text[];
+};
+
+// Per-thread, so that each worker compiling a file has its own atoms
+static _Thread_local struct Atom *Atoms = NULL;
+static _Thread_local int NAtoms = 0;
+static _Thread_local int NAtomSlots = 0;
+static _Thread_local int *AtomHash = NULL;   // Atom in each slot, or NOATOM
+static _Thread_local int NHashSlots = 0;
+static _Thread_local struct NameBlock *NameBlocks = NULL;
+
+
+/* AtomInit --- forget all the atoms, ready for a new compilation-unit */
+
+void AtomInit(void)
+{
+   struct NameBlock *blk;
+   
+   while ((blk = NameBlocks) != NULL) {
+      NameBlocks = blk->next;
+      free(blk);
+   }
+   
+   free(AtomHash);
+   free(Atoms);
+   
+   AtomHash = NULL;
+   NHashSlots = 0;
+   Atoms = NULL;
+   NAtomSlots = 0;
+   NAtoms = 0;
+}
+
+
+/* outOfMemory --- report failure to allocate space for an atom and give up */
+
+static void outOfMemory(const char name[], const int len)
+{
+   fprintf(stderr, "Out of memory for identifier '%.*s'\n", len, name);
+   exit(EXIT_FAILURE);
+}
+
+
+/* hashName --- FNV-1a hash of an identifier */
+
+static unsigned int hashName(const char name[], const int len)
+{
+   unsigned int h = 2166136261u;
+   int i;
+   
+   for (i = 0; i < len; i++)
+      h = (h ^ (unsigned char)name[i]) * 16777619u;
+   
+   return (h);
+}
+
+
+/* findSlot --- return the hash slot holding 'name', or the empty slot where it would go */
+
+static int *findSlot(const char name[], const int len, const unsigned int hash)
+{
+   const unsigned int mask = NHashSlots - 1;
+   const struct Atom *at;
+   unsigned int i;
+   
+   for (i = hash & mask; AtomHash[i] != NOATOM; i = (i + 1) & mask) {
+      at = &Atoms[AtomHash[i]];
+      
+      if ((at->hash == hash) && (at->len == len) && (memcmp(at->name, name, len) == 0))
+         break;
+   }
+   
+   return (&AtomHash[i]);
+}
+
+
+/* growHashTab --- double the number of hash slots and re-insert every atom */
+
+static bool growHashTab(void)
+{
+   const int nNew = (NHashSlots == 0) ? MINATOMSLOTS : NHashSlots * 2;
+   int *slots;
+   int i;
+   
+   if ((slots = malloc(nNew * sizeof (int))) == NULL)
+      return (false);
+   
+   for (i = 0; i < nNew; i++)
+      slots[i] = NOATOM;
+   
+   free(AtomHash);
+   AtomHash = slots;
+   NHashSlots = nNew;
+   
+   for (i = 0; i < NAtoms; i++)
+      *findSlot(Atoms[i].name, Atoms[i].len, Atoms[i].hash) = i;
+   
+   return (true);
+}
+
+
+/* saveName --- copy an identifier into the name blocks */
+
+static const char *saveName(const char name[], const int len)
+{
+   struct NameBlock *blk = NameBlocks;
+   char *text;
+   
+   if ((blk == NULL) || (blk->nUsed + len + 1 > blk->size)) {
+      const int size = (len + 1 > NAMEBLOCKSIZE) ? len + 1 : NAMEBLOCKSIZE;
+      
+      if ((blk = malloc(sizeof (struct NameBlock) + size)) == NULL)
+         return (NULL);
+      
+      blk->next = NameBlocks;
+      blk->nUsed = 0;
+      blk->size = size;
+      NameBlocks = blk;
+   }
+   
+   text = &blk->text[blk->nUsed];
+   memcpy(text, name, len);
+   text[len] = EOS;
+   blk->nUsed += len + 1;
+   
+   return (text);
+}
+
+
+/* Intern --- return the atom for an identifier, making a new one if need be */
+
+int Intern(const char name[], const int len)
+{
+   const unsigned int hash = hashName(name, len);
+   struct Atom *at;
+   int *slot;
+   
+   // Keep the table no more than half full, so that misses are short
+   if ((NAtoms + 1) * 2 > NHashSlots) {
+      if (growHashTab() == false)
+         outOfMemory(name, len);
+   }
+   
+   slot = findSlot(name, len, hash);
+   
+   if (*slot != NOATOM)
+      return (*slot);
+   
+   if (NAtoms == NAtomSlots) {
+      const int n = (NAtomSlots == 0) ? MINATOMSLOTS : NAtomSlots * 2;
+      
+      if ((at = realloc(Atoms, n * sizeof (struct Atom))) == NULL)
+         outOfMemory(name, len);
+      
+      Atoms = at;
+      NAtomSlots = n;
+   }
+   
+   at = &Atoms[NAtoms];
+   
+   if ((at->name = saveName(name, len)) == NULL)
+      outOfMemory(name, len);
+   
+   at->len = len;
+   at->hash = hash;
+   
+   *slot = NAtoms;
+   
+   return (NAtoms++);
+}
+
+
+/* AtomName --- return the EOS-terminated text of an atom */
+
+const char *AtomName(const int atom)
+{
+   if ((atom < 0) || (atom >= NAtoms))
+      return ("");
+   
+   return (Atoms[atom].name);
+}
+
+
+/* AtomLength --- return the number of characters in an atom's name */
+
+int AtomLength(const int atom)
+{
+   if ((atom < 0) || (atom >= NAtoms))
+      return (0);
+   
+   return (Atoms[atom].len);
+}
+
+
+/* AtomCount --- return the number of atoms made so far */
+
+int AtomCount(void)
+{
+   return (NAtoms);
+}
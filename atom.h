@@ -0,0 +1,10 @@
+/* atom --- interned identifier names                       2026-10-17 */
+/* Copyright (c) 2022 John Honniball. All rights reserved              */
+
+#define NOATOM     (-1)
+
+void AtomInit(void);
+int Intern(const char name[], const int len);
+const char *AtomName(const int atom);
+int AtomLength(const int atom);
+int AtomCount(void);
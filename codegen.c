@@ -3,827 +3,3669 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
+#include <limits.h>
 
 #include "codegen.h"
 
 #define NAME_PREFIX  ('_')
 
-static int NextLabel = 0;
-static FILE *Asm = NULL;
+// Cost model for 'switch' dispatch: bytes of code and cycles on the 6809
+#define CYCLEWEIGHT  (2)     // How many bytes one cycle is worth
+#define CHAINBYTES   (8)     // cmpd #n; lbeq
+#define CHAINCYCLES  (10)
+#define NODEBYTES    (12)    // cmpd #n; lbeq; lbgt
+#define NODECYCLES   (15)
+#define JUMPBYTES    (3)     // lbra to the default
+#define TABLEBYTES   (15)    // cmpd; lbhi; aslb; rola; ldx; jmp [d,x]
+#define TABLECYCLES  (27)
+#define TREELEAF     (3)     // Most cases to chain at the bottom of a tree
+#define MAXTABLE     (1024)  // Largest jump table, in entries
+
+// Room for a symbol's name in an operand, e.g. '_name+2', or in a comment
+#define OPERANDSIZE(sym)  (strlen((sym)->name) + 16)
+#define COMMENTSIZE(sym)  (strlen((sym)->name) + 64)
+
+#define MINCODE      (256)   // Initial size of the instruction buffer, in records
+#define MINTEXT      (4096)  // Initial size of the text pool, in bytes
+#define NOTEXT       (-1)
+#define MAXPASSES    (8)     // Most times the peephole rules are applied to a function
+#define MAXEPILOGUE  (4)     // Most instructions in an exit sequence, before its 'rts'
+#define UNKNOWNSIZE  (256)   // Assumed size of data in the code, so no short branch crosses it
+#define MINGLOBALS   (64)    // Initial size of the table of global variables
+#define DPBASE       (0x80)  // Part of page zero reserved for the busiest globals, addressed by 'setdp 0'
+#define DPSIZE       (128)
+#define DEFSIZE      (160)   // Longest line of assembler that defines a variable
+
+// Run-time routines that generated code may call, written out only if used
+#define H_MUL        (1 << 0)
+#define H_UDIV       (1 << 1)
+#define H_SDIV       (1 << 2)
+#define H_ASL        (1 << 3)
+#define H_ASR        (1 << 4)
+#define H_LSR        (1 << 5)
+
+// Kinds of record in the instruction buffer
+enum InstKind {
+   IINST,               // An instruction, e.g. 'ldd #1'
+   ILABEL,              // Definition of a generated label
+   ITEXT,               // Anything else: a function name, data or a comment line
+   IDELETED             // Removed by the peephole optimiser
+};
+
+// How the operand of an instruction is held
+enum OperKind {
+   ONONE,               // No operand, e.g. 'rts'
+   OIMMEDIATE,          // '#value'
+   OLABEL,              // A generated label, 'lnnnn'
+   OADDRESS,            // Address of a generated label, '#lnnnn'
+   OTEXT                // Any other operand, as text
+};
+
+// One record in the instruction buffer. Text is held in the text pool
+// as offsets, because the pool moves when it grows.
+struct Instruction {
+   enum InstKind kind;
+   char inst[8];        // Mnemonic, for IINST
+   enum OperKind operKind;
+   int value;           // Immediate value, for OIMMEDIATE
+   int label;           // Target label for OLABEL or OADDRESS, or the label for ILABEL
+   int oper;            // Operand text for OTEXT, or the whole line for ITEXT
+   int comment;
+   int size;            // Bytes of object code, during branch relaxation
+   int addr;            // Offset from the start of the buffer, likewise
+};
+
+// A global or static scalar. They're all written out at the end of the
+// compilation-unit, when it's known which are used most: those go in the
+// direct page, where each access is a byte shorter and a cycle faster.
+struct GlobalVar {
+   int storageClass;
+   const char *name;    // Name in the source, for the report and the profile
+   int atom;            // For an extern
+   int label;           // For a static
+   int size;
+   int refs;            // Instructions that address it
+   int accesses;        // How often they run, from the profile, or else 'refs'
+   bool profiled;
+   bool direct;
+   char *def;           // Line of assembler that defines it, with its initial value
+};
+
+// Accesses to each variable in a run of the program, read by ReadProfile()
+struct ProfileCount {
+   char *name;
+   int count;
+};
+
+// Set once from the command line, before any worker threads start
+static bool Optimise = true;
+static struct ProfileCount *Profile = NULL;
+static int NProfile = 0;
+
+// Per-thread, so that each worker compiling a file has its own labels and output
+static _Thread_local int NextLabel = 0;
+static _Thread_local FILE *Asm = NULL;
+
+// Code is gathered here and only written out at the end of each function
+static _Thread_local struct Instruction *Code = NULL;
+static _Thread_local int NCode = 0;
+static _Thread_local int MaxCode = 0;
+static _Thread_local char *Text = NULL;
+static _Thread_local int TextLen = 0;
+static _Thread_local int MaxText = 0;
+
+// Where each label is defined in the buffer, and how many times it's used
+static _Thread_local int *LabelAt = NULL;
+static _Thread_local int *LabelRefs = NULL;
+static _Thread_local int MaxLabels = 0;
+
+static _Thread_local unsigned int Helpers = 0;
+
+// Distance from the frame pointer to the first parameter: saved U, maybe Y, and the return address
+static _Thread_local int ParamBase = 4;
+
+// The current function's frame, for addressing it relative to S instead of U
+static _Thread_local int EntryAt = 0;
+static _Thread_local int FrameRegisters = 0;
+
+// Global and static variables, in order of declaration
+static _Thread_local struct GlobalVar *Globals = NULL;
+static _Thread_local int NGlobals = 0;
+static _Thread_local int MaxGlobals = 0;
+
+// The assembler file, while the code is gathered in a temporary file
+// so that the direct page can be written out in front of it
+static _Thread_local FILE *Output = NULL;
+
+
+/* CodeGenInit --- initialise this module for a new compilation-unit */
 
+void CodeGenInit(void)
+{
+   NextLabel = 0;
+   Asm = NULL;
+   Output = NULL;
+   
+   while (NGlobals > 0) {
+      free(Globals[--NGlobals].def);
+   }
+   
+   free(Globals);
+   free(Code);
+   free(Text);
+   free(LabelAt);
+   free(LabelRefs);
+   
+   Code = NULL;
+   NCode = 0;
+   MaxCode = 0;
+   Text = NULL;
+   TextLen = 0;
+   MaxText = 0;
+   LabelAt = NULL;
+   LabelRefs = NULL;
+   MaxLabels = 0;
+   Helpers = 0;
+   Globals = NULL;
+   MaxGlobals = 0;
+}
 
-/* CodeGenInit --- initialise this module */
 
-void CodeGenInit(void)
+/* SetOptimiseFlag --- turn the peephole optimiser on or off */
+
+void SetOptimiseFlag(const bool flag)
 {
+   Optimise = flag;
 }
 
 
-/* OpenAssemblerFile --- open the output file and write a header */
+/* ReadProfile --- read the number of accesses to each variable, as 'name count' pairs */
 
-bool OpenAssemblerFile(const char fname[])
+bool ReadProfile(const char fname[])
 {
-   char asmName[256];
-   char *p;
+   FILE *fp;
+   char name[64];
+   int count;
+   int n;
    
-   strncpy(asmName, fname, sizeof (asmName) - 2);
-   p = strrchr(asmName, '.');
-   strcpy(p, ".asm");
+   if ((fp = fopen(fname, "r")) == NULL) {
+      return (false);
+   }
    
-   Asm = fopen(asmName, "w");
+   while ((n = fscanf(fp, "%63s %d", name, &count)) == 2) {
+      if (((Profile = realloc(Profile, (NProfile + 1) * sizeof (Profile[0]))) == NULL) ||
+          ((Profile[NProfile].name = malloc(strlen(name) + 1)) == NULL)) {
+         fclose(fp);
+         return (false);
+      }
+      
+      strcpy(Profile[NProfile].name, name);
+      Profile[NProfile].count = count;
+      NProfile++;
+   }
    
-   fprintf(Asm, "         setdp 0\n");
-   fprintf(Asm, "         org   $0400\n");
-   fprintf(Asm, "appEntry sts  saveSP            ; Save initial SP in case we call 'exit()'\n");
-#ifdef SIMULATOR
-   fprintf(Asm, "         lda  #3                ; SIM Into CBREAK mode\n");
-   fprintf(Asm, "         swi                    ; SIM\n");
-#endif
-   fprintf(Asm, "         jsr  _main\n");
-   fprintf(Asm, "appExit\n");
-#ifdef SIMULATOR
-   fprintf(Asm, "         lda  #4                ; SIM Out of CBREAK mode\n");
-   fprintf(Asm, "         swi                    ; SIM\n");
-   fprintf(Asm, "         lda  #0                ; SIM Terminate\n");
-   fprintf(Asm, "         swi                    ; SIM\n");
-#else
-   fprintf(Asm, "         rts\n");
-#endif   /* SIMULATOR */
-   fprintf(Asm, "saveSP   fdb  0                 ; Space to store initial SP\n");
-   fprintf(Asm, "_exit    lds  saveSP            ; Recover initial SP\n");
-   fprintf(Asm, "         bra  appExit           ; Branch to instruction after 'main()'\n");
-   fprintf(Asm, "; void putchar(const int ch);\n");
-   fprintf(Asm, "_putchar pshs u                 ; Save old frame pointer\n");
-   fprintf(Asm, "         tfr  s,u               ; Make new frame pointer\n");
-   fprintf(Asm, "         ldd  4,u               ; Pick up first parameter\n");
-#ifdef SIMULATOR
-   fprintf(Asm, "         lda  #5                ; SIM Print char in B register\n");
-   fprintf(Asm, "         swi                    ; SIM\n");
-#else
-   fprintf(Asm, "         tfr  b,a               ; Move char into A register\n");
-   fprintf(Asm, "         jsr  $a020             ; Send one char to the VDU\n");
-#endif   /* SIMULATOR */
-   fprintf(Asm, "         tfr  u,s               ; Deallocate stack frame\n");
-   fprintf(Asm, "         puls u                 ; Restore frame pointer\n");
-   fprintf(Asm, "         rts\n");
-   fprintf(Asm, "; void puts(const char *const s);\n");
-   fprintf(Asm, "_puts    pshs u                 ; Save old frame pointer\n");
-   fprintf(Asm, "         tfr  s,u               ; Make new frame pointer\n");
-   fprintf(Asm, "         ldx  4,u               ; Pick up first parameter\n");
-   fprintf(Asm, "puts1    ldb  ,x+               ; Load char from string\n");
-   fprintf(Asm, "         beq  puts2             ; Exit loop if end-of-string NUL\n");
-#ifdef SIMULATOR
-   fprintf(Asm, "         lda  #5                ; SIM Print char in B register\n");
-   fprintf(Asm, "         swi                    ; SIM\n");
-#else
-   fprintf(Asm, "         tfr  b,a               ; Move char into A register\n");
-   fprintf(Asm, "         jsr  $a020             ; Send one char to the VDU\n");
-#endif   /* SIMULATOR */
-   fprintf(Asm, "         bra  puts1             ; Loop back for next character\n");
-   fprintf(Asm, "puts2    ldb  #10               ; Load NEWLINE\n");
-#ifdef SIMULATOR
-   fprintf(Asm, "         lda  #5                ; SIM Print char in B register\n");
-   fprintf(Asm, "         swi                    ; SIM\n");
-#else
-   fprintf(Asm, "         tfr  b,a               ; Move char into A register\n");
-   fprintf(Asm, "         jsr  $a020             ; Send one char to the VDU\n");
-#endif   /* SIMULATOR */
-   fprintf(Asm, "         tfr  u,s               ; Deallocate stack frame\n");
-   fprintf(Asm, "         puls u                 ; Restore frame pointer\n");
-   fprintf(Asm, "         rts\n");
-   fprintf(Asm, "; void puti(const int i);\n");
-   fprintf(Asm, "decbuf   rmb     16             ; Decimal digit buffer\n");
-   fprintf(Asm, "_puti    pshs u                 ; Save old frame pointer\n");
-   fprintf(Asm, "         tfr  s,u               ; Make new frame pointer\n");
-   fprintf(Asm, "         ldd  4,u               ; Pick up first parameter\n");
-   fprintf(Asm, "         pshs y                 ; Save any register variable in Y\n");
-   fprintf(Asm, "         ldx  #decbuf           ; X points to buffer for decimal digits\n");
-   fprintf(Asm, "         jsr  bn2dec            ; Convert 16-bit binary to decimal ASCII\n");
-   fprintf(Asm, "         puls y                 ; Restore any register variable that we saved\n");
-   fprintf(Asm, "         ldx  #decbuf+1         ; X points to buffer\n");
-   fprintf(Asm, "         bra  puts1             ; Heinous jump into the middle of puts()\n");
+   fclose(fp);
    
-   fprintf(Asm, "bn2dec          std     1,x               ; Save data in buffer\n");
-   fprintf(Asm, ";               bpl     cnvert            ; Branch if data positive\n");
-   fprintf(Asm, ";               ldd     #0                ; else take positive value\n");
-   fprintf(Asm, ";               subd    1,x\n");
-   fprintf(Asm, "; Initialise string length to zero\n");
-   fprintf(Asm, "cnvert          clr     ,x                ; String length = 0\n");
-   fprintf(Asm, "; Divide binary data by 10 by subtracting powers of ten\n");
-   fprintf(Asm, "div10           ldy     #-1000            ; Start quotient at -1000\n");
-   fprintf(Asm, "; Find number of thousands in quotient\n");
-   fprintf(Asm, "thousd          leay    1000,y            ; Add 1000 to quotient\n");
-   fprintf(Asm, "                subd    #10000            ; Subtract 10000 from dividend\n");
-   fprintf(Asm, "                bcc     thousd            ; Branch if difference still positive\n");
-   fprintf(Asm, "                addd    #10000            ; Else add back last 10000\n");
-   fprintf(Asm, "; Find number of hundreds in quotient\n");
-   fprintf(Asm, "                leay    -100,y            ; Start number of hundreds at -1\n");
-   fprintf(Asm, "hundd           leay    100,y             ; Add 100 to quotient\n");
-   fprintf(Asm, "                subd    #1000             ; Subtract 1000 from dividend\n");
-   fprintf(Asm, "                bcc     hundd             ; Branch if difference still positive\n");
-   fprintf(Asm, "                addd    #1000             ; Else add back last 1000\n");
-   fprintf(Asm, "; Find number of tens in quotient\n");
-   fprintf(Asm, "                leay    -10,y             ; Start number of tens at -1\n");
-   fprintf(Asm, "tensd           leay    10,y              ; Add 10 to quotient\n");
-   fprintf(Asm, "                subd    #100              ; Subtract 100 from dividend\n");
-   fprintf(Asm, "                bcc     tensd             ; Branch if difference still positive\n");
-   fprintf(Asm, "                addd    #100              ; Else add back last 100\n");
-   fprintf(Asm, "; Find number of ones in quotient\n");
-   fprintf(Asm, "                leay    -1,y              ; Start number of ones at -1\n");
-   fprintf(Asm, "onesd           leay    1,y               ; Add 1 to quotient\n");
-   fprintf(Asm, "                subd    #10               ; Subtract 10 from dividend\n");
-   fprintf(Asm, "                bcc     onesd             ; Branch if difference still positive\n");
-   fprintf(Asm, "                addd    #10               ; Else add back last 10\n");
-   fprintf(Asm, "                stb     ,-s               ; Save remainder in stack\n");
-   fprintf(Asm, "                inc     ,x                ; Add 1 to length byte\n");
-   fprintf(Asm, "                tfr     y,d               ; Make quotient into new dividend\n");
-   fprintf(Asm, "                cmpd    #0                ; Check if dividend zero\n");
-   fprintf(Asm, "                bne     div10             ; Branch if not - divide by 10 again\n");
-   fprintf(Asm, "; Check if original binary data was negative\n");
-   fprintf(Asm, "; If so, put ASCII - at front of buffer\n");
-   fprintf(Asm, "                lda     ,x+               ; Get length byte (not including sign)\n");
-   fprintf(Asm, ";               ldb     ,x                ; Get high byte of data\n");
-   fprintf(Asm, ";               bpl     bufload           ; Branch if data positive\n");
-   fprintf(Asm, ";               ldb     #'-'              ; Otherwise, get ASCII minus sign\n");
-   fprintf(Asm, ";               stb     ,x+               ; Store minus sign in buffer\n");
-   fprintf(Asm, ";               inc     -2,x              ; Add 1 to length byte for sign\n");
-   fprintf(Asm, "; Move string of digits from stack to buffer\n");
-   fprintf(Asm, "; Most significant digit is at top of stack\n");
-   fprintf(Asm, "; Convert digits to ASCII by adding ASCII 0\n");
-   fprintf(Asm, "bufload         ldb     ,s+               ; Get next digit from stack, moving right\n");
-   fprintf(Asm, "                addb    #'0'              ; Convert digit to ASCII\n");
-   fprintf(Asm, "                stb     ,x+               ; Save digit in buffer\n");
-   fprintf(Asm, "                deca                      ; Decrement byte counter\n");
-   fprintf(Asm, "                bne     bufload           ; Loop if more bytes left\n");
-   fprintf(Asm, "                clr     ,x                ; Add terminator to buffer\n");
-   fprintf(Asm, "                rts\n");
+   return (n == EOF);
+}
 
-   fprintf(Asm, "; void putu(const unsigned int u);\n");
-   fprintf(Asm, "_putu    pshs u                 ; Save old frame pointer\n");
-   fprintf(Asm, "         tfr  s,u               ; Make new frame pointer\n");
-   fprintf(Asm, "         ldd  4,u               ; Pick up first parameter\n");
-   /* Implement putu() here */
-   fprintf(Asm, "         ldb  #10               ; Load NEWLINE\n");
-#ifdef SIMULATOR
-   fprintf(Asm, "         lda  #5                ; SIM Print char in B register\n");
-   fprintf(Asm, "         swi                    ; SIM\n");
-#else
-   fprintf(Asm, "         tfr  b,a               ; Move char into A register\n");
-   fprintf(Asm, "         jsr  $a020             ; Send one char to the VDU\n");
-#endif   /* SIMULATOR */
-   fprintf(Asm, "         tfr  u,s               ; Deallocate stack frame\n");
-   fprintf(Asm, "         puls u                 ; Restore frame pointer\n");
-   fprintf(Asm, "         rts\n");
-   fprintf(Asm, "; void putl(const long int l);\n");
-   fprintf(Asm, "_putl    pshs u                 ; Save old frame pointer\n");
-   fprintf(Asm, "         tfr  s,u               ; Make new frame pointer\n");
-   fprintf(Asm, "         ldd  4,u               ; Pick up first parameter MSB\n");
-   fprintf(Asm, "         ldd  6,u               ; Pick up first parameter LSB\n");
-   /* Implement putl() here */
-   fprintf(Asm, "         ldb  #10               ; Load NEWLINE\n");
-#ifdef SIMULATOR
-   fprintf(Asm, "         lda  #5                ; SIM Print char in B register\n");
-   fprintf(Asm, "         swi                    ; SIM\n");
-#else
-   fprintf(Asm, "         tfr  b,a               ; Move char into A register\n");
-   fprintf(Asm, "         jsr  $a020             ; Send one char to the VDU\n");
-#endif   /* SIMULATOR */
-   fprintf(Asm, "         tfr  u,s               ; Deallocate stack frame\n");
-   fprintf(Asm, "         puls u                 ; Restore frame pointer\n");
-   fprintf(Asm, "         rts\n");
-#ifdef SIMULATOR
-   fprintf(Asm, "_vdustr  tfr  d,x               ; Move pointer into X register\n");
-   fprintf(Asm, "         jmp  $a014             ; Print a nul-terminated string\n");
-   fprintf(Asm, "_getchar jsr  $a252             ; Get char and show cursor\n");
-   fprintf(Asm, "         tfr  a,b               ; Move returned ASCII char into LSB of D register\n");
-   fprintf(Asm, "         clra                   ; Make sure MSB is zero\n");
-   fprintf(Asm, "         rts\n");
-   fprintf(Asm, "_hex2ou  tfr  b,a               ; Move char into A register\n");
-   fprintf(Asm, "         jmp  $a17c             ; Call hex2ou in EPROM\n");
-   fprintf(Asm, "_hex4ou  jmp  $a189             ; Call hex4ou in EPROM\n");
-   fprintf(Asm, "_hex8ou  pshs d                 ; Save D\n");
-   fprintf(Asm, ";        tfr  w,d               ; Transfer hi word to D\n");
-   fprintf(Asm, "         jsr  $a189             ; Call hex4ou in EPROM (hi)\n");
-   fprintf(Asm, "         puls d                 ; Restore D\n");
-   fprintf(Asm, "         jmp  $a189             ; Call hex4ou in EPROM (lo)\n");
-#endif   /* SIMULATOR */
+
+/* outOfMemory --- report failure to grow the instruction buffer and give up */
+
+static void outOfMemory(void)
+{
+   fprintf(stderr, "Out of memory for generated code\n");
+   exit(EXIT_FAILURE);
+}
+
+
+/* saveText --- copy a string into the text pool and return its offset */
+
+static int saveText(const char str[], const int len)
+{
+   const int offset = TextLen;
    
-   return (true);
+   if ((TextLen + len + 1) > MaxText) {
+      int nNew = (MaxText == 0) ? MINTEXT : MaxText;
+      
+      while (nNew < (TextLen + len + 1))
+         nNew *= 2;
+      
+      if ((Text = realloc(Text, nNew)) == NULL)
+         outOfMemory();
+      
+      MaxText = nNew;
+   }
+   
+   memcpy(&Text[TextLen], str, len);
+   Text[TextLen + len] = '\0';
+   TextLen += len + 1;
+   
+   return (offset);
 }
 
 
-/* CloseAssemblerFile --- write a trailer and close the output file */
+/* newInstruction --- append an empty record to the instruction buffer */
 
-bool CloseAssemblerFile(void)
+static struct Instruction *newInstruction(const enum InstKind kind)
 {
-   fprintf(Asm, "        end  appEntry\n");
+   struct Instruction *in;
+   
+   if (NCode >= MaxCode) {
+      const int nNew = (MaxCode == 0) ? MINCODE : MaxCode * 2;
+      
+      if ((Code = realloc(Code, nNew * sizeof (Code[0]))) == NULL)
+         outOfMemory();
+      
+      MaxCode = nNew;
+   }
+   
+   in = &Code[NCode++];
+   
+   in->kind = kind;
+   in->inst[0] = '\0';
+   in->operKind = ONONE;
+   in->value = 0;
+   in->label = NOLABEL;
+   in->oper = NOTEXT;
+   in->comment = NOTEXT;
+   in->size = 0;
+   in->addr = 0;
+   
+   return (in);
+}
 
-   fclose(Asm);
+
+/* appendInst --- append an instruction to the buffer */
+
+static struct Instruction *appendInst(const char inst[], const enum OperKind operKind, const char comment[])
+{
+   struct Instruction *in = newInstruction(IINST);
    
-   return (true);
+   strncpy(in->inst, inst, sizeof (in->inst) - 1);
+   in->inst[sizeof (in->inst) - 1] = '\0';
+   in->operKind = operKind;
+   in->comment = saveText(comment, strlen(comment));
+   
+   return (in);
 }
 
 
-/* Emit --- emit a single assembly-language instruction */
+/* emitText --- append a line of assembler source, formatted as by printf() */
 
-int Emit(const char inst[], const char oper[], const char comment[])
+static void emitText(const char fmt[], ...)
 {
-   fprintf(Asm, "        %-4s %-32s ; %s\n", inst, oper, comment);
+   struct Instruction *in = newInstruction(ITEXT);
+   char line[256];
+   va_list ap;
+   int len;
+   
+   va_start(ap, fmt);
+   len = vsnprintf(line, sizeof (line), fmt, ap);
+   va_end(ap);
+   
+   if (len >= (int)sizeof (line)) {
+      char big[len + 1];
+      
+      va_start(ap, fmt);
+      vsnprintf(big, sizeof (big), fmt, ap);
+      va_end(ap);
+      
+      in->oper = saveText(big, len);
+   }
+   else {
+      in->oper = saveText(line, len);
+   }
+}
 
-   return (1);
+
+/* emitBranch --- append a jump, branch or address constant referring to a label */
+
+static void emitBranch(const char inst[], const int label, const char comment[])
+{
+   struct Instruction *in = appendInst(inst, OLABEL, comment);
+   
+   in->label = label;
 }
 
 
-/* AllocLabel --- allocate a new label for a given purpose */
+/* emitImmediate --- append an instruction with an immediate operand */
 
-int AllocLabel(const char purpose)
+static void emitImmediate(const char inst[], const int value, const char comment[])
 {
-   return (NextLabel++);
+   struct Instruction *in = appendInst(inst, OIMMEDIATE, comment);
+   
+   in->value = value;
 }
 
 
-/* EmitLabel --- emit an allocated label into the assembly-language file */
+/* isInst --- return true if a record is the instruction 'inst' */
 
-void EmitLabel(const int label)
+static bool isInst(const struct Instruction *const in, const char inst[])
 {
-   fprintf(Asm, "l%04d\n", label);
+   return ((in->kind == IINST) && (strcmp(in->inst, inst) == 0));
 }
 
 
-/* EmitFunctionEntry --- emit a label and setup code for a function */
+/* isBranch --- return true if a record is a jump or branch to a label */
 
-void EmitFunctionEntry(const char name[], const int nBytes, const int nRegister)
+static bool isBranch(const struct Instruction *const in)
 {
-   fprintf(Asm, "%c%-44s ; Function entry point\n", NAME_PREFIX, name);
+   return ((in->kind == IINST) && (in->operKind == OLABEL) && (strcmp(in->inst, "fdb") != 0));
+}
 
-   if (nRegister == 0) {
-      Emit("pshs", "u", "Save old frame pointer");
-   }
-   else {
-      Emit("pshs", "u,y", "Save old frame pointer & register variable");
-   }
-   Emit("tfr", "s,u", "Make new frame pointer");
+
+/* endsBlock --- return true if control never passes to the following record */
+
+static bool endsBlock(const struct Instruction *const in)
+{
+   return (isInst(in, "jmp") || isInst(in, "lbra") || isInst(in, "bra") || isInst(in, "rts"));
+}
+
+
+/* nextLive --- return the index of the next record after 'i' that hasn't been deleted */
+
+static int nextLive(int i)
+{
+   for (i++; (i < NCode) && (Code[i].kind == IDELETED); i++)
+      ;
+   
+   return (i);
+}
+
+
+/* prevLive --- return the index of the record before 'i' that hasn't been deleted, or -1 */
+
+static int prevLive(int i)
+{
+   for (i--; (i >= 0) && (Code[i].kind == IDELETED); i--)
+      ;
+   
+   return (i);
+}
+
+
+/* nextInst --- return the index of the first instruction reached by falling through after 'i' */
+
+static int nextInst(int i)
+{
+   for (i++; (i < NCode) && ((Code[i].kind == IDELETED) || (Code[i].kind == ILABEL)); i++)
+      ;
+   
+   return (i);
+}
+
+
+/* deleteInst --- remove a record from the instruction buffer */
+
+static void deleteInst(const int i)
+{
+   struct Instruction *in = &Code[i];
+   
+   if ((in->operKind == OLABEL) || (in->operKind == OADDRESS))
+      LabelRefs[in->label]--;
+   
+   in->kind = IDELETED;
+}
+
+
+/* sameOperand --- return true if two instructions address the same memory */
+
+static bool sameOperand(const struct Instruction *const a, const struct Instruction *const b)
+{
+   const char *oper;
+   
+   if ((a->operKind != OTEXT) || (b->operKind != OTEXT))
+      return (false);
+   
+   oper = &Text[a->oper];
+   
+   // Auto-increment and auto-decrement change the address each time
+   if ((strstr(oper, ",-") != NULL) || (oper[strlen(oper) - 1] == '+'))
+      return (false);
+   
+   return (strcmp(oper, &Text[b->oper]) == 0);
+}
+
+
+/* jumpToNext --- 'jmp l1' where 'l1' follows immediately */
+
+static bool jumpToNext(const int i)
+{
+   int j;
+   
+   if (isBranch(&Code[i]) == false)
+      return (false);
+   
+   for (j = i + 1; (j < NCode) && ((Code[j].kind == IDELETED) || (Code[j].kind == ILABEL)); j++) {
+      if ((Code[j].kind == ILABEL) && (Code[j].label == Code[i].label)) {
+         deleteInst(i);
+         return (true);
+      }
+   }
+   
+   return (false);
+}
+
+
+/* jumpToJump --- 'jmp l1' where 'l1' is another jump, to 'l2' */
+
+static bool jumpToJump(const int i)
+{
+   struct Instruction *in = &Code[i];
+   const struct Instruction *target;
+   int j;
+   
+   if ((isBranch(in) == false) || (LabelAt[in->label] < 0))
+      return (false);
+   
+   if ((j = nextInst(LabelAt[in->label])) >= NCode)
+      return (false);
+   
+   target = &Code[j];
+   
+   if ((isInst(target, "jmp") || isInst(target, "lbra")) && (target->operKind == OLABEL) && (target->label != in->label)) {
+      LabelRefs[in->label]--;
+      in->label = target->label;
+      LabelRefs[in->label]++;
+      return (true);
+   }
+   
+   return (false);
+}
+
+
+/* branchOverJump --- 'lbeq l1' then 'jmp l2' then 'l1', which is just 'lbne l2' */
+
+static bool branchOverJump(const int i)
+{
+   static const char *const pairs[][2] = {
+      {"lbeq", "lbne"}, {"lblt", "lbge"}, {"lble", "lbgt"},
+      {"lblo", "lbhs"}, {"lbls", "lbhi"}
+   };
+   const int npairs = sizeof (pairs) / sizeof (pairs[0]);
+   struct Instruction *in = &Code[i];
+   int j, k, p;
+   
+   if ((isBranch(in) == false) || (in->inst[0] != 'l') || isInst(in, "lbra") || isInst(in, "lbsr"))
+      return (false);
+   
+   if ((j = nextLive(i)) >= NCode)
+      return (false);
+   
+   if (((isInst(&Code[j], "jmp") || isInst(&Code[j], "lbra")) && (Code[j].operKind == OLABEL)) == false)
+      return (false);
+   
+   // The branch must be to the label just after the jump
+   for (k = nextLive(j); (k < NCode) && (Code[k].kind == ILABEL) && (Code[k].label != in->label); k = nextLive(k))
+      ;
+   
+   if ((k >= NCode) || (Code[k].kind != ILABEL))
+      return (false);
+   
+   for (p = 0; p < npairs; p++) {
+      if (strcmp(in->inst, pairs[p][0]) == 0) {
+         strcpy(in->inst, pairs[p][1]);
+         break;
+      }
+      else if (strcmp(in->inst, pairs[p][1]) == 0) {
+         strcpy(in->inst, pairs[p][0]);
+         break;
+      }
+   }
+   
+   if (p == npairs)
+      return (false);
+   
+   LabelRefs[in->label]--;
+   in->label = Code[j].label;
+   LabelRefs[in->label]++;
+   deleteInst(j);
+   
+   return (true);
+}
+
+
+/* unreachable --- instructions after a jump or return, up to the next label that's used */
+
+static bool unreachable(const int i)
+{
+   bool changed = false;
+   int j;
+   
+   if (endsBlock(&Code[i]) == false)
+      return (false);
+   
+   for (j = nextLive(i); j < NCode; j = nextLive(j)) {
+      if (Code[j].kind == ITEXT)
+         break;
+      else if ((Code[j].kind == ILABEL) && (LabelRefs[Code[j].label] > 0))
+         break;
+      else if (Code[j].kind == IINST) {
+         deleteInst(j);
+         changed = true;
+      }
+   }
+   
+   return (changed);
+}
+
+
+/* unusedLabel --- a label that nothing jumps to */
+
+static bool unusedLabel(const int i)
+{
+   if ((Code[i].kind != ILABEL) || (LabelRefs[Code[i].label] > 0))
+      return (false);
+   
+   Code[i].kind = IDELETED;
+   
+   return (true);
+}
+
+
+/* storeThenLoad --- 'std x' then 'ldd x', when D already holds the value */
+
+static bool storeThenLoad(const int i)
+{
+   static const char *const pairs[][2] = {
+      {"std", "ldd"}, {"stx", "ldx"}, {"sty", "ldy"}, {"stq", "ldq"}
+   };
+   int j, p;
+   
+   if (((j = nextLive(i)) >= NCode) || (Code[i].kind != IINST) || (Code[j].kind != IINST))
+      return (false);
+   
+   for (p = 0; p < (int)(sizeof (pairs) / sizeof (pairs[0])); p++) {
+      if (isInst(&Code[i], pairs[p][0]) && isInst(&Code[j], pairs[p][1]) && sameOperand(&Code[i], &Code[j])) {
+         // The load would set the flags just as the store did
+         deleteInst(j);
+         return (true);
+      }
+   }
+   
+   return (false);
+}
+
+
+/* transferBack --- 'tfr d,y' then 'tfr y,d', which changes nothing */
+
+static bool transferBack(const int i)
+{
+   const char *from;
+   const char *to;
+   int j;
+   
+   if (((j = nextLive(i)) >= NCode) || (isInst(&Code[i], "tfr") == false) || (isInst(&Code[j], "tfr") == false))
+      return (false);
+   
+   if ((Code[i].operKind != OTEXT) || (Code[j].operKind != OTEXT))
+      return (false);
+   
+   from = &Text[Code[i].oper];
+   to = &Text[Code[j].oper];
+   
+   // Both registers are the same size, or 'tfr' wouldn't have been used
+   if ((strlen(from) == 3) && (strlen(to) == 3) && (from[0] == to[2]) && (from[2] == to[0])) {
+      deleteInst(j);
+      return (true);
+   }
+   
+   return (false);
+}
+
+
+/* compareWithZero --- 'cmpd #0' when the flags already reflect D */
+
+static bool compareWithZero(const int i)
+{
+   struct Instruction *in = &Code[i];
+   const struct Instruction *prev;
+   const struct Instruction *next;
+   bool zeroOnly;
+   int p, n;
+   
+   if ((isInst(in, "cmpd") == false) || (in->operKind != OIMMEDIATE) || (in->value != 0))
+      return (false);
+   
+   if (((n = nextLive(i)) >= NCode) || ((p = prevLive(i)) < 0))
+      return (false);
+   
+   next = &Code[n];
+   prev = &Code[p];
+   
+   // A test for zero only needs Z. Loads and stores also set N from D and
+   // clear V, just as 'cmpd #0' would, so signed tests work after those.
+   zeroOnly = isInst(next, "lbeq") || isInst(next, "lbne") || isInst(next, "beq") || isInst(next, "bne");
+   
+   if ((zeroOnly == false) && (isInst(next, "lblt") || isInst(next, "lble") || isInst(next, "lbgt") || isInst(next, "lbge")) == false)
+      return (false);
+   
+   if (isInst(prev, "ldd") || isInst(prev, "std")) {
+      deleteInst(i);
+      return (true);
+   }
+   
+   if (zeroOnly == false)
+      return (false);
+   
+   if (isInst(prev, "addd") || isInst(prev, "subd")) {
+      deleteInst(i);
+      return (true);
+   }
+   
+   // A register variable: 'leay ,y' or 'tstw' sets Z more cheaply than 'cmpd #0'
+   if (isInst(prev, "tfr") && (prev->operKind == OTEXT) && (strcmp(&Text[prev->oper], "y,d") == 0)) {
+      strcpy(in->inst, "leay");
+      in->operKind = OTEXT;
+      in->oper = saveText(",y", 2);
+      return (true);
+   }
+   
+   if (isInst(prev, "tfr") && (prev->operKind == OTEXT) && (strcmp(&Text[prev->oper], "w,d") == 0)) {
+      strcpy(in->inst, "tstw");
+      in->operKind = ONONE;
+      return (true);
+   }
+   
+   return (false);
+}
+
+
+/* stackBeforeExit --- 'leas' just before the frame pointer is copied back into S */
+
+static bool stackBeforeExit(const int i)
+{
+   const int j = nextInst(i);
+   
+   if ((isInst(&Code[i], "leas") == false) || (j >= NCode))
+      return (false);
+   
+   if (isInst(&Code[j], "tfr") && (Code[j].operKind == OTEXT) && (strcmp(&Text[Code[j].oper], "u,s") == 0)) {
+      deleteInst(i);
+      return (true);
+   }
+   
+   return (false);
+}
+
+
+/* adjacentStack --- 'leas a,s' then 'leas b,s', or 'leas 0,s' */
+
+static bool adjacentStack(const int i)
+{
+   const int j = nextLive(i);
+   char oper[16];
+   int a, b;
+   
+   if ((isInst(&Code[i], "leas") == false) || (Code[i].operKind != OTEXT) ||
+       (sscanf(&Text[Code[i].oper], "%d,s", &a) != 1) || (strstr(&Text[Code[i].oper], ",s") == NULL))
+      return (false);
+   
+   if (a == 0) {
+      deleteInst(i);
+      return (true);
+   }
+   
+   if ((j >= NCode) || (isInst(&Code[j], "leas") == false) || (Code[j].operKind != OTEXT) ||
+       (sscanf(&Text[Code[j].oper], "%d,s", &b) != 1) || (strstr(&Text[Code[j].oper], ",s") == NULL))
+      return (false);
+   
+   snprintf(oper, sizeof (oper), "%d,s", a + b);
+   Code[i].oper = saveText(oper, strlen(oper));
+   deleteInst(j);
+   
+   return (true);
+}
+
+
+// Each rule looks at the record at one index and returns true if it
+// changed anything. Rules may delete records, but never insert them.
+static bool (*const PeepholeRules[])(const int i) = {
+   jumpToNext,
+   jumpToJump,
+   branchOverJump,
+   unreachable,
+   unusedLabel,
+   storeThenLoad,
+   transferBack,
+   compareWithZero,
+   stackBeforeExit,
+   adjacentStack
+};
+
+
+/* indexLabels --- find where each label is defined and count its uses */
+
+static void indexLabels(void)
+{
+   int i;
+   
+   if (NextLabel > MaxLabels) {
+      free(LabelAt);
+      free(LabelRefs);
+      
+      MaxLabels = NextLabel * 2;
+      
+      if (((LabelAt = malloc(MaxLabels * sizeof (int))) == NULL) ||
+          ((LabelRefs = malloc(MaxLabels * sizeof (int))) == NULL))
+         outOfMemory();
+   }
+   
+   for (i = 0; i < NextLabel; i++) {
+      LabelAt[i] = -1;
+      LabelRefs[i] = 0;
+   }
+   
+   for (i = 0; i < NCode; i++) {
+      if (Code[i].kind == ILABEL)
+         LabelAt[Code[i].label] = i;
+      else if ((Code[i].operKind == OLABEL) || (Code[i].operKind == OADDRESS))
+         LabelRefs[Code[i].label]++;
+   }
+}
+
+
+/* peephole --- apply the peephole rules to the buffer until nothing changes */
+
+static void peephole(void)
+{
+   const int nRules = sizeof (PeepholeRules) / sizeof (PeepholeRules[0]);
+   bool changed;
+   int pass, i, r, n;
+   
+   indexLabels();
+   
+   pass = 0;
+   
+   do {
+      changed = false;
+      
+      for (i = 0; i < NCode; i++)
+         for (r = 0; (r < nRules) && (Code[i].kind != IDELETED); r++)
+            if (PeepholeRules[r](i))
+               changed = true;
+   } while (changed && (++pass < MAXPASSES));
+   
+   // Squeeze out the deleted records
+   for (i = 0, n = 0; i < NCode; i++)
+      if (Code[i].kind != IDELETED)
+         Code[n++] = Code[i];
+   
+   NCode = n;
+}
+
+
+/* uOffset --- return true if an operand is 'n,u' or '[n,u]', and give 'n' */
+
+static bool uOffset(const char oper[], int *offset)
+{
+   const char *p = (oper[0] == '[') ? &oper[1] : oper;
+   char *end;
+   
+   *offset = strtol(p, &end, 10);
+   
+   if ((end == p) || (strncmp(end, ",u", 2) != 0))
+      return (false);
+   
+   return ((oper[0] == '[') ? (strcmp(end, ",u]") == 0) : (end[2] == '\0'));
+}
+
+
+/* stackEffect --- work out how an instruction moves S, or return false if we can't tell */
+
+static bool stackEffect(const struct Instruction *const in, int *depth)
+{
+   const char *oper = (in->operKind == OTEXT) ? &Text[in->oper] : "";
+   const char *p;
+   int n;
+   
+   if (isInst(in, "pshs") || isInst(in, "puls")) {
+      for (p = oper, n = 0; *p != '\0'; p += strcspn(p, ","), p += (*p == ',')) {
+         if ((strncmp(p, "a", 1) == 0) || (strncmp(p, "b", 1) == 0) || (strncmp(p, "cc", 2) == 0) || (strncmp(p, "dp", 2) == 0))
+            n += 1;
+         else if ((strncmp(p, "d", 1) == 0) || (strncmp(p, "x", 1) == 0) || (strncmp(p, "y", 1) == 0))
+            n += 2;
+         else
+            return (false);       // U, S or PC
+      }
+      
+      *depth += isInst(in, "pshs") ? n : -n;
+   }
+   else if (isInst(in, "pshsw") || isInst(in, "pulsw")) {
+      *depth += isInst(in, "pshsw") ? 2 : -2;
+   }
+   else if (isInst(in, "leas")) {
+      if ((sscanf(oper, "%d,s", &n) != 1) || (strstr(oper, ",s") == NULL))
+         return (false);
+      
+      *depth -= n;
+   }
+   else if ((strstr(oper, ",s++") != NULL) || (strstr(oper, ",s+") != NULL)) {
+      *depth -= (strstr(oper, ",s++") != NULL) ? 2 : 1;
+   }
+   else if (isInst(in, "lds") || isInst(in, "leau") || isInst(in, "ldu") || isInst(in, "rts") ||
+            ((isInst(in, "tfr") || isInst(in, "exg")) && (strpbrk(oper, "su") != NULL))) {
+      return (false);
+   }
+   else if ((strstr(oper, ",u") != NULL) && (uOffset(oper, &n) == false)) {
+      return (false);             // Some other use of the frame pointer
+   }
+   
+   return (true);
+}
+
+
+/* omitFramePointer --- address the frame relative to S, so that U needn't be saved and set up */
+
+static void omitFramePointer(void)
+{
+   int *depthAt;
+   int *newDepth;
+   int depth = 0;
+   int entry, exit, i, j, k;
+   bool ok = true;
+   char oper[40];
+   const char *text;
+   
+   // Find 'pshs u' or 'pshs u,y', and 'tfr s,u', at the start, and 'tfr u,s' at the end
+   for (entry = EntryAt; (entry < NCode) && (Code[entry].kind != IINST); entry++)
+      ;
+   
+   for (exit = NCode - 1; (exit > entry) && (isInst(&Code[exit], "tfr") == false); exit--)
+      ;
+   
+   if ((entry >= NCode) || (exit <= entry) || (strcmp(&Text[Code[exit].oper], "u,s") != 0))
+      return;
+   
+   j = entry + ((FrameRegisters > 1) ? 2 : 1);
+   
+   if ((isInst(&Code[entry], "pshs") == false) || (isInst(&Code[j], "tfr") == false) ||
+       (strcmp(&Text[Code[j].oper], "s,u") != 0))
+      return;
+   
+   if (((depthAt = malloc(NextLabel * sizeof (int))) == NULL) ||
+       ((newDepth = malloc(NCode * sizeof (int))) == NULL))
+      outOfMemory();
+   
+   for (i = 0; i < NextLabel; i++)
+      depthAt[i] = INT_MIN;
+   
+   // Follow the depth of S below U through the body. Every path
+   // to a label must agree, or we can't know where the frame is.
+   for (i = j + 1; ok && (i < exit); i++) {
+      const struct Instruction *in = &Code[i];
+      
+      newDepth[i] = depth;
+      
+      switch (in->kind) {
+      case ILABEL:
+         for (k = i - 1; (k > j) && (Code[k].kind != IINST); k--)
+            ;
+         
+         if (depthAt[in->label] == INT_MIN)
+            depthAt[in->label] = depth;
+         else if (endsBlock(&Code[k]))
+            depth = depthAt[in->label];
+         else if (depthAt[in->label] != depth)
+            ok = false;
+         
+         newDepth[i] = depth;
+         break;
+      case IINST:
+         if ((in->operKind == OLABEL) && (isInst(in, "jsr") == false) && (isInst(in, "lbsr") == false)) {
+            if (depthAt[in->label] == INT_MIN)
+               depthAt[in->label] = depth;
+            else if (depthAt[in->label] != depth)
+               ok = false;
+         }
+         
+         if (isInst(in, "leas") && (in->operKind == OTEXT) && uOffset(&Text[in->oper], &k)) {
+            depth = -k;                      // Block entry or exit, 'leas -n,u'
+         }
+         else if (stackEffect(in, &depth) == false) {
+            ok = false;
+         }
+         break;
+      default:
+         break;
+      }
+   }
+   
+   if (ok) {
+      newDepth[exit] = depth;
+      
+      // Saved registers lie between the frame and the return address, but U no longer does
+      for (i = j + 1; i <= exit; i++) {
+         struct Instruction *in = &Code[i];
+         
+         if ((in->kind != IINST) || (in->operKind != OTEXT) || (uOffset(&Text[in->oper], &k) == false))
+            continue;
+         
+         if (isInst(in, "leas")) {
+            if ((k += newDepth[i]) == 0) {
+               deleteInst(i);
+               continue;
+            }
+         }
+         else {
+            if (k >= 2 * FrameRegisters)
+               k -= 2;
+            
+            k += newDepth[i];
+         }
+         
+         text = &Text[in->oper];
+         
+         if (text[0] == '[')
+            snprintf(oper, sizeof (oper), "[%d,s]", k);
+         else
+            snprintf(oper, sizeof (oper), "%d,s", k);
+         
+         in->oper = saveText(oper, strlen(oper));
+      }
+      
+      // The exit has to discard the frame and anything still on the stack
+      if (depth == 0) {
+         deleteInst(exit);
+      }
+      else {
+         strcpy(Code[exit].inst, "leas");
+         snprintf(oper, sizeof (oper), "%d,s", depth);
+         Code[exit].oper = saveText(oper, strlen(oper));
+      }
+      
+      deleteInst(j);
+      
+      for (k = exit + 1; (k < NCode) && (isInst(&Code[k], "puls") == false); k++)
+         ;
+      
+      if (FrameRegisters == 0) {
+         deleteInst(entry);
+         deleteInst(k);
+      }
+      else {
+         Code[entry].oper = saveText("y", 1);
+         Code[entry].comment = saveText("Save register variable", 22);
+         Code[k].oper = saveText("y", 1);
+         Code[k].comment = saveText("Restore register variable", 25);
+      }
+   }
+   
+   free(depthAt);
+   free(newDepth);
+}
+
+
+/* insertCode --- open up a gap of 'n' empty records in front of record 'i' */
+
+static void insertCode(const int i, const int n)
+{
+   int k;
+   
+   for (k = 0; k < n; k++)
+      newInstruction(IDELETED);
+   
+   memmove(&Code[i + n], &Code[i], (NCode - n - i) * sizeof (Code[0]));
+}
+
+
+/* tailCalls --- make a call that's followed only by the exit sequence go straight to the function */
+
+static void tailCalls(const int returnLabel, const int exit)
+{
+   int epilogue[MAXEPILOGUE];
+   int nEpilogue = 0;
+   int i, j, k;
+   
+   // Whatever is left of the exit sequence, once the frame pointer may have gone
+   for (i = exit + 1; (i < NCode) && (isInst(&Code[i], "rts") == false); i++) {
+      if (Code[i].kind != IINST)
+         continue;
+      
+      if (nEpilogue == MAXEPILOGUE)
+         return;
+      
+      epilogue[nEpilogue++] = i;
+   }
+   
+   for (i = exit - 1; i > EntryAt; i--) {
+      if (isInst(&Code[i], "jsr") == false)
+         continue;
+      
+      for (j = i + 1; (Code[j].kind == IDELETED) || ((Code[j].kind == ILABEL) && (Code[j].label != returnLabel)); j++)
+         ;
+      
+      // Falls into the exit sequence, or jumps to it, with nothing to tidy up after the call
+      if ((Code[j].kind != ILABEL) && ((endsBlock(&Code[j]) == false) || (Code[j].operKind != OLABEL) ||
+                                       (Code[j].label != returnLabel)))
+         continue;
+      
+      insertCode(i, nEpilogue);
+      
+      for (k = 0; k < nEpilogue; k++) {
+         epilogue[k] += nEpilogue;
+         Code[i + k] = Code[epilogue[k]];
+      }
+      
+      strcpy(Code[i + nEpilogue].inst, "jmp");
+      Code[i + nEpilogue].comment = saveText("Tail call", 9);
+   }
+}
+
+
+/* isPrefixed --- return true if an instruction has a $10 or $11 page prefix */
+
+static bool isPrefixed(const char inst[])
+{
+   static const char *const prefixed[] = {
+      "ldy", "sty", "lds", "sts", "cmpd", "cmpy", "cmpu", "cmps",
+      "ldq", "stq", "ldw", "stw", "addw", "subw", "cmpw",
+      "clrd", "clrw", "incd", "decd", "tstd", "negd", "comd",
+      "incw", "decw", "tstw", "pshsw", "pulsw",
+      "asld", "asrd", "lsrd", "rold", "rord", "swi2", "swi3"
+   };
+   int i;
+   
+   // Long conditional branches, but not 'lbra' and 'lbsr'
+   if ((inst[0] == 'l') && (inst[1] == 'b') && (strcmp(inst, "lbra") != 0) && (strcmp(inst, "lbsr") != 0))
+      return (true);
+   
+   for (i = 0; i < (int)(sizeof (prefixed) / sizeof (prefixed[0])); i++)
+      if (strcmp(inst, prefixed[i]) == 0)
+         return (true);
+   
+   return (false);
+}
+
+
+/* immediateSize --- return the number of bytes in an instruction's immediate operand */
+
+static int immediateSize(const char inst[])
+{
+   const int len = strlen(inst);
+   
+   if (strcmp(inst, "ldq") == 0)
+      return (4);
+   
+   // 'ldd', 'addd', 'cmpx', 'ldu', 'ldw' and so on
+   if ((strchr("dxyusw", inst[len - 1]) != NULL) && (strcmp(inst, "andcc") != 0))
+      return (2);
+   
+   return (1);
+}
+
+
+/* indexedSize --- return the number of bytes after the postbyte of an indexed operand */
+
+static int indexedSize(const char oper[])
+{
+   const bool indirect = (oper[0] == '[');
+   const char *p = indirect ? &oper[1] : oper;
+   char *end;
+   long int offset;
+   
+   if (*p == ',')                                  // ',x', ',x++' or ',--x'
+      return (0);
+   
+   if ((p[1] == ',') && (strchr("abdefwABDEFW", p[0]) != NULL))
+      return (0);                                  // Accumulator offset, e.g. 'd,x'
+   
+   offset = strtol(p, &end, 10);
+   
+   if ((end == p) || (*end != ','))                // Symbolic offset, or extended indirect
+      return (2);
+   
+   if ((offset == 0) || ((indirect == false) && (offset >= -16) && (offset <= 15)))
+      return (0);
+   
+   if ((offset >= -128) && (offset <= 127))
+      return (1);
+   
+   return (2);
+}
+
+
+/* instSize --- return an upper bound on the bytes of object code for a record */
+
+static int instSize(const struct Instruction *const in)
+{
+   const char *line;
+   int len;
+   
+   switch (in->kind) {
+   case ILABEL:
+   case IDELETED:
+      return (0);
+   case ITEXT:
+      // A comment, or a name on its own, such as a function entry point
+      line = &Text[in->oper];
+      len = strcspn(line, " ;\n");
+      line += len + strspn(&line[len], " ");
+      
+      return (((*line == ';') || (*line == '\n') || (*line == '\0')) ? 0 : UNKNOWNSIZE);
+   case IINST:
+      break;
+   }
+   
+   len = isPrefixed(in->inst) ? 2 : 1;
+   
+   switch (in->operKind) {
+   case ONONE:
+      return (len);
+   case OIMMEDIATE:
+   case OADDRESS:
+      return (len + immediateSize(in->inst));
+   case OLABEL:
+      if (strcmp(in->inst, "fdb") == 0)
+         return (2);
+      else if ((in->inst[0] == 'b') || (strcmp(in->inst, "lbra") == 0) || (strcmp(in->inst, "lbsr") == 0))
+         return (len + ((in->inst[0] == 'b') ? 1 : 2));
+      else if (in->inst[0] == 'l')
+         return (len + 2);                         // Long conditional branch
+      else
+         return (len + 2);                         // 'jmp' or 'jsr' extended
+   case OTEXT:
+      break;
+   }
+   
+   line = &Text[in->oper];
+   
+   if ((strcmp(in->inst, "tfr") == 0) || (strcmp(in->inst, "exg") == 0) ||
+       (strncmp(in->inst, "psh", 3) == 0) || (strncmp(in->inst, "pul", 3) == 0))
+      return (2);
+   
+   if (line[0] == '#')
+      return (len + immediateSize(in->inst));
+   
+   if ((strchr(line, ',') != NULL) || (line[0] == '['))
+      return (len + 1 + indexedSize(line));
+   
+   return (len + 2);                               // Extended
+}
+
+
+/* isRelaxable --- return true if a record is a jump or branch that may be made shorter */
+
+static bool isRelaxable(const struct Instruction *const in)
+{
+   if ((isBranch(in) == false) || (strcmp(in->inst, "jsr") == 0) || (strcmp(in->inst, "lbsr") == 0))
+      return (false);
+   
+   return ((strcmp(in->inst, "jmp") == 0) || (in->inst[0] == 'l'));
+}
+
+
+/* relaxBranches --- give each jump and branch the shortest form that reaches its target */
+
+static void relaxBranches(void)
+{
+   struct Instruction *in;
+   bool changed;
+   int addr, target, i;
+   
+   indexLabels();
+   
+   // Start by assuming every branch can be short, then lengthen the
+   // ones that can't. Branches only ever grow, so this must settle.
+   for (i = 0; i < NCode; i++)
+      Code[i].size = isRelaxable(&Code[i]) ? 2 : instSize(&Code[i]);
+   
+   do {
+      changed = false;
+      
+      for (i = 0, addr = 0; i < NCode; i++) {
+         Code[i].addr = addr;
+         addr += Code[i].size;
+      }
+      
+      for (i = 0; i < NCode; i++) {
+         in = &Code[i];
+         
+         if ((in->size != 2) || (isRelaxable(in) == false))
+            continue;
+         
+         if (LabelAt[in->label] < 0) {
+            in->size = instSize(in);
+            changed = true;
+         }
+         else {
+            target = Code[LabelAt[in->label]].addr - (in->addr + 2);
+            
+            if ((target < -128) || (target > 127)) {
+               in->size = instSize(in);
+               changed = true;
+            }
+         }
+      }
+   } while (changed);
+   
+   for (i = 0; i < NCode; i++) {
+      in = &Code[i];
+      
+      if ((in->size == 2) && isRelaxable(in)) {
+         if (strcmp(in->inst, "jmp") == 0)
+            strcpy(in->inst, "bra");
+         else
+            memmove(in->inst, &in->inst[1], strlen(in->inst));    // 'lbeq' to 'beq'
+      }
+   }
+}
+
+
+/* flushCode --- write out the instruction buffer as assembler source and empty it */
+
+static void flushCode(void)
+{
+   const struct Instruction *in;
+   char oper[16];
+   int i;
+   
+   if (Optimise) {
+      peephole();
+      relaxBranches();
+   }
+   
+   for (i = 0; i < NCode; i++) {
+      in = &Code[i];
+      
+      switch (in->kind) {
+      case ILABEL:
+         fprintf(Asm, "l%04d\n", in->label);
+         break;
+      case ITEXT:
+         fputs(&Text[in->oper], Asm);
+         break;
+      case IDELETED:
+         break;
+      case IINST:
+         switch (in->operKind) {
+         case ONONE:
+            fprintf(Asm, "        %-4s %-32s ; %s\n", in->inst, "", &Text[in->comment]);
+            break;
+         case OIMMEDIATE:
+            snprintf(oper, sizeof (oper), "#%d", in->value);
+            fprintf(Asm, "        %-4s %-32s ; %s\n", in->inst, oper, &Text[in->comment]);
+            break;
+         case OLABEL:
+            snprintf(oper, sizeof (oper), "l%04d", in->label);
+            fprintf(Asm, "        %-4s %-32s ; %s\n", in->inst, oper, &Text[in->comment]);
+            break;
+         case OADDRESS:
+            snprintf(oper, sizeof (oper), "#l%04d", in->label);
+            fprintf(Asm, "        %-4s %-32s ; %s\n", in->inst, oper, &Text[in->comment]);
+            break;
+         case OTEXT:
+            fprintf(Asm, "        %-4s %-32s ; %s\n", in->inst, &Text[in->oper], &Text[in->comment]);
+            break;
+         }
+         break;
+      }
+   }
+   
+   NCode = 0;
+   TextLen = 0;
+}
+
+
+/* compareBenefit --- order globals by how much they gain from the direct page, for qsort() */
+
+static int compareBenefit(const void *a, const void *b)
+{
+   const struct GlobalVar *const g1 = *(const struct GlobalVar *const *)a;
+   const struct GlobalVar *const g2 = *(const struct GlobalVar *const *)b;
+   const long int gain1 = (long int)g1->accesses * g2->size;
+   const long int gain2 = (long int)g2->accesses * g1->size;
+   
+   // Most accesses per byte first, then in order of declaration
+   if (gain1 != gain2)
+      return ((gain1 > gain2) ? -1 : 1);
+   else
+      return ((g1 < g2) ? -1 : 1);
+}
+
+
+/* writeDirectPage --- put the busiest globals into the direct page and report what went there */
+
+static void writeDirectPage(void)
+{
+   struct GlobalVar **byBenefit;
+   struct GlobalVar *g;
+   int nBytes = 0;
+   int nDirect = 0;
+   int bytesSaved = 0;
+   int cyclesSaved = 0;
+   int i, j;
+   
+   if ((Optimise == false) || (NGlobals == 0)) {
+      return;
+   }
+   
+   if ((byBenefit = malloc(NGlobals * sizeof (byBenefit[0]))) == NULL)
+      outOfMemory();
+   
+   for (i = 0; i < NGlobals; i++) {
+      g = &Globals[i];
+      g->accesses = g->refs;
+      g->profiled = false;
+      
+      for (j = 0; j < NProfile; j++) {
+         if (strcmp(Profile[j].name, g->name) == 0) {
+            g->accesses = Profile[j].count;
+            g->profiled = true;
+         }
+      }
+      
+      byBenefit[i] = g;
+   }
+   
+   qsort(byBenefit, NGlobals, sizeof (byBenefit[0]), compareBenefit);
+   
+   // Each access to the direct page saves a byte of code and a cycle
+   for (i = 0; i < NGlobals; i++) {
+      g = byBenefit[i];
+      
+      if ((g->accesses > 0) && ((nBytes + g->size) <= DPSIZE)) {
+         g->direct = true;
+         nBytes += g->size;
+         nDirect++;
+         bytesSaved += g->refs;
+         cyclesSaved += g->accesses;
+      }
+   }
+   
+   if (nDirect > 0) {
+      fprintf(Asm, "; Direct page: %d of %d variables in %d of %d bytes from $%04x\n", nDirect, NGlobals, nBytes, DPSIZE, DPBASE);
+      
+      fprintf(Asm, ";    %-24s Size  Refs  Accesses\n", "Variable");
+      
+      for (i = 0; i < NGlobals; i++) {
+         g = byBenefit[i];
+         
+         if (g->direct) {
+            fprintf(Asm, ";    %-24s %4d  %4d  %8d%s\n", g->name, g->size, g->refs, g->accesses,
+                    g->profiled ? " (profile)" : "");
+         }
+      }
+      
+      fprintf(Asm, "; Saves %d bytes of code and about %d cycles\n", bytesSaved, cyclesSaved);
+      fprintf(Asm, "         org   $%04x\n", DPBASE);
+      
+      for (i = 0; i < NGlobals; i++) {
+         if (byBenefit[i]->direct) {
+            fputs(byBenefit[i]->def, Asm);
+         }
+      }
+   }
+   
+   free(byBenefit);
+}
+
+
+/* writeHeader --- write the start-up code and the library functions, and anything in the direct page */
+
+static void writeHeader(void)
+{
+   fprintf(Asm, "         setdp 0\n");
+   writeDirectPage();
+   fprintf(Asm, "         org   $0400\n");
+   fprintf(Asm, "appEntry sts  saveSP            ; Save initial SP in case we call 'exit()'\n");
+#ifdef SIMULATOR
+   fprintf(Asm, "         lda  #3                ; SIM Into CBREAK mode\n");
+   fprintf(Asm, "         swi                    ; SIM\n");
+#endif
+   fprintf(Asm, "         jsr  _main\n");
+   fprintf(Asm, "appExit\n");
+#ifdef SIMULATOR
+   fprintf(Asm, "         lda  #4                ; SIM Out of CBREAK mode\n");
+   fprintf(Asm, "         swi                    ; SIM\n");
+   fprintf(Asm, "         lda  #0                ; SIM Terminate\n");
+   fprintf(Asm, "         swi                    ; SIM\n");
+#else
+   fprintf(Asm, "         rts\n");
+#endif   /* SIMULATOR */
+   fprintf(Asm, "saveSP   fdb  0                 ; Space to store initial SP\n");
+   fprintf(Asm, "_exit    lds  saveSP            ; Recover initial SP\n");
+   fprintf(Asm, "         bra  appExit           ; Branch to instruction after 'main()'\n");
+   fprintf(Asm, "; void putchar(const int ch);\n");
+   fprintf(Asm, "_putchar pshs u                 ; Save old frame pointer\n");
+   fprintf(Asm, "         tfr  s,u               ; Make new frame pointer\n");
+   fprintf(Asm, "         ldd  4,u               ; Pick up first parameter\n");
+#ifdef SIMULATOR
+   fprintf(Asm, "         lda  #5                ; SIM Print char in B register\n");
+   fprintf(Asm, "         swi                    ; SIM\n");
+#else
+   fprintf(Asm, "         tfr  b,a               ; Move char into A register\n");
+   fprintf(Asm, "         jsr  $a020             ; Send one char to the VDU\n");
+#endif   /* SIMULATOR */
+   fprintf(Asm, "         tfr  u,s               ; Deallocate stack frame\n");
+   fprintf(Asm, "         puls u                 ; Restore frame pointer\n");
+   fprintf(Asm, "         rts\n");
+   fprintf(Asm, "; void puts(const char *const s);\n");
+   fprintf(Asm, "_puts    pshs u                 ; Save old frame pointer\n");
+   fprintf(Asm, "         tfr  s,u               ; Make new frame pointer\n");
+   fprintf(Asm, "         ldx  4,u               ; Pick up first parameter\n");
+   fprintf(Asm, "puts1    ldb  ,x+               ; Load char from string\n");
+   fprintf(Asm, "         beq  puts2             ; Exit loop if end-of-string NUL\n");
+#ifdef SIMULATOR
+   fprintf(Asm, "         lda  #5                ; SIM Print char in B register\n");
+   fprintf(Asm, "         swi                    ; SIM\n");
+#else
+   fprintf(Asm, "         tfr  b,a               ; Move char into A register\n");
+   fprintf(Asm, "         jsr  $a020             ; Send one char to the VDU\n");
+#endif   /* SIMULATOR */
+   fprintf(Asm, "         bra  puts1             ; Loop back for next character\n");
+   fprintf(Asm, "puts2    ldb  #10               ; Load NEWLINE\n");
+#ifdef SIMULATOR
+   fprintf(Asm, "         lda  #5                ; SIM Print char in B register\n");
+   fprintf(Asm, "         swi                    ; SIM\n");
+#else
+   fprintf(Asm, "         tfr  b,a               ; Move char into A register\n");
+   fprintf(Asm, "         jsr  $a020             ; Send one char to the VDU\n");
+#endif   /* SIMULATOR */
+   fprintf(Asm, "         tfr  u,s               ; Deallocate stack frame\n");
+   fprintf(Asm, "         puls u                 ; Restore frame pointer\n");
+   fprintf(Asm, "         rts\n");
+   fprintf(Asm, "; void puti(const int i);\n");
+   fprintf(Asm, "decbuf   rmb     16             ; Decimal digit buffer\n");
+   fprintf(Asm, "_puti    pshs u                 ; Save old frame pointer\n");
+   fprintf(Asm, "         tfr  s,u               ; Make new frame pointer\n");
+   fprintf(Asm, "         ldd  4,u               ; Pick up first parameter\n");
+   fprintf(Asm, "         pshs y                 ; Save any register variable in Y\n");
+   fprintf(Asm, "         ldx  #decbuf           ; X points to buffer for decimal digits\n");
+   fprintf(Asm, "         jsr  bn2dec            ; Convert 16-bit binary to decimal ASCII\n");
+   fprintf(Asm, "         puls y                 ; Restore any register variable that we saved\n");
+   fprintf(Asm, "         ldx  #decbuf+1         ; X points to buffer\n");
+   fprintf(Asm, "         bra  puts1             ; Heinous jump into the middle of puts()\n");
+   
+   fprintf(Asm, "bn2dec          std     1,x               ; Save data in buffer\n");
+   fprintf(Asm, ";               bpl     cnvert            ; Branch if data positive\n");
+   fprintf(Asm, ";               ldd     #0                ; else take positive value\n");
+   fprintf(Asm, ";               subd    1,x\n");
+   fprintf(Asm, "; Initialise string length to zero\n");
+   fprintf(Asm, "cnvert          clr     ,x                ; String length = 0\n");
+   fprintf(Asm, "; Divide binary data by 10 by subtracting powers of ten\n");
+   fprintf(Asm, "div10           ldy     #-1000            ; Start quotient at -1000\n");
+   fprintf(Asm, "; Find number of thousands in quotient\n");
+   fprintf(Asm, "thousd          leay    1000,y            ; Add 1000 to quotient\n");
+   fprintf(Asm, "                subd    #10000            ; Subtract 10000 from dividend\n");
+   fprintf(Asm, "                bcc     thousd            ; Branch if difference still positive\n");
+   fprintf(Asm, "                addd    #10000            ; Else add back last 10000\n");
+   fprintf(Asm, "; Find number of hundreds in quotient\n");
+   fprintf(Asm, "                leay    -100,y            ; Start number of hundreds at -1\n");
+   fprintf(Asm, "hundd           leay    100,y             ; Add 100 to quotient\n");
+   fprintf(Asm, "                subd    #1000             ; Subtract 1000 from dividend\n");
+   fprintf(Asm, "                bcc     hundd             ; Branch if difference still positive\n");
+   fprintf(Asm, "                addd    #1000             ; Else add back last 1000\n");
+   fprintf(Asm, "; Find number of tens in quotient\n");
+   fprintf(Asm, "                leay    -10,y             ; Start number of tens at -1\n");
+   fprintf(Asm, "tensd           leay    10,y              ; Add 10 to quotient\n");
+   fprintf(Asm, "                subd    #100              ; Subtract 100 from dividend\n");
+   fprintf(Asm, "                bcc     tensd             ; Branch if difference still positive\n");
+   fprintf(Asm, "                addd    #100              ; Else add back last 100\n");
+   fprintf(Asm, "; Find number of ones in quotient\n");
+   fprintf(Asm, "                leay    -1,y              ; Start number of ones at -1\n");
+   fprintf(Asm, "onesd           leay    1,y               ; Add 1 to quotient\n");
+   fprintf(Asm, "                subd    #10               ; Subtract 10 from dividend\n");
+   fprintf(Asm, "                bcc     onesd             ; Branch if difference still positive\n");
+   fprintf(Asm, "                addd    #10               ; Else add back last 10\n");
+   fprintf(Asm, "                stb     ,-s               ; Save remainder in stack\n");
+   fprintf(Asm, "                inc     ,x                ; Add 1 to length byte\n");
+   fprintf(Asm, "                tfr     y,d               ; Make quotient into new dividend\n");
+   fprintf(Asm, "                cmpd    #0                ; Check if dividend zero\n");
+   fprintf(Asm, "                bne     div10             ; Branch if not - divide by 10 again\n");
+   fprintf(Asm, "; Check if original binary data was negative\n");
+   fprintf(Asm, "; If so, put ASCII - at front of buffer\n");
+   fprintf(Asm, "                lda     ,x+               ; Get length byte (not including sign)\n");
+   fprintf(Asm, ";               ldb     ,x                ; Get high byte of data\n");
+   fprintf(Asm, ";               bpl     bufload           ; Branch if data positive\n");
+   fprintf(Asm, ";               ldb     #'-'              ; Otherwise, get ASCII minus sign\n");
+   fprintf(Asm, ";               stb     ,x+               ; Store minus sign in buffer\n");
+   fprintf(Asm, ";               inc     -2,x              ; Add 1 to length byte for sign\n");
+   fprintf(Asm, "; Move string of digits from stack to buffer\n");
+   fprintf(Asm, "; Most significant digit is at top of stack\n");
+   fprintf(Asm, "; Convert digits to ASCII by adding ASCII 0\n");
+   fprintf(Asm, "bufload         ldb     ,s+               ; Get next digit from stack, moving right\n");
+   fprintf(Asm, "                addb    #'0'              ; Convert digit to ASCII\n");
+   fprintf(Asm, "                stb     ,x+               ; Save digit in buffer\n");
+   fprintf(Asm, "                deca                      ; Decrement byte counter\n");
+   fprintf(Asm, "                bne     bufload           ; Loop if more bytes left\n");
+   fprintf(Asm, "                clr     ,x                ; Add terminator to buffer\n");
+   fprintf(Asm, "                rts\n");
+
+   fprintf(Asm, "; void putu(const unsigned int u);\n");
+   fprintf(Asm, "_putu    pshs u                 ; Save old frame pointer\n");
+   fprintf(Asm, "         tfr  s,u               ; Make new frame pointer\n");
+   fprintf(Asm, "         ldd  4,u               ; Pick up first parameter\n");
+   /* Implement putu() here */
+   fprintf(Asm, "         ldb  #10               ; Load NEWLINE\n");
+#ifdef SIMULATOR
+   fprintf(Asm, "         lda  #5                ; SIM Print char in B register\n");
+   fprintf(Asm, "         swi                    ; SIM\n");
+#else
+   fprintf(Asm, "         tfr  b,a               ; Move char into A register\n");
+   fprintf(Asm, "         jsr  $a020             ; Send one char to the VDU\n");
+#endif   /* SIMULATOR */
+   fprintf(Asm, "         tfr  u,s               ; Deallocate stack frame\n");
+   fprintf(Asm, "         puls u                 ; Restore frame pointer\n");
+   fprintf(Asm, "         rts\n");
+   fprintf(Asm, "; void putl(const long int l);\n");
+   fprintf(Asm, "_putl    pshs u                 ; Save old frame pointer\n");
+   fprintf(Asm, "         tfr  s,u               ; Make new frame pointer\n");
+   fprintf(Asm, "         ldd  4,u               ; Pick up first parameter MSB\n");
+   fprintf(Asm, "         ldd  6,u               ; Pick up first parameter LSB\n");
+   /* Implement putl() here */
+   fprintf(Asm, "         ldb  #10               ; Load NEWLINE\n");
+#ifdef SIMULATOR
+   fprintf(Asm, "         lda  #5                ; SIM Print char in B register\n");
+   fprintf(Asm, "         swi                    ; SIM\n");
+#else
+   fprintf(Asm, "         tfr  b,a               ; Move char into A register\n");
+   fprintf(Asm, "         jsr  $a020             ; Send one char to the VDU\n");
+#endif   /* SIMULATOR */
+   fprintf(Asm, "         tfr  u,s               ; Deallocate stack frame\n");
+   fprintf(Asm, "         puls u                 ; Restore frame pointer\n");
+   fprintf(Asm, "         rts\n");
+#ifdef SIMULATOR
+   fprintf(Asm, "_vdustr  tfr  d,x               ; Move pointer into X register\n");
+   fprintf(Asm, "         jmp  $a014             ; Print a nul-terminated string\n");
+   fprintf(Asm, "_getchar jsr  $a252             ; Get char and show cursor\n");
+   fprintf(Asm, "         tfr  a,b               ; Move returned ASCII char into LSB of D register\n");
+   fprintf(Asm, "         clra                   ; Make sure MSB is zero\n");
+   fprintf(Asm, "         rts\n");
+   fprintf(Asm, "_hex2ou  tfr  b,a               ; Move char into A register\n");
+   fprintf(Asm, "         jmp  $a17c             ; Call hex2ou in EPROM\n");
+   fprintf(Asm, "_hex4ou  jmp  $a189             ; Call hex4ou in EPROM\n");
+   fprintf(Asm, "_hex8ou  pshs d                 ; Save D\n");
+   fprintf(Asm, ";        tfr  w,d               ; Transfer hi word to D\n");
+   fprintf(Asm, "         jsr  $a189             ; Call hex4ou in EPROM (hi)\n");
+   fprintf(Asm, "         puls d                 ; Restore D\n");
+   fprintf(Asm, "         jmp  $a189             ; Call hex4ou in EPROM (lo)\n");
+#endif   /* SIMULATOR */
+}
+
+
+/* writeHelpers --- write out the run-time routines that the generated code called */
+
+static void writeHelpers(void)
+{
+   if (Helpers & H_MUL) {
+      fprintf(Asm, "; 16-bit multiply: D = D * X\n");
+      fprintf(Asm, "mul16    pshs d,x               ; Left operand at ,s and right at 2,s\n");
+      fprintf(Asm, "         lda  1,s               ; Low byte of left\n");
+      fprintf(Asm, "         ldb  3,s               ; Low byte of right\n");
+      fprintf(Asm, "         mul                    ; Low x low\n");
+      fprintf(Asm, "         pshs d                 ; Start of the product\n");
+      fprintf(Asm, "         lda  3,s               ; Low byte of left\n");
+      fprintf(Asm, "         ldb  4,s               ; High byte of right\n");
+      fprintf(Asm, "         mul                    ; Low x high\n");
+      fprintf(Asm, "         addb ,s                ; Add into high byte of product\n");
+      fprintf(Asm, "         stb  ,s\n");
+      fprintf(Asm, "         lda  2,s               ; High byte of left\n");
+      fprintf(Asm, "         ldb  5,s               ; Low byte of right\n");
+      fprintf(Asm, "         mul                    ; High x low\n");
+      fprintf(Asm, "         addb ,s                ; Add into high byte of product\n");
+      fprintf(Asm, "         stb  ,s\n");
+      fprintf(Asm, "         puls d                 ; Product\n");
+      fprintf(Asm, "         leas 4,s               ; Discard operands\n");
+      fprintf(Asm, "         rts\n");
+   }
+   
+   if (Helpers & H_SDIV) {
+      fprintf(Asm, "; Signed 16-bit divide: D = D / X and X = D %% X, rounded towards zero\n");
+      fprintf(Asm, "sdiv16   pshs a                 ; Sign of dividend is the sign of the remainder\n");
+      fprintf(Asm, "         pshs a                 ; Sign of quotient\n");
+      fprintf(Asm, "         tsta\n");
+      fprintf(Asm, "         bpl  sdiv1\n");
+      fprintf(Asm, "         nega                   ; Make dividend positive\n");
+      fprintf(Asm, "         negb\n");
+      fprintf(Asm, "         sbca #0\n");
+      fprintf(Asm, "sdiv1    exg  d,x\n");
+      fprintf(Asm, "         tsta\n");
+      fprintf(Asm, "         bpl  sdiv2\n");
+      fprintf(Asm, "         com  ,s                ; Negative divisor flips sign of quotient\n");
+      fprintf(Asm, "         nega                   ; Make divisor positive\n");
+      fprintf(Asm, "         negb\n");
+      fprintf(Asm, "         sbca #0\n");
+      fprintf(Asm, "sdiv2    exg  d,x\n");
+      fprintf(Asm, "         bsr  udiv16\n");
+      fprintf(Asm, "         tst  ,s+               ; Quotient negative?\n");
+      fprintf(Asm, "         bpl  sdiv3\n");
+      fprintf(Asm, "         nega\n");
+      fprintf(Asm, "         negb\n");
+      fprintf(Asm, "         sbca #0\n");
+      fprintf(Asm, "sdiv3    tst  ,s+               ; Remainder negative?\n");
+      fprintf(Asm, "         bpl  sdiv4\n");
+      fprintf(Asm, "         exg  d,x\n");
+      fprintf(Asm, "         nega\n");
+      fprintf(Asm, "         negb\n");
+      fprintf(Asm, "         sbca #0\n");
+      fprintf(Asm, "         exg  d,x\n");
+      fprintf(Asm, "sdiv4    rts\n");
+   }
+   
+   if (Helpers & H_UDIV) {
+      fprintf(Asm, "; Unsigned 16-bit divide: D = D / X and X = D %% X\n");
+      fprintf(Asm, "udiv16   pshs d,x               ; Dividend becomes quotient at ,s and divisor at 2,s\n");
+      fprintf(Asm, "         ldd  #0                ; Remainder\n");
+      fprintf(Asm, "         ldx  #16               ; Bit count\n");
+      fprintf(Asm, "udiv1    asl  1,s               ; Shift next bit of dividend...\n");
+      fprintf(Asm, "         rol  ,s\n");
+      fprintf(Asm, "         rolb                   ; ...into remainder\n");
+      fprintf(Asm, "         rola\n");
+      fprintf(Asm, "         bcs  udiv2             ; Seventeen bits is more than the divisor\n");
+      fprintf(Asm, "         cmpd 2,s\n");
+      fprintf(Asm, "         blo  udiv3             ; Divisor doesn't go\n");
+      fprintf(Asm, "udiv2    subd 2,s\n");
+      fprintf(Asm, "         inc  1,s               ; Set quotient bit\n");
+      fprintf(Asm, "udiv3    leax -1,x\n");
+      fprintf(Asm, "         bne  udiv1\n");
+      fprintf(Asm, "         tfr  d,x               ; Remainder\n");
+      fprintf(Asm, "         puls d                 ; Quotient\n");
+      fprintf(Asm, "         leas 2,s               ; Discard divisor\n");
+      fprintf(Asm, "         rts\n");
+   }
+   
+   if (Helpers & H_ASL) {
+      fprintf(Asm, "; Shift left: D = D << X\n");
+      fprintf(Asm, "asl16    leax ,x                ; Shift count zero?\n");
+      fprintf(Asm, "         beq  asl2\n");
+      fprintf(Asm, "asl1     aslb\n");
+      fprintf(Asm, "         rola\n");
+      fprintf(Asm, "         leax -1,x\n");
+      fprintf(Asm, "         bne  asl1\n");
+      fprintf(Asm, "asl2     rts\n");
+   }
+   
+   if (Helpers & H_ASR) {
+      fprintf(Asm, "; Signed shift right: D = D >> X\n");
+      fprintf(Asm, "asr16    leax ,x                ; Shift count zero?\n");
+      fprintf(Asm, "         beq  asr2\n");
+      fprintf(Asm, "asr1     asra\n");
+      fprintf(Asm, "         rorb\n");
+      fprintf(Asm, "         leax -1,x\n");
+      fprintf(Asm, "         bne  asr1\n");
+      fprintf(Asm, "asr2     rts\n");
+   }
+   
+   if (Helpers & H_LSR) {
+      fprintf(Asm, "; Unsigned shift right: D = D >> X\n");
+      fprintf(Asm, "lsr16    leax ,x                ; Shift count zero?\n");
+      fprintf(Asm, "         beq  lsr2\n");
+      fprintf(Asm, "lsr1     lsra\n");
+      fprintf(Asm, "         rorb\n");
+      fprintf(Asm, "         leax -1,x\n");
+      fprintf(Asm, "         bne  lsr1\n");
+      fprintf(Asm, "lsr2     rts\n");
+   }
+}
+
+
+/* OpenAssemblerFile --- open the output file, and a temporary file to gather the code in */
+
+bool OpenAssemblerFile(const char fname[])
+{
+   char asmName[256];
+   char *p;
+   
+   strncpy(asmName, fname, sizeof (asmName) - 2);
+   p = strrchr(asmName, '.');
+   strcpy(p, ".asm");
+   
+   if ((Output = fopen(asmName, "w")) == NULL) {
+      return (false);
+   }
+   
+   if ((Asm = tmpfile()) == NULL) {
+      fclose(Output);
+      return (false);
+   }
+   
+   return (true);
+}
+
+
+/* CloseAssemblerFile --- write the header, the code, the variables and a trailer, and close the output file */
+
+bool CloseAssemblerFile(void)
+{
+   FILE *code = Asm;
+   char buf[BUFSIZ];
+   size_t n;
+   int i;
+   
+   flushCode();
+   
+   // The direct page is known now, so it can go in front of the code
+   Asm = Output;
+   writeHeader();
+   
+   rewind(code);
+   
+   while ((n = fread(buf, 1, sizeof (buf), code)) > 0) {
+      fwrite(buf, 1, n, Asm);
+   }
+   
+   fclose(code);
+   
+   for (i = 0; i < NGlobals; i++) {
+      if (Globals[i].direct == false) {
+         fputs(Globals[i].def, Asm);
+      }
+   }
+   
+   writeHelpers();
+   
+   fprintf(Asm, "        end  appEntry\n");
+
+   fclose(Asm);
+   
+   return (true);
+}
+
+
+/* Emit --- emit a single assembly-language instruction */
+
+int Emit(const char inst[], const char oper[], const char comment[])
+{
+   struct Instruction *in;
+   
+   if (oper[0] == '\0') {
+      appendInst(inst, ONONE, comment);
+   }
+   else {
+      in = appendInst(inst, OTEXT, comment);
+      in->oper = saveText(oper, strlen(oper));
+   }
+
+   return (1);
+}
+
+
+/* MarkCode --- return the position in the instruction buffer where the next code will go */
+
+int MarkCode(void)
+{
+   return (NCode);
+}
+
+
+/* MoveCode --- move the code between two marks to the end of the buffer */
+
+void MoveCode(const int from, const int to)
+{
+   const int n = to - from;
+   struct Instruction *moved;
+   
+   if (n <= 0)
+      return;
+   
+   if ((moved = malloc(n * sizeof (moved[0]))) == NULL)
+      outOfMemory();
+   
+   memcpy(moved, &Code[from], n * sizeof (moved[0]));
+   memmove(&Code[from], &Code[to], (NCode - to) * sizeof (moved[0]));
+   memcpy(&Code[NCode - n], moved, n * sizeof (moved[0]));
+   
+   free(moved);
+}
+
+
+/* AllocLabel --- allocate a new label for a given purpose */
+
+int AllocLabel(const char purpose)
+{
+   return (NextLabel++);
+}
+
+
+/* EmitLabel --- emit an allocated label into the assembly-language file */
+
+void EmitLabel(const int label)
+{
+   struct Instruction *in = newInstruction(ILABEL);
+   
+   in->label = label;
+}
+
+
+/* EmitFunctionEntry --- emit a label and setup code for a function */
+
+void EmitFunctionEntry(const char name[], const int nBytes, const int nRegister)
+{
+   emitText("%c%-44s ; Function entry point\n", NAME_PREFIX, name);
+   
+   ParamBase = 4 + (2 * nRegister);
+   EntryAt = NCode;
+   FrameRegisters = nRegister;
+
+   if (nRegister == 0) {
+      Emit("pshs", "u", "Save old frame pointer");
+   }
+   else {
+      Emit("pshs", "u,y", "Save old frame pointer & register variable");
+   }
+   
+   if (nRegister > 1) {
+      Emit("pshsw", "", "Save second register variable");
+   }
+   
+   Emit("tfr", "s,u", "Make new frame pointer");
+   
+   if (nBytes != 0) {
+      char frame[32];
+      
+      snprintf(frame, sizeof (frame), "-%d,s", nBytes);
+      Emit("leas", frame, "Allocate stack frame");
+   }
+}
+
+
+/* EmitFunctionExit --- emit return label and function exit code */
+
+void EmitFunctionExit(const int returnLabel, const int nRegister)
+{
+   const int exit = NCode;
+   
+   EmitLabel(returnLabel);
+   Emit("tfr", "u,s", "Deallocate stack frame");
+   
+   if (nRegister > 1) {
+      Emit("pulsw", "", "Restore second register variable");
+   }
+   
+   if (nRegister == 0) {
+      Emit("puls", "u", "Restore frame pointer");
+   }
+   else {
+      Emit("puls", "u,y", "Restore frame pointer & register variable");
+   }
+   Emit("rts", "", "Return to caller");
+   
+   if (Optimise) {
+      omitFramePointer();
+      tailCalls(returnLabel, exit);
+   }
+   
+   flushCode();
+}
+
+
+/* EmitStackCleanup --- emit code to clean up stack after a function call */
+
+void EmitStackCleanup(const int nBytes)
+{
+   if (nBytes != 0) {
+      char buf[32];
+      
+      snprintf(buf, sizeof (buf), "%d,s", nBytes);
+      Emit("leas", buf, "clear actual parameters off stack");
+   }
+}
+
+
+/* EmitStackDepth --- emit code to leave 'nBytes' of locals below the frame pointer */
+
+void EmitStackDepth(const int nBytes, const char comment[])
+{
+   char buf[32];
+   
+   // Relative to U rather than S, so that it's correct even if a 'break'
+   // or 'continue' has jumped out of a block without deallocating it
+   snprintf(buf, sizeof (buf), "-%d,u", nBytes);
+   Emit("leas", buf, comment);
+}
+
+
+/* EmitStaticCharArray --- emit declaration for an initialised char array or string */
+
+void EmitStaticCharArray(const struct StringConstant *sc, const char name[])
+{
+   char target[8];
+   char bytes[64];
+   int i, n;
+
+   snprintf(target, sizeof (target), "l%04d", sc->label);
+   
+   bytes[0] = '\0';
+   
+   if (sc->sLength > 7) {
+      n = 7;
+   }
+   else {
+      n = sc->sLength;
+   }
+
+   for (i = 0; i < n; i++) {
+      char hex[8];
+      
+      sprintf(hex, "$%02x", sc->sValue[i] & 0xff);
+      
+      strcat(bytes, hex);
+      
+      if (i < (n - 1)) {
+         strcat(bytes, ",");
+      }
+   }
+   
+   emitText("%-7s fcb  %-32s ; const char %s[%d] = %.*s\n", target, bytes, name, sc->sLength - 1, sc->strLength, sc->str);
+   
+   while (i < sc->sLength) {
+      n += 7;
+      
+      if (n > sc->sLength) {
+         n = sc->sLength;
+      }
+
+      bytes[0] = '\0';
+
+      for ( ; i < n; i++) {
+         char hex[8];
+
+         sprintf(hex, "$%02x", sc->sValue[i] & 0xff);
+         
+         strcat(bytes, hex);
+         
+         if (i < (n - 1)) {
+            strcat(bytes, ",");
+         }
+
+      }
+
+      emitText("        fcb  %s\n", bytes);
+   }
+}
+
+
+/* frameOffset --- return the offset of an automatic variable or parameter from the frame pointer */
+
+static int frameOffset(const struct Symbol *const sym)
+{
+   if (sym->fpOffset >= 0)
+      return (sym->fpOffset + ParamBase);
+   else
+      return (sym->fpOffset);
+}
+
+
+/* GenTargetOperand --- generate the assembler operand to address a scalar variable */
+
+static void GenTargetOperand(const struct Symbol *const sym, const int offset, char target[])
+{
+   if (offset == 0) {
+      switch (sym->storageClass) {
+      case SCEXTERN:
+         snprintf(target, OPERANDSIZE(sym), "%c%s", NAME_PREFIX, sym->name);
+         break;
+      case SCSTATIC:
+         snprintf(target, OPERANDSIZE(sym), "l%04d", sym->label);
+         break;
+      case SCAUTO:
+         snprintf(target, OPERANDSIZE(sym), "%d,u", frameOffset(sym));
+         break;
+      case SCREGISTER:
+         snprintf(target, OPERANDSIZE(sym), "#0");
+         break;
+      }
+   }
+   else {
+      switch (sym->storageClass) {
+      case SCEXTERN:
+         snprintf(target, OPERANDSIZE(sym), "%c%s+%d", NAME_PREFIX, sym->name, offset);
+         break;
+      case SCSTATIC:
+         snprintf(target, OPERANDSIZE(sym), "l%04d+%d", sym->label, offset);
+         break;
+      case SCAUTO:
+         snprintf(target, OPERANDSIZE(sym), "%d,u", frameOffset(sym) + offset);
+         break;
+      case SCREGISTER:
+         snprintf(target, OPERANDSIZE(sym), "#0");
+         break;
+      }
+   }
+}
+
+
+
+/* directRef --- count instructions that address a global, which would be shorter in the direct page */
+
+static void directRef(const struct Symbol *const sym, const int n)
+{
+   int i;
+   
+   for (i = 0; i < NGlobals; i++) {
+      if ((Globals[i].storageClass == sym->storageClass) &&
+          ((sym->storageClass == SCSTATIC) ? (Globals[i].label == sym->label) : (Globals[i].atom == sym->atom))) {
+         Globals[i].refs += n;
+         return;
+      }
+   }
+}
+
+
+/* storageClassAsString --- generate a string representation of a storage class */
+
+static char *storageClassAsString(const int sc)
+{
+   char *str = "";
+   
+   switch (sc) {
+   case SCEXTERN:
+      str = "extern";
+      break;
+   case SCSTATIC:
+      str = "static";
+      break;
+   case SCAUTO:
+      str = "auto";
+      break;
+   case SCREGISTER:
+      str = "register";
+      break;
+   }
+   
+   return (str);
+}
+
+
+/* typeAsString --- generate a string representation of a type */
+
+static char *typeAsString(const int ty)
+{
+   char *str = "";
+   
+   switch (ty) {
+   case T_CHAR:
+      str = "char";
+      break;
+   case T_UCHAR:
+      str = "unsigned char";
+      break;
+   case T_INT:
+      str = "int";
+      break;
+   case T_UINT:
+      str = "unsigned int";
+      break;
+   case T_FLOAT:
+      str = "float";
+      break;
+   case T_DOUBLE:
+      str = "double";
+      break;
+   }
+   
+   return (str);
+}
+
+
+/* scalarType --- return the type of a variable as held in memory, where pointers are 'unsigned int' */
+
+static int scalarType(const struct Symbol *const sym)
+{
+   return ((sym->pLevel > 0) ? T_UINT : sym->type);
+}
+
+
+/* LoadScalar --- load a scalar variable into D or Q */
+
+void LoadScalar(const struct Symbol *const sym)
+{
+   char comment[COMMENTSIZE(sym)];
+   const char *sc = storageClassAsString(sym->storageClass);
+   const char *ty = typeAsString(sym->type);
+   
+   snprintf(comment, sizeof (comment), "Load %s %s %s", sc, ty, sym->name);
+   
+   if (sym->storageClass == SCREGISTER) {
+      const char *const reg = (sym->reg == R_W) ? "w,d" : "y,d";
+      
+      switch (scalarType(sym)) {
+      case T_CHAR:
+         Emit("tfr", reg, comment);
+         Emit("sex", "", "Sign extend to 16 bits");
+         break;
+      case T_UCHAR:
+         Emit("tfr", reg, comment);
+         Emit("clra", "", "No sign extension");
+         break;
+      case T_SHORT:
+      case T_USHORT:
+      case T_INT:
+      case T_UINT:
+         Emit("tfr", reg, comment);
+         break;
+      }
+   }
+   else {
+      char target[OPERANDSIZE(sym)];
+
+      GenTargetOperand(sym, 0, target);
+      directRef(sym, 1);
+
+      switch (scalarType(sym)) {
+      case T_CHAR:
+         Emit("ldb", target, comment);
+         Emit("sex", "", "Sign extend to 16 bits");
+         break;
+      case T_UCHAR:
+         Emit("ldb", target, comment);
+         Emit("clra", "", "No sign extension");
+         break;
+      case T_SHORT:
+      case T_USHORT:
+      case T_INT:
+      case T_UINT:
+         Emit("ldd", target, comment);
+         break;
+      case T_LONG:
+      case T_ULONG:
+         Emit("ldq", target, comment);
+         break;
+      case T_FLOAT:
+         Emit("ldq", target, comment);
+         break;
+      case T_DOUBLE:
+         Emit("ldq", target, comment);
+         Emit("nop", "", "How to load low 32 bits?");
+         break;
+      }
+   }
+}
+
+
+/* StoreScalar --- store a scalar variable from D or Q */
+
+void StoreScalar(const struct Symbol *const sym)
+{
+   char comment[COMMENTSIZE(sym)];
+   const char *sc = storageClassAsString(sym->storageClass);
+   const char *ty = typeAsString(sym->type);
+   
+   snprintf(comment, sizeof (comment), "Store %s %s %s", sc, ty, sym->name);
+
+   if (sym->storageClass == SCREGISTER) {
+      const char *const reg = (sym->reg == R_W) ? "d,w" : "d,y";
+      
+      switch (scalarType(sym)) {
+      case T_CHAR:
+      case T_UCHAR:
+         Emit("tfr", reg, comment);
+         break;
+      case T_SHORT:
+      case T_USHORT:
+      case T_INT:
+      case T_UINT:
+         Emit("tfr", reg, comment);
+         break;
+      }
+   }
+   else {
+      char target[OPERANDSIZE(sym)];
+
+      GenTargetOperand(sym, 0, target);
+      directRef(sym, 1);
+
+      switch (scalarType(sym)) {
+      case T_CHAR:
+      case T_UCHAR:
+         Emit("stb", target, comment);
+         break;
+      case T_SHORT:
+      case T_USHORT:
+      case T_INT:
+      case T_UINT:
+         Emit("std", target, comment);
+         break;
+      case T_LONG:
+      case T_ULONG:
+         Emit("stq", target, comment);
+         break;
+      case T_FLOAT:
+         Emit("stq", target, comment);
+         break;
+      case T_DOUBLE:
+         Emit("stq", target, comment);
+         GenTargetOperand(sym, 4, target);
+         Emit("stq", target, "Store low 32 bits");
+         break;
+      case T_VOID:
+         break;
+      }
+   }
+}
+
+
+/* EmitRegisterParam --- store the nth argument of a '__fastcall' function, passed in D or X */
+
+void EmitRegisterParam(const struct Symbol *const sym, const int n)
+{
+   char comment[COMMENTSIZE(sym)];
+   char target[OPERANDSIZE(sym)];
+   
+   snprintf(comment, sizeof (comment), "Store %s %s %s", storageClassAsString(sym->storageClass), typeAsString(sym->type), sym->name);
+   
+   if (n == 0) {
+      StoreScalar(sym);
+   }
+   else if (sym->storageClass == SCREGISTER) {
+      Emit("tfr", (sym->reg == R_W) ? "x,w" : "x,y", comment);
+   }
+   else if ((sym->type == T_CHAR) || (sym->type == T_UCHAR)) {
+      Emit("tfr", "x,d", comment);    // The first argument is already safe
+      StoreScalar(sym);
+   }
+   else {
+      GenTargetOperand(sym, 0, target);
+      Emit("stx", target, comment);
+   }
+}
+
+
+/* LoadIntConstant --- load an int constant into a given register */
+
+void LoadIntConstant(const int val, const int reg, const char comment[])
+{
+   switch (reg) {
+   case 'D':
+   case 'd':
+      emitImmediate("ldd", val, comment);
+      break;
+   case 'X':
+   case 'x':
+      emitImmediate("ldx", val, comment);
+      break;
+   case 'Y':
+   case 'y':
+      emitImmediate("ldy", val, comment);
+      break;
+   }
+}
+
+
+/* LoadLabelAddr --- load the address of a generated label */
+
+void LoadLabelAddr(const int label, const char comment[])
+{
+   char target[8];
+
+   snprintf(target, sizeof (target), "#l%04d", label);
+   
+   Emit("ldd", target, comment);
+}
+
+
+/* addGlobal --- add a variable to the table, to be defined at the end of the compilation-unit */
+
+static void addGlobal(const struct Symbol *const sym, const char def[])
+{
+   struct GlobalVar *g;
+   
+   if (NGlobals >= MaxGlobals) {
+      const int nNew = (MaxGlobals == 0) ? MINGLOBALS : MaxGlobals * 2;
+      
+      if ((Globals = realloc(Globals, nNew * sizeof (Globals[0]))) == NULL)
+         outOfMemory();
+      
+      MaxGlobals = nNew;
+   }
+   
+   g = &Globals[NGlobals++];
+   
+   g->storageClass = sym->storageClass;
+   g->name = sym->name;
+   g->atom = sym->atom;
+   g->label = sym->label;
+   g->size = ObjectSize(sym->type, sym->pLevel);
+   g->refs = 0;
+   g->accesses = 0;
+   g->profiled = false;
+   g->direct = false;
+   
+   if ((g->def = malloc(strlen(def) + 1)) == NULL)
+      outOfMemory();
+   
+   strcpy(g->def, def);
+}
+
+
+/* EmitExternScalar --- emit declaration for an extern scalar variable */
+
+void EmitExternScalar(const struct Symbol *const sym, const int init, const double fInit)
+{
+   char name[OPERANDSIZE(sym)];
+   char def[DEFSIZE + OPERANDSIZE(sym)];
+   char *storage = "";
+   int b1, b2, b3, b4, b5, b6, b7, b8;
+   union {
+      float f;
+      unsigned char b[4];
+   } f;
+   union {
+      double d;
+      unsigned char b[4];
+   } d;
+   
+   def[0] = '\0';
+   
+   if (sym->storageClass == SCEXTERN) {
+      snprintf(name, sizeof (name), "%c%s", NAME_PREFIX, sym->name);
+   }
+   else if (sym->storageClass == SCSTATIC) {
+      snprintf(name, sizeof (name), "l%04d", sym->label);
+      storage = "static ";
+   }
+   else {
+      fprintf(stderr, "Only 'extern' or 'static' is valid\n");
+   }
+   
+   if (sym->pLevel == 0) {
+      switch (sym->type) {
+      case T_CHAR:
+      case T_UCHAR:
+         snprintf(def, sizeof (def), "%-30s  fcb  %d      ; %schar %s = %d\n", name, init, storage, sym->name, init);
+         break;
+      case T_SHORT:
+      case T_USHORT:
+      case T_INT:
+      case T_UINT:
+         snprintf(def, sizeof (def), "%-30s  fdb  %d      ; %sint %s = %d\n", name, init, storage, sym->name, init);
+         break;
+      case T_LONG:
+      case T_ULONG:
+         snprintf(def, sizeof (def), "%-30s  fqb  %d      ; %slong int %s = %d\n", name, init, storage, sym->name, init);
+         break;
+      case T_FLOAT:
+         f.f = fInit;
+         
+         b1 = f.b[3];   // 6809 is big-endian
+         b2 = f.b[2];
+         b3 = f.b[1];
+         b4 = f.b[0];
+
+         snprintf(def, sizeof (def), "%-30s  fcb  %d,%d,%d,%d         ; %sfloat %s = %g\n", name, b1, b2, b3, b4, storage, sym->name, fInit);
+         break;
+      case T_DOUBLE:
+         d.d = fInit;
+         
+         b1 = d.b[7];   // 6809 is big-endian
+         b2 = d.b[6];
+         b3 = d.b[5];
+         b4 = d.b[4];
+         b5 = d.b[3];
+         b6 = d.b[2];
+         b7 = d.b[1];
+         b8 = d.b[0];
+
+         snprintf(def, sizeof (def), "%-30s  fcb  %d,%d,%d,%d,%d,%d,%d,%d ; %sdouble %s = %g\n", name, b1, b2, b3, b4, b5, b6, b7, b8, storage, sym->name, fInit);
+         break;
+      }
+   }
+   else {
+      snprintf(def, sizeof (def), "%-30s  fdb  %d     ; %spointer %s = %d\n", name, init, storage, sym->name, init);
+   }
+   
+   addGlobal(sym, def);
+}
+
+
+/* EmitJump --- emit a jump (possibly relative) to a given label */
+
+void EmitJump(const int label, const char comment[])
+{
+   emitBranch("jmp", label, comment);
+}
+
+
+/* EmitBranchIfEqual --- emit a BEQ to a label */
+
+void EmitBranchIfEqual(const int label, const char comment[])
+{
+   emitBranch("lbeq", label, comment);
+}
+
+
+/* EmitBranchNotEqual --- emit a BNE to a label */
+
+void EmitBranchNotEqual(const int label, const char comment[])
+{
+   emitBranch("lbne", label, comment);
+}
+
+
+/* EmitBranchIf --- emit a conditional branch to a label, after a compare */
+
+void EmitBranchIf(const int cond, const bool isUnsigned, const int label, const char comment[])
+{
+   static const char *const signedBranch[] = {"lbeq", "lbne", "lblt", "lble", "lbgt", "lbge"};
+   static const char *const unsignedBranch[] = {"lbeq", "lbne", "lblo", "lbls", "lbhi", "lbhs"};
+   
+   emitBranch(isUnsigned ? unsignedBranch[cond] : signedBranch[cond], label, comment);
+}
+
+
+/* EmitIncScalar --- emit an INC for a scalar variable */
+
+void EmitIncScalar(const struct Symbol *const sym, const int amount)
+{
+   char op[30];
+   char comment[COMMENTSIZE(sym)];
+   const char *sc = storageClassAsString(sym->storageClass);
+   const char *ty = typeAsString(sym->type);
+   char *incDec = "inc";
+   
+   if (amount < 0) {
+      incDec = "dec";
+   }
+
+   snprintf(comment, sizeof (comment), "%s %s %s %s", incDec, sc, ty, sym->name);
+
+
+   if ((sym->storageClass == SCREGISTER) && (sym->reg == R_W)) {
+      if (amount == 1)
+         Emit("incw", "", comment);
+      else if (amount == -1)
+         Emit("decw", "", comment);
+      else
+         emitImmediate("addw", amount, comment);
+   }
+   else if (sym->storageClass == SCREGISTER) {
+      snprintf(op, sizeof (op), "%d,y", amount);
+
+      switch (scalarType(sym)) {
+      case T_CHAR:
+      case T_UCHAR:
+      case T_SHORT:
+      case T_USHORT:
+      case T_INT:
+      case T_UINT:
+         Emit("leay", op, comment);
+         break;
+      }
+   }
+   else {
+      char target[OPERANDSIZE(sym)];
+
+      GenTargetOperand(sym, 0, target);
+
+      snprintf(op, sizeof (op), "%d,x", amount);
+
+      switch (scalarType(sym)) {
+      case T_CHAR:
+      case T_UCHAR:
+         directRef(sym, 1);
+         
+         if (amount == 1) {
+            Emit("inc", target, comment);
+         }
+         else if (amount == -1) {
+            Emit("dec", target, comment);
+         }
+         else {
+            fprintf(stderr, "Inc/Dec by more than 1\n");
+         }
+         break;
+      case T_SHORT:
+      case T_USHORT:
+      case T_INT:
+      case T_UINT:
+         Emit("ldx", target, comment);
+         Emit("leax", op, incDec);
+         Emit("stx", target, comment);
+         directRef(sym, 2);
+         break;
+      case T_LONG:
+      case T_ULONG:
+         Emit("nop", "", comment);
+         break;
+      case T_FLOAT:
+         Emit("nop", "", comment);
+         break;
+      case T_DOUBLE:
+         Emit("nop", "", comment);
+         break;
+      }
+   }
+}
+
+
+/* EmitCompareIntConstant --- code to compare an integer constant */
+
+void EmitCompareIntConstant(const int compare, const char comment[])
+{
+   emitImmediate("cmpd", compare, comment);
+}
+
+
+/* EmitCompareStacked --- compare D with a value pushed onto the stack, and pop it */
+
+void EmitCompareStacked(const char comment[])
+{
+   Emit("cmpd", ",s++", comment);
+}
+
+
+/* compareCases --- qsort() comparison of two 'case' values */
+
+static int compareCases(const void *a, const void *b)
+{
+   const struct SwitchCase *ca = a;
+   const struct SwitchCase *cb = b;
+   
+   return ((ca->match > cb->match) - (ca->match < cb->match));
+}
+
+
+/* estimateTree --- estimate bytes and average cycles of a compare tree over 'n' cases */
+
+static void estimateTree(const int n, int *bytes, int *cycles)
+{
+   int lBytes, lCycles;
+   int rBytes, rCycles;
+   
+   if (n <= TREELEAF) {
+      *bytes = (CHAINBYTES * n) + JUMPBYTES;
+      *cycles = (CHAINCYCLES * (n + 1)) / 2;
+   }
+   else {
+      estimateTree(n / 2, &lBytes, &lCycles);
+      estimateTree(n - (n / 2) - 1, &rBytes, &rCycles);
+      
+      *bytes = NODEBYTES + lBytes + rBytes;
+      *cycles = NODECYCLES + ((lCycles + rCycles) / 2);
+   }
+}
+
+
+/* emitChain --- emit a compare and branch for each case, then go to the default */
+
+static void emitChain(const struct SwitchCase cases[], const int nCases, const int defaultLabel, const int nextLabel)
+{
+   int i;
+   
+   for (i = 0; i < nCases; i++) {
+      EmitCompareIntConstant(cases[i].match, "switch: compare");
+      EmitBranchIfEqual(cases[i].label, "switch: branch to code");
+   }
+   
+   if (defaultLabel != nextLabel) {
+      EmitJump(defaultLabel, "switch: default");
+   }
+}
+
+
+/* emitTree --- emit a balanced tree of compares over sorted cases */
+
+static void emitTree(const struct SwitchCase cases[], const int nCases, const int defaultLabel, const int nextLabel)
+{
+   const int mid = nCases / 2;
+   int rlabel;
+   
+   if (nCases <= TREELEAF) {
+      emitChain(cases, nCases, defaultLabel, nextLabel);
+      return;
+   }
+   
+   rlabel = AllocLabel('W');
+   
+   // Switch values are 'int', so the 6809's signed branches apply
+   EmitCompareIntConstant(cases[mid].match, "switch: compare middle case");
+   EmitBranchIfEqual(cases[mid].label, "switch: branch to code");
+   emitBranch("lbgt", rlabel, "switch: upper half");
+   
+   emitTree(cases, mid, defaultLabel, NOLABEL);
+   
+   EmitLabel(rlabel);
+   emitTree(&cases[mid + 1], nCases - mid - 1, defaultLabel, nextLabel);
+}
+
+
+/* emitJumpTable --- emit an indexed jump through a table of case labels */
+
+static void emitJumpTable(const struct SwitchCase cases[], const int nCases, const int defaultLabel)
+{
+   const int lo = cases[0].match;
+   const int hi = cases[nCases - 1].match;
+   const int tlabel = AllocLabel('T');
+   struct Instruction *in;
+   char comment[32];
+   int i, j;
+   
+   // Subtracting the lowest case makes any value below it wrap around to
+   // a big unsigned number, so one unsigned compare checks both bounds
+   if (lo != 0) {
+      emitImmediate("subd", lo, "switch: subtract lowest case");
+   }
+   
+   emitImmediate("cmpd", hi - lo, "switch: check range");
+   emitBranch("lbhi", defaultLabel, "switch: out of range");
+   
+   Emit("aslb", "", "switch: two bytes per entry");
+   Emit("rola", "", "switch:");
+   
+   in = appendInst("ldx", OADDRESS, "switch: point at jump table");
+   in->label = tlabel;
+   Emit("jmp", "[d,x]", "switch: jump via table");
+   
+   EmitLabel(tlabel);
+   
+   // Cases are sorted, so walk them alongside the range of values
+   for (i = lo, j = 0; i <= hi; i++) {
+      if (cases[j].match == i) {
+         snprintf(comment, sizeof (comment), "switch: case %d", i);
+         emitBranch("fdb", cases[j++].label, comment);
+      }
+      else {
+         snprintf(comment, sizeof (comment), "switch: no case %d", i);
+         emitBranch("fdb", defaultLabel, comment);
+      }
+   }
+}
+
+
+/* EmitSwitch --- emit the cheapest dispatch code for a 'switch' statement */
+
+void EmitSwitch(struct SwitchCase cases[], const int nCases, const int defaultLabel, const int nextLabel)
+{
+   int chainBytes, chainCycles, chainCost;
+   int treeBytes, treeCycles, treeCost;
+   int tableBytes, tableCycles, tableCost;
+   long int range;
+   
+   if (nCases == 0) {
+      if (defaultLabel != nextLabel) {
+         EmitJump(defaultLabel, "switch: no cases");
+      }
+      
+      return;
+   }
+   
+   qsort(cases, nCases, sizeof (cases[0]), compareCases);
+   
+   range = (long int)cases[nCases - 1].match - cases[0].match + 1;
+   
+   // Estimate the size of each kind of dispatch code and the average
+   // number of cycles it takes, then weigh speed against size
+   chainBytes = (CHAINBYTES * nCases) + JUMPBYTES;
+   chainCycles = (CHAINCYCLES * (nCases + 1)) / 2;
+   chainCost = (CYCLEWEIGHT * chainCycles) + chainBytes;
+   
+   estimateTree(nCases, &treeBytes, &treeCycles);
+   treeCost = (CYCLEWEIGHT * treeCycles) + treeBytes;
+   
+   if (range <= MAXTABLE) {
+      tableBytes = TABLEBYTES + (2 * range) + ((cases[0].match != 0) ? 4 : 0);
+      tableCycles = TABLECYCLES + ((cases[0].match != 0) ? 4 : 0);
+      tableCost = (CYCLEWEIGHT * tableCycles) + tableBytes;
+   }
+   else {
+      tableCost = INT_MAX;
+   }
+   
+   if ((tableCost < chainCost) && (tableCost <= treeCost)) {
+      emitText("; switch: %d cases by jump table\n", nCases);
+      emitJumpTable(cases, nCases, defaultLabel);
+   }
+   else if (treeCost < chainCost) {
+      emitText("; switch: %d cases by binary search\n", nCases);
+      emitTree(cases, nCases, defaultLabel, nextLabel);
+   }
+   else {
+      emitText("; switch: %d cases by compare chain\n", nCases);
+      emitChain(cases, nCases, defaultLabel, nextLabel);
+   }
+}
+
+
+/* EmitCallFunction --- code to call a function */
+
+void EmitCallFunction(const char name[], const char comment[])
+{
+   char target[30];
+
+   snprintf(target, sizeof (target), "%c%s", NAME_PREFIX, name);
+
+   Emit("jsr", target, comment);
+}
+
+
+
+static void emitExpr(const struct ExprNode *e);
+static void emitCondition(const struct ExprNode *e, const int label, const bool sense, const char stmt[]);
+
+
+/* isWord --- return true if a value is held in 16 bits */
+
+static bool isWord(const struct ExprNode *e)
+{
+   switch (e->type) {
+   case T_SHORT:
+   case T_USHORT:
+   case T_INT:
+   case T_UINT:
+      return (true);
+   }
+   
+   return (e->pLevel > 0);
+}
+
+
+/* isRegisterVar --- return true if a node is a variable held in Y or W */
+
+static bool isRegisterVar(const struct ExprNode *e)
+{
+   return ((e->kind == N_VAR) && (e->sym->storageClass == SCREGISTER));
+}
+
+
+/* isPointerVar --- return true if a node is a pointer variable, so that it can be used indirectly */
+
+static bool isPointerVar(const struct ExprNode *e)
+{
+   return ((e->kind == N_VAR) && (e->pLevel > 0));
+}
+
+
+/* isOperand --- return true if a value can be the operand of an instruction such as 'addd' */
+
+static bool isOperand(const struct ExprNode *e)
+{
+   switch (e->kind) {
+   case N_CONST:
+   case N_STRING:
+      return (true);                               // '#n' or '#lnnnn'
+   case N_VAR:
+      return (isWord(e) && (isRegisterVar(e) == false));
+   case N_ADDR:
+      return (e->sym->storageClass != SCAUTO);     // '#_name' or '#lnnnn'
+   case N_DEREF:
+      return (isWord(e) && isPointerVar(e->left)); // '[p]' or ',y'
+   }
+   
+   return (false);
+}
+
+
+/* isByteOperand --- return true if each byte of a value can be the operand of an instruction such as 'anda' */
+
+static bool isByteOperand(const struct ExprNode *e)
+{
+   if ((e->kind == N_DEREF) && isWord(e) && isRegisterVar(e->left))
+      return (true);                               // ',y' and '1,y'
+   
+   return ((e->kind == N_CONST) || ((e->kind == N_VAR) && isOperand(e)));
+}
+
+
+/* isOperandFor --- return true if a value can be the right-hand operand of an operator without being pushed */
+
+static bool isOperandFor(const int kind, const struct ExprNode *e)
+{
+   if ((kind == N_AND) || (kind == N_OR) || (kind == N_XOR))
+      return (isByteOperand(e));
+   
+   return (isOperand(e));
+}
+
+
+/* isCommutative --- return true if the operands of an operator may be swapped */
+
+static bool isCommutative(const int kind)
+{
+   switch (kind) {
+   case N_ADD:
+   case N_MUL:
+   case N_AND:
+   case N_OR:
+   case N_XOR:
+   case N_EQ:
+   case N_NE:
+   case N_LT:     // Relational operators are reversed when swapped
+   case N_LE:
+   case N_GT:
+   case N_GE:
+      return (true);
+   }
+   
+   return (false);
+}
+
+
+/* worthSwapping --- return true if the operands of a commutative operator should be swapped */
+
+static bool worthSwapping(const struct ExprNode *e)
+{
+   const struct ExprNode *l = e->left;
+   const struct ExprNode *r = e->right;
+   
+   // Constants go on the right, for immediate operands and cheap shifts
+   if (r->kind == N_CONST)
+      return (false);
+   
+   if (l->kind == N_CONST)
+      return (true);
+   
+   if (isOperandFor(e->kind, r))
+      return (false);
+   
+   if (isOperandFor(e->kind, l))
+      return (true);
+   
+   // Neither operand can be used directly, so the right-hand one is
+   // evaluated and pushed first. That should be the one that needs more.
+   return (l->need > r->need);
+}
+
+
+/* labelTree --- work out the Sethi-Ullman number of each node, and order the operands to suit */
+
+static void labelTree(struct ExprNode *e)
+{
+   static const int reversed[] = {N_EQ, N_NE, N_GT, N_GE, N_LT, N_LE};
+   struct ExprNode *tmp;
+   struct ExprNode *arg;
+   
+   switch (e->kind) {
+   case N_CONST:
+   case N_STRING:
+   case N_VAR:
+   case N_ADDR:
+      e->need = 1;
+      return;
+   case N_CALL:
+      // Each argument is pushed as soon as it's evaluated, and the
+      // call leaves nothing in registers except its result
+      for (arg = e->left; arg != NULL; arg = arg->right)
+         labelTree(arg->left);
+      
+      e->need = 1;
+      return;
+   case N_COND:
+      labelTree(e->left);
+      labelTree(e->right);
+      labelTree(e->third);
+      
+      e->need = e->left->need;
+      
+      if (e->right->need > e->need)
+         e->need = e->right->need;
+      
+      if (e->third->need > e->need)
+         e->need = e->third->need;
+      
+      return;
+   case N_LOGAND:
+   case N_LOGOR:
+      // Each operand is tested on its own, so nothing is ever pushed
+      labelTree(e->left);
+      labelTree(e->right);
+      
+      e->need = (e->left->need > e->right->need) ? e->left->need : e->right->need;
+      return;
+   }
+   
+   labelTree(e->left);
+   
+   if (e->right == NULL) {
+      e->need = e->left->need;
+      return;
+   }
+   
+   labelTree(e->right);
+   
+   if (isCommutative(e->kind) && worthSwapping(e)) {
+      tmp = e->left;
+      e->left = e->right;
+      e->right = tmp;
+      
+      if ((e->kind >= N_EQ) && (e->kind <= N_GE))
+         e->kind = reversed[e->kind - N_EQ];
+   }
+   
+   // With a single accumulator, a right-hand operand that can't be used
+   // directly from memory has to be pushed onto the stack
+   if (isOperandFor(e->kind, e->right))
+      e->need = e->left->need;
+   else if (e->left->need == e->right->need)
+      e->need = e->left->need + 1;
+   else
+      e->need = (e->left->need > e->right->need) ? e->left->need : e->right->need;
+}
+
+
+/* emitOperand --- emit an instruction that uses a value directly from memory, or one byte of it */
+
+static void emitOperand(const char inst[], const struct ExprNode *e, const int offset, const char comment[])
+{
+   const struct Symbol *sym = (e->kind == N_DEREF) ? e->left->sym : e->sym;
+   const int size = (sym != NULL) ? OPERANDSIZE(sym) : 16;
+   char target[size];
+   char oper[size + 2];
    
-   if (nBytes != 0) {
-      char frame[32];
-      
-      snprintf(frame, sizeof (frame), "-%d,s", nBytes);
-      Emit("leas", frame, "Allocate stack frame");
+   switch (e->kind) {
+   case N_CONST:
+      emitImmediate(inst, e->value, comment);
+      return;
+   case N_STRING:
+      snprintf(oper, sizeof (oper), "#l%04d", e->value);
+      break;
+   case N_ADDR:
+      GenTargetOperand(sym, 0, target);
+      snprintf(oper, sizeof (oper), "#%s", target);
+      break;
+   case N_VAR:
+      GenTargetOperand(sym, offset, oper);
+      directRef(sym, 1);
+      break;
+   case N_DEREF:
+      if (sym->storageClass == SCREGISTER) {
+         if (offset == 0)
+            snprintf(oper, sizeof (oper), ",y");
+         else
+            snprintf(oper, sizeof (oper), "%d,y", offset);
+      }
+      else {
+         GenTargetOperand(sym, 0, target);
+         snprintf(oper, sizeof (oper), "[%s]", target);
+      }
+      break;
    }
+   
+   Emit(inst, oper, comment);
 }
 
 
-/* EmitFunctionExit --- emit return label and function exit code */
+/* emitPush --- evaluate an expression and push its value onto the stack */
 
-void EmitFunctionExit(const int returnLabel, const int nRegister)
+static void emitPush(const struct ExprNode *e, const char comment[])
 {
-   EmitLabel(returnLabel);
-   Emit("tfr", "u,s", "Deallocate stack frame");
-   if (nRegister == 0) {
-      Emit("puls", "u", "Restore frame pointer");
+   if (isRegisterVar(e) && isWord(e) && (e->sym->reg == R_W)) {
+      Emit("pshsw", "", comment);
+   }
+   else if (isRegisterVar(e) && isWord(e)) {
+      Emit("pshs", "y", comment);
    }
    else {
-      Emit("puls", "u,y", "Restore frame pointer & register variable");
+      emitExpr(e);
+      Emit("pshs", "d", comment);
    }
-   Emit("rts", "", "Return to caller");
 }
 
 
-/* EmitStackCleanup --- emit code to clean up stack after a function call */
+/* emitWithOperand --- evaluate the left operand into D and apply 'inst' with the right one */
 
-void EmitStackCleanup(const int nBytes)
+static void emitWithOperand(const struct ExprNode *e, const char inst[], const char comment[])
 {
-   if (nBytes != 0) {
-      char buf[32];
-      
-      snprintf(buf, sizeof (buf), "%d,s", nBytes);
-      Emit("leas", buf, "clear actual parameters off stack");
+   if (isOperand(e->right)) {
+      emitExpr(e->left);
+      emitOperand(inst, e->right, 0, comment);
+   }
+   else {
+      emitPush(e->right, "Save right-hand operand");
+      emitExpr(e->left);
+      Emit(inst, ",s++", comment);
    }
 }
 
 
-/* EmitStaticCharArray --- emit declaration for an initialised char array or string */
+/* emitByteImmediate --- emit an 8-bit logical operation with a constant, if it does anything */
 
-void EmitStaticCharArray(const struct StringConstant *sc, const char name[])
+static void emitByteImmediate(const char inst[], const int value, const char comment[])
 {
-   char target[8];
-   char bytes[64];
-   int i, n;
-
-   snprintf(target, sizeof (target), "l%04d", sc->label);
-   
-   bytes[0] = '\0';
+   const char reg = inst[strlen(inst) - 1];
+   char op[8];
    
-   if (sc->sLength > 7) {
-      n = 7;
-   }
-   else {
-      n = sc->sLength;
-   }
-
-   for (i = 0; i < n; i++) {
-      char hex[8];
-      
-      sprintf(hex, "$%02x", sc->sValue[i] & 0xff);
-      
-      strcat(bytes, hex);
+   if (strncmp(inst, "and", 3) == 0) {
+      if (value == 0xff)
+         return;
       
-      if (i < (n - 1)) {
-         strcat(bytes, ",");
+      if (value == 0) {
+         snprintf(op, sizeof (op), "clr%c", reg);
+         Emit(op, "", comment);
+         return;
       }
    }
-   
-   fprintf(Asm, "%-7s fcb  %-32s ; const char %s[%d] = %s\n", target, bytes, name, sc->sLength - 1, sc->str);
-   
-   while (i < sc->sLength) {
-      n += 7;
+   else if (strncmp(inst, "or", 2) == 0) {
+      if (value == 0)
+         return;
+   }
+   else {
+      if (value == 0)
+         return;
       
-      if (n > sc->sLength) {
-         n = sc->sLength;
-      }
-
-      bytes[0] = '\0';
-
-      for ( ; i < n; i++) {
-         char hex[8];
-
-         sprintf(hex, "$%02x", sc->sValue[i] & 0xff);
-         
-         strcat(bytes, hex);
-         
-         if (i < (n - 1)) {
-            strcat(bytes, ",");
-         }
-
+      if (value == 0xff) {
+         snprintf(op, sizeof (op), "com%c", reg);
+         Emit(op, "", comment);
+         return;
       }
-
-      fprintf(Asm, "        fcb  %s\n", bytes);
    }
+   
+   emitImmediate(inst, value, comment);
 }
 
 
-/* GenTargetOperand --- generate the assembler operand to address a scalar variable */
+/* emitLogical --- generate code for '&', '|' or '^', a byte at a time */
 
-static void GenTargetOperand(const struct Symbol *const sym, const int offset, char target[])
+static void emitLogical(const struct ExprNode *e, const char hiInst[], const char loInst[], const char comment[])
 {
-   if (offset == 0) {
-      switch (sym->storageClass) {
-      case SCEXTERN:
-         snprintf(target, MAXNAME + 1, "%c%s", NAME_PREFIX, sym->name);
-         break;
-      case SCSTATIC:
-         snprintf(target, MAXNAME + 1, "l%04d", sym->label);
-         break;
-      case SCAUTO:
-         snprintf(target, MAXNAME + 1, "%d,u", sym->fpOffset);
-         break;
-      case SCREGISTER:
-         snprintf(target, MAXNAME + 1, "#0");
-         break;
-      }
+   const struct ExprNode *r = e->right;
+   
+   if (r->kind == N_CONST) {
+      emitExpr(e->left);
+      emitByteImmediate(hiInst, (r->value >> 8) & 0xff, comment);
+      emitByteImmediate(loInst, r->value & 0xff, comment);
+   }
+   else if (isByteOperand(r)) {
+      emitExpr(e->left);
+      emitOperand(hiInst, r, 0, comment);
+      emitOperand(loInst, r, 1, comment);
    }
    else {
-      switch (sym->storageClass) {
-      case SCEXTERN:
-         snprintf(target, MAXNAME + 1, "%c%s+%d", NAME_PREFIX, sym->name, offset);
-         break;
-      case SCSTATIC:
-         snprintf(target, MAXNAME + 1, "l%04d+%d", sym->label, offset);
-         break;
-      case SCAUTO:
-         snprintf(target, MAXNAME + 1, "%d,u", sym->fpOffset + offset);
-         break;
-      case SCREGISTER:
-         snprintf(target, MAXNAME + 1, "#0");
-         break;
-      }
+      emitPush(r, "Save right-hand operand");
+      emitExpr(e->left);
+      Emit(hiInst, ",s+", comment);
+      Emit(loInst, ",s+", comment);
    }
 }
 
 
+/* emitShiftBy --- shift D by a constant number of bits */
 
-/* storageClassAsString --- generate a string representation of a storage class */
-
-static char *storageClassAsString(const int sc)
+static void emitShiftBy(int n, const bool isLeft, const bool isUnsigned)
 {
-   char *str = "";
+   if (n > 15) {
+      if (isLeft || isUnsigned) {
+         emitImmediate("ldd", 0, "Every bit shifted out");
+         return;
+      }
+      
+      n = 15;
+   }
    
-   switch (sc) {
-   case SCEXTERN:
-      str = "extern";
-      break;
-   case SCSTATIC:
-      str = "static";
-      break;
-   case SCAUTO:
-      str = "auto";
-      break;
-   case SCREGISTER:
-      str = "register";
-      break;
+   if (n >= 8) {
+      if (isLeft) {
+         Emit("tfr", "b,a", "Shift left 8 bits");
+         Emit("clrb", "", "");
+      }
+      else {
+         Emit("tfr", "a,b", "Shift right 8 bits");
+         Emit(isUnsigned ? "clra" : "sex", "", "");
+      }
+      
+      n -= 8;
    }
    
-   return (str);
+   for ( ; n > 0; n--) {
+      if (isLeft) {
+         Emit("aslb", "", "Shift left");
+         Emit("rola", "", "");
+      }
+      else {
+         Emit(isUnsigned ? "lsra" : "asra", "", "Shift right");
+         Emit("rorb", "", "");
+      }
+   }
 }
 
 
-/* typeAsString --- generate a string representation of a type */
+/* powerOfTwo --- return 'n' if a constant is two to the power 'n', or -1 */
 
-static char *typeAsString(const int ty)
+static int powerOfTwo(const struct ExprNode *e)
 {
-   char *str = "";
+   const unsigned int value = e->value & 0xffff;
+   int n;
    
-   switch (ty) {
-   case T_CHAR:
-      str = "char";
-      break;
-   case T_UCHAR:
-      str = "unsigned char";
-      break;
-   case T_INT:
-      str = "int";
-      break;
-   case T_UINT:
-      str = "unsigned int";
-      break;
-   case T_FLOAT:
-      str = "float";
-      break;
-   case T_DOUBLE:
-      str = "double";
-      break;
-   }
+   if (e->kind != N_CONST)
+      return (-1);
    
-   return (str);
+   for (n = 0; n < 16; n++)
+      if (value == (1u << n))
+         return (n);
+   
+   return (-1);
 }
 
 
-/* LoadScalar --- load a scalar variable into D or Q */
+/* emitHelper --- call a run-time routine with the left operand in D and the right one in X */
 
-void LoadScalar(const struct Symbol *const sym)
+static void emitHelper(const struct ExprNode *e, const char name[], const unsigned int helper, const char comment[])
 {
-   char comment[MAXNAME + 64];
-   const char *sc = storageClassAsString(sym->storageClass);
-   const char *ty = typeAsString(sym->type);
-   
-   snprintf(comment, sizeof (comment), "Load %s %s %s", sc, ty, sym->name);
-   
-   if (sym->storageClass == SCREGISTER) {
-      switch (sym->type) {
-      case T_CHAR:
-         Emit("tfr", "y,d", comment);
-         Emit("sex", "", "Sign extend to 16 bits");
-         break;
-      case T_UCHAR:
-         Emit("tfr", "y,d", comment);
-         Emit("clra", "", "No sign extension");
-         break;
-      case T_SHORT:
-      case T_USHORT:
-      case T_INT:
-      case T_UINT:
-         Emit("tfr", "y,d", comment);
-         break;
-      }
+   if (isOperand(e->right)) {
+      emitExpr(e->left);
+      emitOperand("ldx", e->right, 0, "Right-hand operand");
    }
    else {
-      char target[MAXNAME + 1];
-
-      GenTargetOperand(sym, 0, target);
-
-      switch (sym->type) {
-      case T_CHAR:
-         Emit("ldb", target, comment);
-         Emit("sex", "", "Sign extend to 16 bits");
-         break;
-      case T_UCHAR:
-         Emit("ldb", target, comment);
-         Emit("clra", "", "No sign extension");
-         break;
-      case T_SHORT:
-      case T_USHORT:
-      case T_INT:
-      case T_UINT:
-         Emit("ldd", target, comment);
-         break;
-      case T_LONG:
-      case T_ULONG:
-         Emit("ldq", target, comment);
-         break;
-      case T_FLOAT:
-         Emit("ldq", target, comment);
-         break;
-      case T_DOUBLE:
-         Emit("ldq", target, comment);
-         Emit("nop", "", "How to load low 32 bits?");
-         break;
-      }
+      emitPush(e->right, "Save right-hand operand");
+      emitExpr(e->left);
+      Emit("puls", "x", "Right-hand operand");
    }
+   
+   Emit("jsr", name, comment);
+   Helpers |= helper;
 }
 
 
-/* StoreScalar --- store a scalar variable from D or Q */
+/* emitMultiply --- generate code for '*' */
 
-void StoreScalar(const struct Symbol *const sym)
+static void emitMultiply(const struct ExprNode *e)
 {
-   char comment[MAXNAME + 64];
-   const char *sc = storageClassAsString(sym->storageClass);
-   const char *ty = typeAsString(sym->type);
+   const int n = powerOfTwo(e->right);
    
-   snprintf(comment, sizeof (comment), "Store %s %s %s", sc, ty, sym->name);
-
-   if (sym->storageClass == SCREGISTER) {
-      switch (sym->type) {
-      case T_CHAR:
-      case T_UCHAR:
-         Emit("tfr", "d,y", comment);
-         break;
-      case T_SHORT:
-      case T_USHORT:
-      case T_INT:
-      case T_UINT:
-         Emit("tfr", "d,y", comment);
-         break;
-      }
+   if (n >= 0) {
+      emitExpr(e->left);
+      emitShiftBy(n, true, false);
    }
-   else {
-      char target[MAXNAME + 1];
-
-      GenTargetOperand(sym, 0, target);
-
-      switch (sym->type) {
-      case T_CHAR:
-      case T_UCHAR:
-         Emit("stb", target, comment);
-         break;
-      case T_SHORT:
-      case T_USHORT:
-      case T_INT:
-      case T_UINT:
-         Emit("std", target, comment);
-         break;
-      case T_LONG:
-      case T_ULONG:
-         Emit("stq", target, comment);
-         break;
-      case T_FLOAT:
-         Emit("stq", target, comment);
-         break;
-      case T_DOUBLE:
-         Emit("stq", target, comment);
-         GenTargetOperand(sym, 4, target);
-         Emit("stq", target, "Store low 32 bits");
-         break;
-      case T_VOID:
-         break;
-      }
+   else {
+      emitHelper(e, "mul16", H_MUL, "multiply");
    }
 }
 
 
-/* LoadIntConstant --- load an int constant into a given register */
+/* emitDivide --- generate code for '/' or '%' */
 
-void LoadIntConstant(const int val, const int reg, const char comment[])
+static void emitDivide(const struct ExprNode *e)
 {
-   char immediate[8];
+   const bool isUnsigned = IsUnsignedNode(e->left) || IsUnsignedNode(e->right);
+   const int n = powerOfTwo(e->right);
+   
+   if (isUnsigned && (n >= 0)) {
+      emitExpr(e->left);
+      
+      if (e->kind == N_DIV) {
+         emitShiftBy(n, false, true);
+      }
+      else {
+         emitByteImmediate("anda", ((e->right->value - 1) >> 8) & 0xff, "remainder");
+         emitByteImmediate("andb", (e->right->value - 1) & 0xff, "remainder");
+      }
+   }
+   else {
+      if (isUnsigned)
+         emitHelper(e, "udiv16", H_UDIV, "unsigned divide");
+      else
+         emitHelper(e, "sdiv16", H_SDIV | H_UDIV, "signed divide");
+      
+      if (e->kind == N_MOD)
+         Emit("tfr", "x,d", "Remainder");
+   }
+}
 
-   snprintf(immediate, sizeof (immediate), "#%d", val);
 
-   switch (reg) {
-   case 'D':
-   case 'd':
-      Emit("ldd", immediate, comment);
-      break;
-   case 'X':
-   case 'x':
-      Emit("ldx", immediate, comment);
-      break;
-   case 'Y':
-   case 'y':
-      Emit("ldy", immediate, comment);
-      break;
+/* emitShift --- generate code for '<<' or '>>' */
+
+static void emitShift(const struct ExprNode *e)
+{
+   const bool isLeft = (e->kind == N_LSHIFT);
+   const bool isUnsigned = IsUnsignedNode(e->left);
+   
+   if (e->right->kind == N_CONST) {
+      emitExpr(e->left);
+      emitShiftBy(e->right->value & 0xffff, isLeft, isUnsigned);
+   }
+   else if (isLeft) {
+      emitHelper(e, "asl16", H_ASL, "shift left");
+   }
+   else if (isUnsigned) {
+      emitHelper(e, "lsr16", H_LSR, "shift right");
+   }
+   else {
+      emitHelper(e, "asr16", H_ASR, "shift right");
    }
 }
 
 
-/* LoadLabelAddr --- load the address of a generated label */
+/* emitAddress --- generate code to load the address of a variable */
 
-void LoadLabelAddr(const int label, const char comment[])
+static void emitAddress(const struct ExprNode *e)
 {
-   char target[8];
-
-   snprintf(target, sizeof (target), "#l%04d", label);
+   char oper[32];
+   char comment[COMMENTSIZE(e->sym)];
    
-   Emit("ldd", target, comment);
+   snprintf(comment, sizeof (comment), "Address of %s", e->sym->name);
+   
+   if (e->sym->storageClass == SCAUTO) {
+      snprintf(oper, sizeof (oper), "%d,u", frameOffset(e->sym));
+      Emit("leax", oper, comment);
+      Emit("tfr", "x,d", "");
+   }
+   else {
+      emitOperand("ldd", e, 0, comment);
+   }
 }
 
 
-/* EmitExternScalar --- emit declaration for an extern scalar variable */
+/* emitDeref --- generate code to load the object that a pointer points to */
 
-void EmitExternScalar(const struct Symbol *const sym, const int init, const double fInit)
+static void emitDeref(const struct ExprNode *e)
 {
-   char name[MAXNAME + 1];
-   char *storage = "";
-   int b1, b2, b3, b4, b5, b6, b7, b8;
-   union {
-      float f;
-      unsigned char b[4];
-   } f;
-   union {
-      double d;
-      unsigned char b[4];
-   } d;
+   const char *load = isWord(e) ? "ldd" : "ldb";
    
-   if (sym->storageClass == SCEXTERN) {
-      snprintf(name, sizeof (name), "%c%s", NAME_PREFIX, sym->name);
-   }
-   else if (sym->storageClass == SCSTATIC) {
-      snprintf(name, sizeof (name), "l%04d", sym->label);
-      storage = "static ";
+   if (isPointerVar(e->left)) {
+      char comment[COMMENTSIZE(e->left->sym)];
+      
+      snprintf(comment, sizeof (comment), "Load *%s", e->left->sym->name);
+      emitOperand(load, e, 0, comment);
    }
    else {
-      fprintf(stderr, "Only 'extern' or 'static' is valid\n");
+      emitExpr(e->left);
+      Emit("tfr", "d,x", "Pointer");
+      Emit(load, ",x", "Load through pointer");
    }
    
-   if (sym->pLevel == 0) {
-      switch (sym->type) {
-      case T_CHAR:
-      case T_UCHAR:
-         fprintf(Asm, "%-30s  fcb  %d      ; %schar %s = %d\n", name, init, storage, sym->name, init);
-         break;
-      case T_SHORT:
-      case T_USHORT:
-      case T_INT:
-      case T_UINT:
-         fprintf(Asm, "%-30s  fdb  %d      ; %sint %s = %d\n", name, init, storage, sym->name, init);
-         break;
-      case T_LONG:
-      case T_ULONG:
-         fprintf(Asm, "%-30s  fqb  %d      ; %slong int %s = %d\n", name, init, storage, sym->name, init);
-         break;
-      case T_FLOAT:
-         f.f = fInit;
-         
-         b1 = f.b[3];   // 6809 is big-endian
-         b2 = f.b[2];
-         b3 = f.b[1];
-         b4 = f.b[0];
+   if (isWord(e) == false) {
+      if (e->type == T_UCHAR)
+         Emit("clra", "", "No sign extension");
+      else
+         Emit("sex", "", "Sign extend to 16 bits");
+   }
+}
 
-         fprintf(Asm, "%-30s  fcb  %d,%d,%d,%d         ; %sfloat %s = %g\n", name, b1, b2, b3, b4, storage, sym->name, fInit);
-         break;
-      case T_DOUBLE:
-         d.d = fInit;
-         
-         b1 = d.b[7];   // 6809 is big-endian
-         b2 = d.b[6];
-         b3 = d.b[5];
-         b4 = d.b[4];
-         b5 = d.b[3];
-         b6 = d.b[2];
-         b7 = d.b[1];
-         b8 = d.b[0];
 
-         fprintf(Asm, "%-30s  fcb  %d,%d,%d,%d,%d,%d,%d,%d ; %sdouble %s = %g\n", name, b1, b2, b3, b4, b5, b6, b7, b8, storage, sym->name, fInit);
-         break;
-      }
+/* emitAssign --- generate code for an assignment, leaving the value in D */
+
+static void emitAssign(const struct ExprNode *e)
+{
+   const struct ExprNode *l = e->left;
+   const char *store = isWord(l) ? "std" : "stb";
+   
+   if (l->kind == N_VAR) {
+      emitExpr(e->right);
+      StoreScalar(l->sym);
+   }
+   else if (isPointerVar(l->left)) {
+      char comment[COMMENTSIZE(l->left->sym)];
+      
+      snprintf(comment, sizeof (comment), "Store *%s", l->left->sym->name);
+      emitExpr(e->right);
+      emitOperand(store, l, 0, comment);
    }
    else {
-      fprintf(Asm, "%-30s  fdb  %d     ; %spointer %s = %d\n", name, init, storage, sym->name, init);
+      emitPush(e->right, "Save value to store");
+      emitExpr(l->left);
+      Emit("tfr", "d,x", "Pointer");
+      Emit("puls", "d", "Value to store");
+      Emit(store, ",x", "Store through pointer");
    }
 }
 
 
-/* EmitJump --- emit a jump (possibly relative) to a given label */
+/* emitIncDec --- generate code for '++' or '--', loading the value only if it's needed */
 
-void EmitJump(const int label, const char comment[])
+static void emitIncDec(const struct ExprNode *e, const bool needValue)
 {
-   char target[8];
+   const struct Symbol *sym = e->left->sym;
+   const bool isPost = (e->kind == N_POSTINC) || (e->kind == N_POSTDEC);
+   const int step = (e->pLevel > 0) ? ObjectSize(e->type, e->pLevel - 1) : 1;
+   
+   if (needValue && isPost)
+      LoadScalar(sym);
    
-   snprintf(target, sizeof (target), "l%04d", label);
+   if ((e->kind == N_PREINC) || (e->kind == N_POSTINC))
+      EmitIncScalar(sym, step);
+   else
+      EmitIncScalar(sym, -step);
    
-   Emit("jmp", target, comment);
+   if (needValue && (isPost == false))
+      LoadScalar(sym);
 }
 
 
-/* EmitBranchIfEqual --- emit a BEQ to a label */
+/* emitArgs --- push a list of actual parameters, last first, and return the bytes stacked */
 
-void EmitBranchIfEqual(const int label, const char comment[])
+static int emitArgs(const struct ExprNode *arg)
 {
-   char target[8];
+   int stackedBytes;
+   
+   if (arg == NULL)
+      return (0);
    
-   snprintf(target, sizeof (target), "l%04d", label);
+   // The first parameter ends up nearest the return address
+   stackedBytes = emitArgs(arg->right);
    
-   Emit("lbeq", target, comment);
+   // TODO: actual parameters other than 2 bytes long
+   emitPush(arg->left, "<actual parameter>");
+   
+   return (stackedBytes + 2);
 }
 
 
-/* EmitBranchNotEqual --- emit a BNE to a label */
+/* emitCall --- generate code to call a function, pushing its arguments first */
 
-void EmitBranchNotEqual(const int label, const char comment[])
+static void emitCall(const struct ExprNode *e)
 {
-   char target[8];
+   const struct ExprNode *first = e->left;
+   const struct ExprNode *second = (first != NULL) ? first->right : NULL;
+   const int nRegArgs = (e->sym != NULL) ? e->sym->regParams : 0;
+   int stackedBytes;
+   
+   if ((nRegArgs == 0) || (first == NULL)) {
+      stackedBytes = emitArgs(first);
+   }
+   else if ((nRegArgs == 1) || (second == NULL)) {
+      stackedBytes = emitArgs(second);
+      emitExpr(first->left);
+   }
+   else {
+      // The first argument goes in D and the second in X, which
+      // has to be loaded last if evaluating the first might use it
+      stackedBytes = emitArgs(second->right);
+      
+      if (isOperand(second->left)) {
+         emitExpr(first->left);
+         emitOperand("ldx", second->left, 0, "<actual parameter in X>");
+      }
+      else if (isRegisterVar(second->left) && isWord(second->left)) {
+         emitExpr(first->left);
+         Emit("tfr", (second->left->sym->reg == R_W) ? "w,x" : "y,x", "<actual parameter in X>");
+      }
+      else {
+         emitPush(second->left, "<actual parameter>");
+         emitExpr(first->left);
+         Emit("puls", "x", "<actual parameter in X>");
+      }
+   }
    
-   snprintf(target, sizeof (target), "l%04d", label);
+   if (first == NULL)
+      EmitCallFunction(e->name, "call function no actual parameters");
+   else
+      EmitCallFunction(e->name, "call function with parameters");
    
-   Emit("lbne", target, comment);
+   EmitStackCleanup(stackedBytes);
 }
 
 
-/* EmitIncScalar --- emit an INC for a scalar variable */
+/* emitTruth --- generate code to load 1 if a condition is true, or 0 */
 
-void EmitIncScalar(const struct Symbol *const sym, const int amount)
+static void emitTruth(const struct ExprNode *e)
 {
-   char op[30];
-   char comment[MAXNAME + 64];
-   const char *sc = storageClassAsString(sym->storageClass);
-   const char *ty = typeAsString(sym->type);
-   char *incDec = "inc";
+   const int falseLabel = AllocLabel('F');
+   const int endLabel = AllocLabel('T');
    
-   if (amount < 0) {
-      incDec = "dec";
-   }
+   emitCondition(e, falseLabel, false, "value");
+   emitImmediate("ldd", 1, "True");
+   EmitJump(endLabel, "");
+   EmitLabel(falseLabel);
+   emitImmediate("ldd", 0, "False");
+   EmitLabel(endLabel);
+}
 
-   snprintf(comment, sizeof (comment), "%s %s %s %s", incDec, sc, ty, sym->name);
 
+/* emitConditional --- generate code for 'a ? b : c' */
 
-   if (sym->storageClass == SCREGISTER) {
-      snprintf(op, sizeof (op), "%d,y", amount);
+static void emitConditional(const struct ExprNode *e)
+{
+   const int elseLabel = AllocLabel('E');
+   const int endLabel = AllocLabel('I');
+   
+   emitCondition(e->left, elseLabel, false, "?:");
+   emitExpr(e->right);
+   EmitJump(endLabel, "?: jump to end");
+   EmitLabel(elseLabel);
+   emitExpr(e->third);
+   EmitLabel(endLabel);
+}
 
-      switch (sym->type) {
-      case T_CHAR:
-      case T_UCHAR:
-      case T_SHORT:
-      case T_USHORT:
-      case T_INT:
-      case T_UINT:
-         Emit("leay", op, comment);
-         break;
+
+/* emitExpr --- generate code to leave the value of an expression in D */
+
+static void emitExpr(const struct ExprNode *e)
+{
+   char comment[256];
+   
+   switch (e->kind) {
+   case N_CONST:
+      if (e->text != NULL)
+         snprintf(comment, sizeof (comment), "%.*s", e->textLength, e->text);
+      else
+         snprintf(comment, sizeof (comment), "Constant");
+      
+      emitImmediate("ldd", e->value, comment);
+      break;
+   case N_STRING:
+      snprintf(comment, sizeof (comment), "%.*s", e->textLength, e->text);
+      LoadLabelAddr(e->value, comment);
+      break;
+   case N_VAR:
+      LoadScalar(e->sym);
+      break;
+   case N_ADDR:
+      emitAddress(e);
+      break;
+   case N_DEREF:
+      emitDeref(e);
+      break;
+   case N_CALL:
+      emitCall(e);
+      break;
+   case N_CAST:
+      emitExpr(e->left);
+      
+      if ((e->pLevel == 0) && (e->type == T_CHAR))
+         Emit("sex", "", "Convert to 'char'");
+      else if ((e->pLevel == 0) && (e->type == T_UCHAR))
+         Emit("clra", "", "Convert to 'unsigned char'");
+      
+      break;
+   case N_NEG:
+      emitExpr(e->left);
+      Emit("nega", "", "Negate D");
+      Emit("negb", "", "");
+      emitImmediate("sbca", 0, "");
+      break;
+   case N_COM:
+      emitExpr(e->left);
+      Emit("coma", "", "Complement D");
+      Emit("comb", "", "");
+      break;
+   case N_PREINC:
+   case N_PREDEC:
+   case N_POSTINC:
+   case N_POSTDEC:
+      emitIncDec(e, true);
+      break;
+   case N_ASSIGN:
+      emitAssign(e);
+      break;
+   case N_ADD:
+      emitWithOperand(e, "addd", "add");
+      break;
+   case N_SUB:
+      emitWithOperand(e, "subd", "subtract");
+      break;
+   case N_MUL:
+      emitMultiply(e);
+      break;
+   case N_DIV:
+   case N_MOD:
+      emitDivide(e);
+      break;
+   case N_AND:
+      emitLogical(e, "anda", "andb", "and");
+      break;
+   case N_OR:
+      emitLogical(e, "ora", "orb", "or");
+      break;
+   case N_XOR:
+      emitLogical(e, "eora", "eorb", "exclusive or");
+      break;
+   case N_LSHIFT:
+   case N_RSHIFT:
+      emitShift(e);
+      break;
+   case N_NOT:
+   case N_EQ:
+   case N_NE:
+   case N_LT:
+   case N_LE:
+   case N_GT:
+   case N_GE:
+   case N_LOGAND:
+   case N_LOGOR:
+      emitTruth(e);
+      break;
+   case N_COND:
+      emitConditional(e);
+      break;
+   }
+}
+
+
+/* emitCompare --- compare the operands of a relational operator and return the condition to test */
+
+static int emitCompare(const struct ExprNode *e, const char comment[])
+{
+   static const int conditions[] = {C_EQ, C_NE, C_LT, C_LE, C_GT, C_GE};
+   
+   if (isOperand(e->right)) {
+      if (isRegisterVar(e->left) && isWord(e->left)) {
+         emitOperand((e->left->sym->reg == R_W) ? "cmpw" : "cmpy", e->right, 0, comment);
+      }
+      else {
+         emitExpr(e->left);
+         emitOperand("cmpd", e->right, 0, comment);
       }
    }
    else {
-      char target[MAXNAME + 1];
+      emitPush(e->right, "Save right-hand operand");
+      emitExpr(e->left);
+      EmitCompareStacked(comment);
+   }
+   
+   return (conditions[e->kind - N_EQ]);
+}
 
-      GenTargetOperand(sym, 0, target);
 
-      snprintf(op, sizeof (op), "%d,x", amount);
+/* emitCondition --- generate code to branch to 'label' if the truth of an expression is 'sense' */
 
-      switch (sym->type) {
-      case T_CHAR:
-      case T_UCHAR:
-         if (amount == 1) {
-            Emit("inc", target, comment);
-         }
-         else if (amount == -1) {
-            Emit("dec", target, comment);
-         }
-         else {
-            fprintf(stderr, "Inc/Dec by more than 1\n");
-         }
-         break;
-      case T_SHORT:
-      case T_USHORT:
-      case T_INT:
-      case T_UINT:
-         Emit("ldx", target, comment);
-         Emit("leax", op, incDec);
-         Emit("stx", target, comment);
-         break;
-      case T_LONG:
-      case T_ULONG:
-         Emit("nop", "", comment);
-         break;
-      case T_FLOAT:
-         Emit("nop", "", comment);
-         break;
-      case T_DOUBLE:
-         Emit("nop", "", comment);
-         break;
+static void emitCondition(const struct ExprNode *e, const int label, const bool sense, const char stmt[])
+{
+   static const int inverse[] = {C_NE, C_EQ, C_GE, C_GT, C_LE, C_LT};
+   char comment[32];
+   int cond;
+   int skip;
+   
+   switch (e->kind) {
+   case N_CONST:
+      if (((e->value & 0xffff) != 0) == sense) {
+         snprintf(comment, sizeof (comment), "%s: always", stmt);
+         EmitJump(label, comment);
+      }
+      break;
+   case N_NOT:
+      emitCondition(e->left, label, !sense, stmt);
+      break;
+   case N_LOGAND:
+   case N_LOGOR:
+      // If the left-hand operand alone decides the outcome in the sense
+      // that we're testing for, both operands branch straight to 'label'.
+      // Otherwise, it decides the opposite, and skips over the right-hand test.
+      if ((e->kind == N_LOGOR) == sense) {
+         emitCondition(e->left, label, sense, stmt);
+         emitCondition(e->right, label, sense, stmt);
+      }
+      else {
+         skip = AllocLabel('L');
+         emitCondition(e->left, skip, !sense, stmt);
+         emitCondition(e->right, label, sense, stmt);
+         EmitLabel(skip);
       }
+      break;
+   case N_EQ:
+   case N_NE:
+   case N_LT:
+   case N_LE:
+   case N_GT:
+   case N_GE:
+      snprintf(comment, sizeof (comment), "%s: compare", stmt);
+      cond = emitCompare(e, comment);
+      
+      if (sense == false)
+         cond = inverse[cond];
+      
+      snprintf(comment, sizeof (comment), "%s: branch", stmt);
+      EmitBranchIf(cond, IsUnsignedNode(e->left) || IsUnsignedNode(e->right), label, comment);
+      break;
+   default:
+      // Compare the value with zero
+      snprintf(comment, sizeof (comment), "%s: test", stmt);
+      emitExpr(e);
+      EmitCompareIntConstant(0, comment);
+      
+      snprintf(comment, sizeof (comment), "%s: branch", stmt);
+      EmitBranchIf(sense ? C_NE : C_EQ, false, label, comment);
+      break;
    }
 }
 
 
-/* EmitCompareIntConstant --- code to compare an integer constant */
+/* EmitTailRecursion --- replace the current function's parameters with the arguments of a call to itself */
 
-void EmitCompareIntConstant(const int compare, const char comment[])
+void EmitTailRecursion(struct ExprNode *e, const struct Symbol *const params[])
 {
-   char cmpArg[16];
+   const struct ExprNode *arg;
+   int n = 0;
    
-   snprintf(cmpArg, sizeof (cmpArg), "#%d", compare);
+   labelTree(e);
+   
+   // Every argument is worked out before any parameter changes, so all
+   // but the last wait on the stack
+   for (arg = e->left; arg != NULL; arg = arg->right, n++) {
+      if (arg->right == NULL)
+         emitExpr(arg->left);
+      else
+         emitPush(arg->left, "<actual parameter>");
+   }
    
-   Emit("cmpd", cmpArg, comment);
+   while (n-- > 0) {
+      if (params[n] != NULL)
+         StoreScalar(params[n]);
+      
+      if (n > 0)
+         Emit("puls", "d", "<actual parameter>");
+   }
 }
 
 
-/* EmitCallFunction --- code to call a function */
+/* EmitExpression --- generate code for an expression, leaving its value in D if it's needed */
 
-void EmitCallFunction(const char name[], const char comment[])
+void EmitExpression(struct ExprNode *e, const bool needValue)
 {
-   char target[30];
+   labelTree(e);
+   
+   switch (e->kind) {
+   case N_PREINC:
+   case N_PREDEC:
+   case N_POSTINC:
+   case N_POSTDEC:
+      emitIncDec(e, needValue);
+      break;
+   default:
+      emitExpr(e);
+      break;
+   }
+}
 
-   snprintf(target, sizeof (target), "%c%s", NAME_PREFIX, name);
 
-   Emit("jsr", target, comment);
-}
+/* EmitCondition --- generate code to branch to 'label' if the truth of an expression is 'sense' */
 
+void EmitCondition(struct ExprNode *e, const int label, const bool sense, const char stmt[])
+{
+   char comment[32];
+   
+   // No expression at all, as in 'for (;;)', is always true
+   if (e == NULL) {
+      if (sense) {
+         snprintf(comment, sizeof (comment), "%s: always", stmt);
+         EmitJump(label, comment);
+      }
+      
+      return;
+   }
+   
+   labelTree(e);
+   emitCondition(e, label, sense, stmt);
+}
@@ -2,25 +2,42 @@
 /* Copyright (c) 2022 John Honniball. All rights reserved              */
 
 #include "symtab.h"
+#include "tree.h"
 
 #define NOLABEL    (-1)
 
+// Conditions for EmitBranchIf()
+enum eCondition {C_EQ, C_NE, C_LT, C_LE, C_GT, C_GE};
+
 struct StringConstant {
    int label;
-   char str[256];
-   char sValue[256];
+   const char *str;     // Source text of the literal, not EOS-terminated
+   int strLength;
+   const char *sValue;  // Decoded bytes, including the EOS
    int sLength;
 };
 
+struct SwitchCase {
+   int match;           // Value of the 'case' label
+   int label;           // Code for that case
+};
+
 void CodeGenInit(void);
+void SetOptimiseFlag(const bool flag);
+bool ReadProfile(const char fname[]);
 bool OpenAssemblerFile(const char fname[]);
 bool CloseAssemblerFile(void);
 int Emit(const char inst[], const char oper[], const char comment[]);
+int MarkCode(void);
+void MoveCode(const int from, const int to);
 int AllocLabel(const char purpose);
 void EmitLabel(const int label);
 void EmitFunctionEntry(const char name[], const int nBytes, const int nRegister);
 void EmitFunctionExit(const int returnLabel, const int nRegister);
+void EmitRegisterParam(const struct Symbol *const sym, const int n);
+void EmitTailRecursion(struct ExprNode *e, const struct Symbol *const params[]);
 void EmitStackCleanup(const int nBytes);
+void EmitStackDepth(const int nBytes, const char comment[]);
 void EmitStaticCharArray(const struct StringConstant *sc, const char name[]);
 void LoadScalar(const struct Symbol *const sym);
 void StoreScalar(const struct Symbol *const sym);
@@ -30,6 +47,11 @@ void EmitExternScalar(const struct Symbol *const sym, const int init, const doub
 void EmitJump(const int label, const char comment[]);
 void EmitBranchIfEqual(const int label, const char comment[]);
 void EmitBranchNotEqual(const int label, const char comment[]);
+void EmitBranchIf(const int cond, const bool isUnsigned, const int label, const char comment[]);
 void EmitIncScalar(const struct Symbol *const sym, const int amount);
 void EmitCompareIntConstant(const int compare, const char comment[]);
+void EmitCompareStacked(const char comment[]);
+void EmitSwitch(struct SwitchCase cases[], const int nCases, const int defaultLabel, const int nextLabel);
 void EmitCallFunction(const char name[], const char comment[]);
+void EmitExpression(struct ExprNode *e, const bool needValue);
+void EmitCondition(struct ExprNode *e, const int label, const bool sense, const char stmt[]);
@@ -8,30 +8,177 @@
 #include <string.h>
 
 #include "lexical.h"
+#include "atom.h"
 
 
 #define EOS   ('\0')
 
-#define MAXNAME  (32)
-#define MAXSYMS  (512)
+#define IS_INT_SUFFIX(ch)   (((ch) == 'L') || ((ch) == 'l') || ((ch) == 'U') || ((ch) == 'u'))
 
-struct Symbol {
-   char name[MAXNAME];
+#define KWMINLEN    (2)     // Length of shortest keyword
+#define KWMAXLEN    (8)     // Length of longest keyword
+#define KWHASHSIZE  (64)    // Must be a power of two
+
+// Perfect hash on keyword length and first and last characters
+#define KWHASH(name, len) \
+   (((len) + KeywordAssoc[(unsigned char)(name)[0]] + KeywordAssoc[(unsigned char)(name)[(len) - 1]]) & (KWHASHSIZE - 1))
+
+struct Keyword {
+   char name[KWMAXLEN + 1];
    enum eToken token;
    bool isType;
-   bool isKeyword;
 };
 
-static int NextSym = 0;
-static struct Symbol SymTab[MAXSYMS];
-static char SrcName[256];
-static FILE *Src = NULL;
-static int Line = 0;
-static int Pos = 0;
+/* Keyword hash tables, generated offline. Each C keyword hashes to its
+ * own slot, so recognising a keyword (or rejecting an identifier) needs
+ * at most one string compare. Unused slots have an empty name.
+ */
+static const unsigned char KeywordAssoc[256] = {
+   ['a'] = 30, ['b'] = 12, ['c'] =  4, ['d'] = 18, ['e'] =  0, ['f'] = 35,
+   ['g'] = 41, ['h'] =  9, ['i'] = 38, ['k'] = 28, ['l'] = 13, ['m'] = 55,
+   ['n'] = 50, ['o'] = 20, ['r'] = 41, ['s'] = 54, ['t'] = 21, ['u'] = 22,
+   ['v'] = 30, ['w'] = 42,
+};
+
+static const struct Keyword KeywordTab[KWHASHSIZE] = {
+   [ 0] = {"static",   TSTATIC,   true},
+   [ 1] = {"goto",     TGOTO,     false},
+   [ 4] = {"else",     TELSE,     false},
+   [ 5] = {"switch",   TSWITCH,   false},
+   [ 6] = {"restrict", TRESTRICT, true},
+   [ 8] = {"case",     TCASE,     false},
+   [11] = {"if",       TIF,       false},
+   [12] = {"continue", TCONTINUE, false},
+   [13] = {"union",    TUNION,    true},
+   [14] = {"signed",   TSIGNED,   true},
+   [15] = {"for",      TFOR,      false},
+   [16] = {"short",    TSHORT,    true},
+   [17] = {"struct",   TSTRUCT,   true},
+   [24] = {"double",   TDOUBLE,   true},
+   [26] = {"register", TREGISTER, true},
+   [30] = {"const",    TCONST,    true},
+   [31] = {"sizeof",   TSIZEOF,   false},
+   [33] = {"return",   TRETURN,   false},
+   [38] = {"volatile", TVOLATILE, true},
+   [40] = {"do",       TDO,       false},
+   [44] = {"inline",   TINLINE,   true},
+   [45] = {"break",    TBREAK,    false},
+   [46] = {"default",  TDEFAULT,  false},
+   [47] = {"while",    TWHILE,    false},
+   [48] = {"unsigned", TUNSIGNED, true},
+   [49] = {"char",     TCHAR,     true},
+   [52] = {"void",     TVOID,     true},
+   [54] = {"auto",     TAUTO,     true},
+   [56] = {"extern",   TEXTERN,   true},
+   [58] = {"long",     TLONG,     true},
+   [59] = {"enum",     TENUM,     true},
+   [61] = {"float",    TFLOAT,    true},
+   [62] = {"int",      TINT,      true},
+   [63] = {"typedef",  TTYPEDEF,  false},
+};
+
+/* Character classes for the lexical analyser's state machine */
+enum eCharClass {
+   CL_IGNORE, CL_NL, CL_EOS, CL_ALPHA, CL_DIGIT, CL_DQUOTE, CL_SQUOTE, CL_INVAL,
+   CL_COLON, CL_SEMI, CL_COMMA, CL_QUEST, CL_OPAREN, CL_CPAREN, CL_OSQBRK, CL_CSQBRK,
+   CL_OBRACE, CL_CBRACE, CL_TILDE,
+   CL_OR, CL_EQ, CL_STAR, CL_BANG, CL_PLUS, CL_MINUS, CL_AND, CL_SLASH, CL_PERCENT,
+   CL_GT, CL_LT, CL_DOT, CL_CARET,
+   NCLASSES
+};
+
+static const unsigned char CharClass[256] = {
+   [EOS] = CL_EOS,   ['\n'] = CL_NL,
+   ['a' ... 'z'] = CL_ALPHA, ['A' ... 'Z'] = CL_ALPHA, ['_'] = CL_ALPHA,
+   ['0' ... '9'] = CL_DIGIT,
+   ['"'] = CL_DQUOTE, ['\''] = CL_SQUOTE,
+   ['#'] = CL_INVAL, ['$'] = CL_INVAL, ['`'] = CL_INVAL, ['@'] = CL_INVAL, ['\\'] = CL_INVAL,
+   [':'] = CL_COLON,  [';'] = CL_SEMI,   [','] = CL_COMMA,  ['?'] = CL_QUEST,
+   ['('] = CL_OPAREN, [')'] = CL_CPAREN, ['['] = CL_OSQBRK, [']'] = CL_CSQBRK,
+   ['{'] = CL_OBRACE, ['}'] = CL_CBRACE, ['~'] = CL_TILDE,
+   ['|'] = CL_OR,     ['='] = CL_EQ,     ['*'] = CL_STAR,   ['!'] = CL_BANG,
+   ['+'] = CL_PLUS,   ['-'] = CL_MINUS,  ['&'] = CL_AND,    ['/'] = CL_SLASH,
+   ['%'] = CL_PERCENT, ['>'] = CL_GT,    ['<'] = CL_LT,     ['.'] = CL_DOT,
+   ['^'] = CL_CARET,
+};
+
+/* States of the lexical analyser's state machine. Identifiers, numbers,
+ * string literals and character constants are consumed by separate
+ * scanning loops, so only punctuators and comments need states here.
+ */
+enum eLexState {
+   S_START, S_OR, S_EQ, S_STAR, S_BANG, S_PLUS, S_MINUS, S_AND, S_SLASH,
+   S_LINECMT, S_BLKCMT, S_BLKSTAR, S_PERCENT, S_GT, S_GTGT, S_LT, S_LTLT,
+   S_DOT, S_DOTDOT, S_CARET,
+   NSTATES
+};
+
+// Transition table actions. Values below NSTATES consume the character and go to that state.
+#define ACCEPT    (0x100)           // Consume the character and return the token
+#define RETURN    (0x200)           // Return the token, leaving the character unread
+#define ACC(t)    (ACCEPT | (t))
+#define RET(t)    (RETURN | (t))
+#define A_NAME    (0x300)           // Scan an identifier or keyword
+#define A_NUMBER  (0x301)           // Scan an integer or floating-point literal
+#define A_STRING  (0x302)           // Scan a string literal
+#define A_CHAR    (0x303)           // Scan a character constant
+#define A_EOS     (0x304)           // End-of-file, if the EOS is our sentinel
+
+static const short Transition[NSTATES][NCLASSES] = {
+   [S_START] = {
+      [CL_IGNORE] = S_START,        [CL_NL] = S_START,            [CL_EOS] = A_EOS,
+      [CL_ALPHA] = A_NAME,          [CL_DIGIT] = A_NUMBER,
+      [CL_DQUOTE] = A_STRING,       [CL_SQUOTE] = A_CHAR,         [CL_INVAL] = ACC(TINVAL),
+      [CL_COLON] = ACC(TCOLON),     [CL_SEMI] = ACC(TSEMI),       [CL_COMMA] = ACC(TCOMMA),
+      [CL_QUEST] = ACC(TQUEST),     [CL_OPAREN] = ACC(TOPAREN),   [CL_CPAREN] = ACC(TCPAREN),
+      [CL_OSQBRK] = ACC(TOSQBRK),   [CL_CSQBRK] = ACC(TCSQBRK),   [CL_OBRACE] = ACC(TOBRACE),
+      [CL_CBRACE] = ACC(TCBRACE),   [CL_TILDE] = ACC(TNOT),
+      [CL_OR] = S_OR,               [CL_EQ] = S_EQ,               [CL_STAR] = S_STAR,
+      [CL_BANG] = S_BANG,           [CL_PLUS] = S_PLUS,           [CL_MINUS] = S_MINUS,
+      [CL_AND] = S_AND,             [CL_SLASH] = S_SLASH,         [CL_PERCENT] = S_PERCENT,
+      [CL_GT] = S_GT,               [CL_LT] = S_LT,               [CL_DOT] = S_DOT,
+      [CL_CARET] = S_CARET,
+   },
+   [S_OR]      = { [0 ... NCLASSES - 1] = RET(TOR),      [CL_OR] = ACC(TLOGOR),  [CL_EQ] = ACC(TORAB) },
+   [S_EQ]      = { [0 ... NCLASSES - 1] = RET(TASSIGN),  [CL_EQ] = ACC(TEQ) },
+   [S_STAR]    = { [0 ... NCLASSES - 1] = RET(TSTAR),    [CL_EQ] = ACC(TTIMESAB) },
+   [S_BANG]    = { [0 ... NCLASSES - 1] = RET(TLOGNOT),  [CL_EQ] = ACC(TNE) },
+   [S_PLUS]    = { [0 ... NCLASSES - 1] = RET(TPLUS),    [CL_PLUS] = ACC(TINC),  [CL_EQ] = ACC(TPLUSAB) },
+   [S_MINUS]   = { [0 ... NCLASSES - 1] = RET(TMINUS),   [CL_MINUS] = ACC(TDEC), [CL_EQ] = ACC(TMINUSAB),
+                   [CL_GT] = ACC(TPOINT) },
+   [S_AND]     = { [0 ... NCLASSES - 1] = RET(TAND),     [CL_AND] = ACC(TLOGAND), [CL_EQ] = ACC(TANDAB) },
+   [S_SLASH]   = { [0 ... NCLASSES - 1] = RET(TDIV),     [CL_EQ] = ACC(TDIVAB),
+                   [CL_SLASH] = S_LINECMT,               [CL_STAR] = S_BLKCMT },
+   [S_LINECMT] = { [0 ... NCLASSES - 1] = S_LINECMT,     [CL_NL] = S_START,      [CL_EOS] = A_EOS },
+   [S_BLKCMT]  = { [0 ... NCLASSES - 1] = S_BLKCMT,      [CL_STAR] = S_BLKSTAR,  [CL_EOS] = A_EOS },
+   [S_BLKSTAR] = { [0 ... NCLASSES - 1] = S_BLKCMT,      [CL_STAR] = S_BLKSTAR,  [CL_EOS] = A_EOS,
+                   [CL_SLASH] = S_START },
+   [S_PERCENT] = { [0 ... NCLASSES - 1] = RET(TMOD),     [CL_EQ] = ACC(TMODAB) },
+   [S_GT]      = { [0 ... NCLASSES - 1] = RET(TGT),      [CL_EQ] = ACC(TGE),     [CL_GT] = S_GTGT },
+   [S_GTGT]    = { [0 ... NCLASSES - 1] = RET(TRSHT),    [CL_EQ] = ACC(TRSHTAB) },
+   [S_LT]      = { [0 ... NCLASSES - 1] = RET(TLT),      [CL_EQ] = ACC(TLE),     [CL_LT] = S_LTLT },
+   [S_LTLT]    = { [0 ... NCLASSES - 1] = RET(TLSHT),    [CL_EQ] = ACC(TLSHTAB) },
+   [S_DOT]     = { [0 ... NCLASSES - 1] = RET(TDOT),     [CL_DOT] = S_DOTDOT },
+   [S_DOTDOT]  = { [0 ... NCLASSES - 1] = RET(TINVAL),   [CL_DOT] = ACC(TELLIPSIS) },
+   [S_CARET]   = { [0 ... NCLASSES - 1] = RET(TEXOR),    [CL_EQ] = ACC(TEXORAB) },
+};
+
+// Values of simple escape sequences in string literals and character constants.
+// Zero means that the escaped character stands for itself.
+static const char EscapeChar[256] = {
+   ['a'] = '\a', ['b'] = '\b', ['f'] = '\f', ['n'] = '\n',
+   ['r'] = '\r', ['t'] = '\t', ['v'] = '\v',
+};
+
 static bool TraceTokens = false;
 static bool TraceSyntax = false;
 
-static int GetOneToken(struct Token *tok);
+static int GetOneToken(struct LexerContext *lex, struct Token *tok);
+static const unsigned char *ScanName(struct Token *tok, const unsigned char *p);
+static const unsigned char *ScanNumber(struct Token *tok, const unsigned char *p);
+static const unsigned char *ScanString(struct LexerContext *lex, struct Token *tok, const unsigned char *p);
+static const unsigned char *ScanChar(struct LexerContext *lex, struct Token *tok, const unsigned char *p);
+static int HexDigit(const int ch);
 
 
 /* LexicalInit --- initialise this module */
@@ -39,42 +186,6 @@ static int GetOneToken(struct Token *tok);
 void LexicalInit(void)
 {
    TraceTokens = false;
-   
-   installkw("break",    TBREAK,    false);
-   installkw("case",     TCASE,     false);
-   installkw("continue", TCONTINUE, false);
-   installkw("do",       TDO,       false);
-   installkw("default",  TDEFAULT,  false);
-   installkw("else",     TELSE,     false);
-   installkw("for",      TFOR,      false);
-   installkw("goto",     TGOTO,     false);
-   installkw("if",       TIF,       false);
-   installkw("typedef",  TTYPEDEF,  false);
-   installkw("return",   TRETURN,   false);
-   installkw("sizeof",   TSIZEOF,   false);
-   installkw("switch",   TSWITCH,   false);
-   installkw("while",    TWHILE,    false);
-   
-   installkw("int",      TINT,      true);
-   installkw("float",    TFLOAT,    true);
-   installkw("double",   TDOUBLE,   true);
-   installkw("char",     TCHAR,     true);
-   installkw("void",     TVOID,     true);
-   installkw("short",    TSHORT,    true);
-   installkw("long",     TLONG,     true);
-   installkw("auto",     TAUTO,     true);
-   installkw("static",   TSTATIC,   true);
-   installkw("inline",   TINLINE,   true);
-   installkw("restrict", TRESTRICT, true);
-   installkw("const",    TCONST,    true);
-   installkw("volatile", TVOLATILE, true);
-   installkw("signed",   TSIGNED,   true);
-   installkw("unsigned", TUNSIGNED, true);
-   installkw("register", TREGISTER, true);
-   installkw("extern",   TEXTERN,   true);
-   installkw("struct",   TSTRUCT,   true);
-   installkw("union",    TUNION,    true);
-   installkw("enum",     TENUM,     true);
 }
 
 
@@ -110,103 +221,231 @@ void PrintSyntax(const char *fmt, ...)
 
 /* Error --- print a compiler error message */
 
-void Error(const char *fmt, ...)
+void Error(const struct LexerContext *lex, const char *fmt, ...)
 {
    va_list ap;
 
-   fprintf(stderr, "%s: %d:%d: ", SrcName, Line, Pos);
+   fprintf(lex->errors, "%s: %d:%d: ", lex->srcName, lex->line, (int)(lex->srcPtr - lex->lineStart) + 1);
    va_start(ap, fmt);
-   vfprintf(stderr, fmt, ap);
+   vfprintf(lex->errors, fmt, ap);
    va_end(ap);
-   fputs("\n", stderr);
+   fputs("\n", lex->errors);
 }
 
 
-/* installkw --- install a C keyword in the symbol table */
+/* OpenSourceFile --- read the entire C source code file into memory */
 
-void installkw(const char keyword[], enum eToken token, bool isType)
-{
-   struct Symbol *sym = &SymTab[NextSym++];
-   
-   strcpy(sym->name, keyword);
-   sym->token     = token;
-   sym->isType    = isType;
-   sym->isKeyword = true;
-}
-
-
-/* OpenSourceFile --- open the C source code file */
-
-bool OpenSourceFile(const char fname[])
+bool OpenSourceFile(struct LexerContext *lex, const char fname[], FILE *errors)
 {
    FILE *fp;
+   long size;
 
+   lex->errors = errors;
+   
    if ((fp = fopen(fname, "r")) == NULL) {
-      fprintf(stderr, "%s: can't open\n", fname);
+      fprintf(errors, "%s: can't open\n", fname);
       return (false);
    }
    
-   strncpy(SrcName, fname, sizeof (SrcName));
-   Src = fp;
-   Line = 1;
-   Pos = 1;
+   if ((fseek(fp, 0L, SEEK_END) != 0) || ((size = ftell(fp)) < 0L)) {
+      fprintf(errors, "%s: can't determine file size\n", fname);
+      fclose(fp);
+      return (false);
+   }
+   
+   rewind(fp);
+   
+   // One extra byte for the EOS sentinel at the end of the buffer
+   if ((lex->srcBuf = malloc(size + 1)) == NULL) {
+      fprintf(errors, "%s: can't allocate %ld bytes\n", fname, size + 1);
+      fclose(fp);
+      return (false);
+   }
+   
+   // Decoded string literals are never longer than their source text
+   if ((lex->strArena = malloc(size + 1)) == NULL) {
+      fprintf(errors, "%s: can't allocate %ld bytes\n", fname, size + 1);
+      free(lex->srcBuf);
+      lex->srcBuf = NULL;
+      fclose(fp);
+      return (false);
+   }
+   
+   size = fread(lex->srcBuf, 1, size, fp);
+   fclose(fp);
+   
+   lex->srcBuf[size] = EOS;
+   
+   strncpy(lex->srcName, fname, sizeof (lex->srcName));
+   lex->srcPtr = lex->srcBuf;
+   lex->srcEnd = lex->srcBuf + size;
+   lex->strNext = 0;
+   lex->lineStart = lex->srcBuf;
+   lex->line = 1;
    
    return (true);
 }
 
 
-/* CloseSourceFile --- close the source code file */
+/* CloseSourceFile --- release the source code and string literal buffers */
 
-bool CloseSourceFile(void)
+bool CloseSourceFile(struct LexerContext *lex)
 {
-   if (Src != NULL)
-      fclose(Src);
+   free(lex->srcBuf);
+   free(lex->strArena);
+   
+   lex->strArena = NULL;
+   lex->strNext = 0;
+   lex->srcBuf = NULL;
+   lex->srcPtr = NULL;
+   lex->srcEnd = NULL;
    
    return (true);
 }
 
 
-/* lookupKeyword --- look up a name in the symbol table to see if it's a keyword */
+/* lookupKeyword --- look up a name in the keyword hash table to see if it's a keyword */
 
-enum eToken lookupKeyword(const char name[])
+enum eToken lookupKeyword(const char name[], const int len)
 {
-   int i;
+   const struct Keyword *kw;
+   
+   if ((len < KWMINLEN) || (len > KWMAXLEN))
+      return (TNULL);
    
-   for (i = 0; (i < NextSym) && SymTab[i].isKeyword; i++)
-     if (strcmp(name, SymTab[i].name) == 0)
-        return (SymTab[i].token);
+   kw = &KeywordTab[KWHASH(name, len)];
+   
+   if ((kw->name[0] == name[0]) && (kw->name[len] == EOS) && (memcmp(name, kw->name, len) == 0))
+      return (kw->token);
         
    return (TNULL);
 }
 
 
+/* TokenText --- return a pointer to the token's text in the source buffer (not EOS-terminated) */
+
+const char *TokenText(const struct LexerContext *lex, const struct Token *tok)
+{
+   return ((const char *)lex->srcBuf + tok->offset);
+}
+
+
+/* TokenLength --- return the length of the token's source text */
+
+int TokenLength(const struct Token *tok)
+{
+   return (tok->length);
+}
+
+
+/* CopyTokenText --- copy the token's source text into an EOS-terminated buffer */
+
+char *CopyTokenText(const struct LexerContext *lex, const struct Token *tok, char buf[], const int size)
+{
+   int len = tok->length;
+   
+   if (len > (size - 1)) {
+      len = size - 1;
+   }
+   
+   memcpy(buf, lex->srcBuf + tok->offset, len);
+   buf[len] = EOS;
+   
+   return (buf);
+}
+
+
+/* TokenAtom --- return the interned name of an identifier */
+
+int TokenAtom(const struct Token *tok)
+{
+   if (tok->token == TID) {
+      return (tok->value.atom);
+   }
+   
+   return (NOATOM);
+}
+
+
+/* TokenIntValue --- return the value of an integer or character literal */
+
+int TokenIntValue(const struct Token *tok)
+{
+   if (tok->token == TINTLIT) {
+      return (tok->value.i);
+   }
+   
+   return (0);
+}
+
+
+/* TokenFloatValue --- return the value of a floating-point literal */
+
+double TokenFloatValue(const struct Token *tok)
+{
+   if (tok->token == TFLOATLIT) {
+      return (tok->value.f);
+   }
+   
+   return (0.0);
+}
+
+
+/* TokenStringValue --- return the decoded bytes of a string literal, including the EOS */
+
+const char *TokenStringValue(const struct LexerContext *lex, const struct Token *tok)
+{
+   if (tok->token == TSTRLIT) {
+      return (lex->strArena + tok->value.s.offset);
+   }
+   
+   return ("");
+}
+
+
+/* TokenStringLength --- return the number of decoded bytes in a string literal */
+
+int TokenStringLength(const struct Token *tok)
+{
+   if (tok->token == TSTRLIT) {
+      return (tok->value.s.length);
+   }
+   
+   return (0);
+}
+
+
 
 /* PrintToken --- print a token for debugging or tracing */
 
-void PrintToken(const struct Token *tok)
+void PrintToken(const struct LexerContext *lex, const struct Token *tok)
 {
+   const int len = TokenLength(tok);
+   const char *const text = TokenText(lex, tok);
+   const char *sValue;
    int i;
    
    switch (tok->token) {
    case TNULL:
-      printf("NULL:     '%c'\n", tok->str[0]);
+      printf("NULL:     '%.*s'\n", len, text);
       break;
    case TINVAL:
-      printf("INVALID:  '%s'\n", tok->str);
+      printf("INVALID:  '%.*s'\n", len, text);
       break;
    case TID:
-      printf("NAME:     '%s' %s\n", tok->str, tokenAsStr(tok));
+      printf("NAME:     '%.*s' %s\n", len, text, tokenAsStr(tok));
       break;
    case TINTLIT:
-      printf("NUMBER:   '%s' %s %d\n", tok->str, tokenAsStr(tok), tok->iValue);
+      printf("NUMBER:   '%.*s' %s %d\n", len, text, tokenAsStr(tok), TokenIntValue(tok));
       break;
    case TFLOATLIT:
-      printf("NUMBER:   '%s' %s %g\n", tok->str, tokenAsStr(tok), tok->fValue);
+      printf("NUMBER:   '%.*s' %s %g\n", len, text, tokenAsStr(tok), TokenFloatValue(tok));
       break;
    case TSTRLIT:
-      printf("STRING:   '%s' %s", tok->str, tokenAsStr(tok));
-      for (i = 0; i < tok->sLength; i++) {
-         printf(" %02x", tok->sValue[i] & 0xff);
+      printf("STRING:   '%.*s' %s", len, text, tokenAsStr(tok));
+      sValue = TokenStringValue(lex, tok);
+      for (i = 0; i < TokenStringLength(tok); i++) {
+         printf(" %02x", sValue[i] & 0xff);
       }
       printf("\n");
       break;
@@ -244,7 +483,7 @@ void PrintToken(const struct Token *tok)
    case TENUM:
    case TSTRUCT:
    case TUNION:
-      printf("KEYWORD:  '%s' %s\n", tok->str, tokenAsStr(tok)); 
+      printf("KEYWORD:  '%.*s' %s\n", len, text, tokenAsStr(tok)); 
       break;
    case TPLUS:
    case TMINUS:
@@ -282,10 +521,10 @@ void PrintToken(const struct Token *tok)
    case TPOINT:
    case TDOT:
    case TQUEST:
-      printf("OPERATOR: '%s' %s\n", tok->str, tokenAsStr(tok));
+      printf("OPERATOR: '%.*s' %s\n", len, text, tokenAsStr(tok));
       break;
    default:
-      printf("TOKEN:    '%s' %s\n", tok->str, tokenAsStr(tok));
+      printf("TOKEN:    '%.*s' %s\n", len, text, tokenAsStr(tok));
       break;
    }
 }
@@ -293,12 +532,14 @@ void PrintToken(const struct Token *tok)
 
 /* GetToken --- get the a token and print trace if enabled */
 
-int GetToken(struct Token *tok)
+int GetToken(struct LexerContext *lex, struct Token *tok)
 {
-   GetOneToken(tok);
+   GetOneToken(lex, tok);
+   
+   tok->length = (lex->srcPtr - lex->srcBuf) - tok->offset;
 
    if (TraceTokens) {
-      PrintToken(tok);
+      PrintToken(lex, tok);
    }
    
    return (tok->token);
@@ -307,940 +548,314 @@ int GetToken(struct Token *tok)
 
 /* GetOneToken --- get the next lexical token from the source file */
 
-static int GetOneToken(struct Token *tok)
+static int GetOneToken(struct LexerContext *lex, struct Token *tok)
 {
-   int ch;
-   int i;
-   int j;
-   static int state = 0;
+   const unsigned char *p = lex->srcPtr;
+   const unsigned char *start = p;
+   int state = S_START;
+   int action;
+   int cl;
 
    tok->token = TNULL;
-   tok->sValue[0] = EOS;
-   tok->sLength = 0;
-   tok->iValue = 0;
-   tok->fValue = 0.0;
-   tok->str[0] = EOS;
    
    while (1) {
-      if ((ch = getc(Src)) == EOF) {
-         tok->token = TEOF;
-         return (tok->token);
+      if (state == S_START) {    // Token starts here unless it's white space or a comment
+         start = p;
+         tok->line = lex->line;
+         tok->column = (p - lex->lineStart) + 1;
       }
       
-      if (ch == '\n') {
-         Line++;
-         Pos = 1;
-      }
-      else {
-         Pos++;
+      cl = CharClass[*p];
+      action = Transition[state][cl];
+      
+      if (action < NSTATES) {
+         if (cl == CL_NL) {
+            lex->line++;
+            lex->lineStart = p + 1;
+         }
+         
+         p++;
+         state = action;
       }
-
-      switch (state) {
-      case 0:
-         switch (ch) {
-         case ':':
-            tok->token = TCOLON;
-            tok->str[0] = ch;
-            tok->str[1] = EOS;
-            return (tok->token);
-         case ';':
-            tok->token = TSEMI;
-            tok->str[0] = ch;
-            tok->str[1] = EOS;
-            return (tok->token);
-         case ',':
-            tok->token = TCOMMA;
-            tok->str[0] = ch;
-            tok->str[1] = EOS;
-            return (tok->token);
-         case '(':
-            tok->token = TOPAREN;
-            tok->str[0] = ch;
-            tok->str[1] = EOS;
-            return (tok->token);
-         case ')':
-            tok->token = TCPAREN;
-            tok->str[0] = ch;
-            tok->str[1] = EOS;
-            return (tok->token);
-         case '[':
-            tok->token = TOSQBRK;
-            tok->str[0] = ch;
-            tok->str[1] = EOS;
-            return (tok->token);
-         case ']':
-            tok->token = TCSQBRK;
-            tok->str[0] = ch;
-            tok->str[1] = EOS;
-            return (tok->token);
-         case '{':
-            tok->token = TOBRACE;
-            tok->str[0] = ch;
-            tok->str[1] = EOS;
-            return (tok->token);
-         case '}':
-            tok->token = TCBRACE;
-            tok->str[0] = ch;
-            tok->str[1] = EOS;
-            return (tok->token);
-         case '?':
-            tok->token = TQUEST;
-            tok->str[0] = ch;
-            tok->str[1] = EOS;
-            return (tok->token);
-         case '~':
-            tok->token = TNOT;
-            tok->str[0] = ch;
-            tok->str[1] = EOS;
-            return (tok->token);
-         case '#':
-         case '$':
-         case '`':
-         case '@':
-         case '\\':
-            tok->token = TINVAL;
-            tok->str[0] = ch;
-            tok->str[1] = EOS;
-            return (tok->token);
-         case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g': case 'h': case 'i': case 'j':
-         case 'k': case 'l': case 'm': case 'n': case 'o': case 'p': case 'q': case 'r': case 's': case 't':
-         case 'u': case 'v': case 'w': case 'x': case 'y': case 'z':
-         case 'A': case 'B': case 'C': case 'D': case 'E': case 'F': case 'G': case 'H': case 'I': case 'J':
-         case 'K': case 'L': case 'M': case 'N': case 'O': case 'P': case 'Q': case 'R': case 'S': case 'T':
-         case 'U': case 'V': case 'W': case 'X': case 'Y': case 'Z':
-         case '_':
-            tok->str[0] = ch;
-            i = 1;
-            state = 1;
-            break;
-         case '|':
-            tok->str[0] = ch;
-            i = 1;
-            state = 2;
-            break;
-         case '=':
-            tok->str[0] = ch;
-            i = 1;
-            state = 3;
-            break;
-         case '.':
-            tok->str[0] = ch;
-            i = 1;
-            state = 33;
-            break;
-         case '0':
-            tok->str[0] = ch;
-            i = 1;
-            state = 24;
-            break;
-         case '1': case '2': case '3': case '4':
-         case '5': case '6': case '7': case '8': case '9':
-            tok->str[0] = ch;
-            i = 1;
-            state = 4;
-            break;
-         case '*':
-            tok->str[0] = ch;
-            i = 1;
-            state = 5;
-            break;
-         case '!':
-            tok->str[0] = ch;
-            i = 1;
-            state = 6;
-            break;
-         case '+':
-            tok->str[0] = ch;
-            i = 1;
-            state = 7;
-            break;
-         case '-':
-            tok->str[0] = ch;
-            i = 1;
-            state = 8;
-            break;
-         case '&':
-            tok->str[0] = ch;
-            i = 1;
-            state = 9;
-            break;
-         case '/':
-            tok->str[0] = ch;
-            i = 1;
-            state = 10;
-            break;
-         case '"':
-            tok->str[0] = ch;
-            i = 1;
-            j = 0;
-            state = 12;
-            break;
-         case '%':
-            tok->str[0] = ch;
-            i = 1;
-            state = 14;
-            break;
-         case '>':
-            tok->str[0] = ch;
-            i = 1;
-            state = 15;
-            break;
-         case '<':
-            tok->str[0] = ch;
-            i = 1;
-            state = 17;
-            break;
-         case '\'':
-            tok->str[0] = ch;
-            i = 1;
-            state = 21;
-            break;
-         }
-         break;
-      case 1:        // name
-         if (((ch >= 'a') && (ch <= 'z')) ||
-             ((ch >= 'A') && (ch <= 'Z')) ||
-             ((ch >= '0') && (ch <= '9')) ||
-             (ch == '_')) {
-            tok->str[i++] = ch;
-         }
-         else {
-            enum eToken token;
-            
-            state = 0;
-            ungetc(ch, Src);
-            tok->str[i] = EOS;
-            if ((token = lookupKeyword(tok->str)) == TNULL) {
-               tok->token = TID;
-            }
-            else {
-               tok->token = token;
-            }
-            return (tok->token);
-         }
-         break;
-      case 2:        // seen '|'
-         if (ch == '|') {
-            state = 0;
-            tok->str[i++] = ch;
-            tok->str[i] = EOS;
-            tok->token = TLOGOR;
-            return (tok->token);
-         }
-         else if (ch == '=') {
-            state = 0;
-            tok->str[i++] = ch;
-            tok->str[i] = EOS;
-            tok->token = TORAB;
-            return (tok->token);
-         }
-         else {
-            state = 0;
-            ungetc(ch, Src);
-            tok->str[i] = EOS;
-            tok->token = TOR;
-            return (tok->token);
-         }
-         break;
-      case 3:        // seen '='
-         if (ch == '=') {
-            state = 0;
-            tok->str[i++] = ch;
-            tok->str[i] = EOS;
-            tok->token = TEQ;
-            return (tok->token);
-         }
-         else {
-            state = 0;
-            ungetc(ch, Src);
-            tok->str[i] = EOS;
-            tok->token = TASSIGN;
-            return (tok->token);
-         }
-         break;
-      case 4:        // Seen '1' to '9' (decimal number)
-         if ((ch >= '0') && (ch <= '9')) {
-            tok->str[i++] = ch;
-         }
-         else if (ch == '.') {
-            tok->str[i++] = ch;
-            state = 27;
-         }
-         else if ((ch == 'e') || (ch == 'E')) {
-            tok->str[i++] = ch;
-            state = 28;
-         }
-         else if ((ch == 'L') || (ch == 'l')) {
-            tok->str[i++] = ch;
-         }
-         else if ((ch == 'U') || (ch == 'u')) {
-            tok->str[i++] = ch;
-         }
-         else {
-            state = 0;
-            ungetc(ch, Src);
-            tok->str[i] = EOS;
-            tok->token = TINTLIT;
-            tok->iValue = atoi(tok->str);
-            return (tok->token);
-         }
-         break;
-      case 5:        // seen '*'
-         if (ch == '=') {
-            state = 0;
-            tok->str[i++] = ch;
-            tok->str[i] = EOS;
-            tok->token = TTIMESAB;
-            return (tok->token);
-         }
-         else {
-            state = 0;
-            ungetc(ch, Src);
-            tok->str[i] = EOS;
-            tok->token = TSTAR;
-            return (tok->token);
-         }
-         break;
-      case 6:        // seen '!'
-         if (ch == '=') {
-            state = 0;
-            tok->str[i++] = ch;
-            tok->str[i] = EOS;
-            tok->token = TNE;
-            return (tok->token);
-         }
-         else {
-            state = 0;
-            ungetc(ch, Src);
-            tok->str[i] = EOS;
-            tok->token = TLOGNOT;
-            return (tok->token);
-         }
-         break;
-      case 7:        // seen '+'
-         if (ch == '=') {
-            state = 0;
-            tok->token = TPLUSAB;
-            tok->str[i++] = ch;
-            tok->str[i] = EOS;
-            return (tok->token);
-         }
-         else if (ch == '+') {
-            state = 0;
-            tok->token = TINC;
-            tok->str[i++] = ch;
-            tok->str[i] = EOS;
-            return (tok->token);
-         }
-         else {
-            state = 0;
-            ungetc(ch, Src);
-            tok->token = TPLUS;
-            tok->str[i] = EOS;
-            return (tok->token);
-         }
-         break;
-      case 8:        // seen '-'
-         if (ch == '=') {
-            state = 0;
-            tok->token = TMINUSAB;
-            tok->str[i++] = ch;
-            tok->str[i] = EOS;
-            return (tok->token);
-         }
-         else if (ch == '-') {
-            state = 0;
-            tok->token = TDEC;
-            tok->str[i++] = ch;
-            tok->str[i] = EOS;
-            return (tok->token);
-         }
-         else if (ch == '>') {
-            state = 0;
-            tok->token = TPOINT;
-            tok->str[i++] = ch;
-            tok->str[i] = EOS;
-            return (tok->token);
-         }
-         else {
-            state = 0;
-            tok->token = TMINUS;
-            ungetc(ch, Src);
-            tok->str[i] = EOS;
-            return (tok->token);
-         }
-         break;
-      case 9:        // seen '&'
-         if (ch == '=') {
-            state = 0;
-            tok->token = TANDAB;
-            tok->str[i++] = ch;
-            tok->str[i] = EOS;
-            return (tok->token);
-         }
-         else if (ch == '&') {
-            state = 0;
-            tok->token = TLOGAND;
-            tok->str[i++] = ch;
-            tok->str[i] = EOS;
-            return (tok->token);
-         }
-         else {
-            state = 0;
-            ungetc(ch, Src);
-            tok->token = TAND;
-            tok->str[i] = EOS;
-            return (tok->token);
-         }
-      case 10:       // seen '/'
-         if (ch == '=') {
-            state = 0;
-            tok->token = TDIVAB;
-            tok->str[i++] = ch;
-            tok->str[i] = EOS;
-            return (tok->token);
-         }
-         else if (ch == '/') {
-            state = 11;
-         }
-         else if (ch == '*') {
-            state = 19;
-         }
-         else {
-            state = 0;
-            ungetc(ch, Src);
-            tok->str[i] = EOS;
-            tok->token = TDIV;
-            return (tok->token);
-         }
-         break;
-      case 11:       // seen '//', comment to end-of-line
-         if (ch == '\n') {
-            state = 0;
-         }
-         break;
-      case 12:       // seen '"', string literal
-         if (ch == '\\') {
-            tok->str[i++] = ch;
-            state = 13;
-         }
-         else if (ch == '"') {
-            state = 0;
-            tok->str[i++] = ch;
-            tok->str[i] = EOS;
-            tok->sValue[j] = EOS;
-            tok->sLength = j + 1; // Include EOS in the length
-            tok->token = TSTRLIT;
-            return (tok->token);
-         }
-         else {
-            tok->str[i++] = ch;
-            tok->sValue[j++] = ch;
-         }
-         break;
-      case 13:       // seen '\' within string literal
-         switch (ch) {
-         case 'a':      // audible alert
-            tok->str[i++] = ch;
-            tok->sValue[j++] = '\a';
-            state = 12;
-            break;
-         case 'b':      // backspace
-            tok->str[i++] = ch;
-            tok->sValue[j++] = '\b';
-            state = 12;
-            break;
-         case 'f':      // form feed
-            tok->str[i++] = ch;
-            tok->sValue[j++] = '\f';
-            state = 12;
-            break;
-         case 'n':      // newline
-            tok->str[i++] = ch;
-            tok->sValue[j++] = '\n';
-            state = 12;
-            break;
-         case 'r':      // return
-            tok->str[i++] = ch;
-            tok->sValue[j++] = '\r';
-            state = 12;
-            break;
-         case 't':      // tab
-            tok->str[i++] = ch;
-            tok->sValue[j++] = '\t';
-            state = 12;
-            break;
-         case 'v':      // vertical tab
-            tok->str[i++] = ch;
-            tok->sValue[j++] = '\v';
-            state = 12;
-            break;
-         case '\\':     // backslash
-            tok->str[i++] = ch;
-            tok->sValue[j++] = '\\';
-            state = 12;
-            break;
-         case '"':      // double quote
-            tok->str[i++] = ch;
-            tok->sValue[j++] = ch;
-            state = 12;
-            break;
-         case '0':      // octal escape
-         case '1': case '2': case '3': case '4':
-         case '5': case '6': case '7':
-            tok->str[i++] = ch;
-            tok->sValue[j] = ch - '0';
-            state = 31;
-            break;
-         case 'x':      // hex escape
-            tok->str[i++] = ch;
-            tok->sValue[j] = 0;
-            state = 32;
-            break;
-         default:
-            tok->str[i++] = ch;
-            tok->sValue[j++] = ch;
-            state = 12;
-            break;
-         }
-         break;
-      case 14:       // seen '%'
-         if (ch == '=') {
-            state = 0;
-            tok->token = TMODAB;
-            tok->str[i++] = ch;
-            tok->str[i] = EOS;
-            return (tok->token);
-         }
-         else {
-            state = 0;
-            ungetc(ch, Src);
-            tok->token = TMOD;
-            tok->str[i] = EOS;
-            return (tok->token);
-         }
-         break;
-      case 15:       // seen '>'
-         if (ch == '=') {
-            state = 0;
-            tok->str[i++] = ch;
-            tok->str[i] = EOS;
-            tok->token = TGE;
-            return (tok->token);
-         }
-         else if (ch == '>') {
-            state = 16;
-            tok->str[i++] = ch;
-            tok->str[i] = EOS;
-         }
-         else {
-            state = 0;
-            ungetc(ch, Src);
-            tok->str[i] = EOS;
-            tok->token = TGT;
-            return (tok->token);
-         }
-         break;
-      case 16:       // seen '>>'
-         if (ch == '=') {
-            state = 0;
-            tok->str[i++] = ch;
-            tok->str[i] = EOS;
-            tok->token = TRSHTAB;
-            return (tok->token);
-         }
-         else {
-            state = 0;
-            ungetc(ch, Src);
-            tok->str[i] = EOS;
-            tok->token = TRSHT;
-            return (tok->token);
-         }
-         break;
-      case 17:       // seen '<'
-         if (ch == '=') {
-            state = 0;
-            tok->str[i++] = ch;
-            tok->str[i] = EOS;
-            tok->token = TLE;
-            return (tok->token);
-         }
-         else if (ch == '<') {
-            state = 18;
-            tok->str[i++] = ch;
-            tok->str[i] = EOS;
-         }
-         else {
-            state = 0;
-            ungetc(ch, Src);
-            tok->str[i] = EOS;
-            tok->token = TLT;
-            return (tok->token);
-         }
-         break;
-      case 18:       // seen '<<'
-         if (ch == '=') {
-            state = 0;
-            tok->str[i++] = ch;
-            tok->str[i] = EOS;
-            tok->token = TLSHTAB;
-            return (tok->token);
-         }
-         else {
-            state = 0;
-            ungetc(ch, Src);
-            tok->str[i] = EOS;
-            tok->token = TLSHT;
-            return (tok->token);
-         }
-         break;
-      case 19:
-         if (ch == '*') {
-            state = 20;
-         }
+      else if (action < RETURN) {
+         p++;
+         tok->token = action - ACCEPT;
          break;
-      case 20:
-         if (ch == '/') {  // End of traditional C comment
-            state = 0;
-         }
-         else {
-            state = 19;
-         }
-         break;
-      case 21:       // seen single quote: character literal
-         if (ch == '\\') {
-            tok->str[i++] = ch;
-            tok->str[i] = EOS;
-            state = 22;
-         }
-         else {
-            tok->str[i++] = ch;
-            tok->str[i] = EOS;
-            tok->iValue = ch;
-            state = 23;
-         }
-         break;
-      case 22:       // seen backslash: escaped character constant
-         if (ch == 'a') {        // audible alert
-            tok->str[i++] = ch;
-            tok->str[i] = EOS;
-            tok->iValue = '\a';
-            state = 23;
-         }
-         else if (ch == 'b') {   // backspace
-            tok->str[i++] = ch;
-            tok->str[i] = EOS;
-            tok->iValue = '\b';
-            state = 23;
-         }
-         else if (ch == 'f') {   // form feed
-            tok->str[i++] = ch;
-            tok->str[i] = EOS;
-            tok->iValue = '\f';
-            state = 23;
-         }
-         else if (ch == 'n') {   // newline
-            tok->str[i++] = ch;
-            tok->str[i] = EOS;
-            tok->iValue = '\n';
-            state = 23;
-         }
-         else if (ch == 'r') {   // return
-            tok->str[i++] = ch;
-            tok->str[i] = EOS;
-            tok->iValue = '\r';
-            state = 23;
-         }
-         else if (ch == 't') {   // tab
-            tok->str[i++] = ch;
-            tok->str[i] = EOS;
-            tok->iValue = '\t';
-            state = 23;
-         }
-         else if (ch == 'v') {   // vertical tab
-            tok->str[i++] = ch;
-            tok->str[i] = EOS;
-            tok->iValue = '\v';
-            state = 23;
-         }
-         else if (ch == '\'') {  // single quote
-            tok->str[i++] = ch;
-            tok->str[i] = EOS;
-            tok->iValue = '\'';
-            state = 23;
-         }
-         else if (ch == '\\') {  // backslash
-            tok->str[i++] = ch;
-            tok->str[i] = EOS;
-            tok->iValue = '\\';
-            state = 23;
-         }
-         else if (ch == 'x') {   // hex number
-            tok->str[i++] = ch;
-            tok->str[i] = EOS;
-            tok->iValue = 0;
-            state = 29;
-         }
-         else if ((ch >= '0') && (ch <= '7')) {  // octal number
-            tok->str[i++] = ch;
-            tok->str[i] = EOS;
-            tok->iValue = ch - '0';
-            state = 30;
-         }
-         else {                  // unrecognised escape
-            tok->str[i++] = ch;
-            tok->str[i] = EOS;
-            tok->iValue = ch;
-            state = 23;
-         }
-         break;
-      case 23:       // looking for closing single quote
-         if (ch == '\'') {
-            state = 0;
-            tok->str[i++] = ch;
-            tok->str[i] = EOS;
-            tok->token = TINTLIT;
-            return (tok->token);
-         }
-         else {
-            state = 23;
-         }
-         break;
-      case 24:       // seen '0' (octal or hex number, or float number)
-         if ((ch == 'x') || (ch == 'X')) {
-            tok->str[i++] = ch;
-            state = 26;
-         }
-         else if ((ch >= '0') && (ch <= '7')) {
-            tok->str[i++] = ch;
-            state = 25;
-         }
-         else if (ch == '.') {
-            tok->str[i++] = ch;
-            state = 27;
-         }
-         else if ((ch == 'L') || (ch == 'l')) {
-            tok->str[i++] = ch;
-         }
-         else if ((ch == 'U') || (ch == 'u')) {
-            tok->str[i++] = ch;
-         }
-         else {
-            state = 0;
-            ungetc(ch, Src);
-            tok->str[i] = EOS;
-            tok->token = TINTLIT;
-            tok->iValue = strtoul(tok->str, NULL, 8);
-            return (tok->token);
-         }
-         break;
-      case 25:       // seen '0' followed by '0' to '7' (octal number)
-         if ((ch >= '0') && (ch <= '7')) {
-            tok->str[i++] = ch;
-         }
-         else if (ch == '.') {
-            tok->str[i++] = ch;
-            state = 27;
-         }
-         else if ((ch == 'L') || (ch == 'l')) {
-            tok->str[i++] = ch;
-         }
-         else if ((ch == 'U') || (ch == 'u')) {
-            tok->str[i++] = ch;
-         }
-         else {
-            state = 0;
-            ungetc(ch, Src);
-            tok->str[i] = EOS;
-            tok->token = TINTLIT;
-            tok->iValue = strtoul(tok->str, NULL, 8);
-            return (tok->token);
-         }
-         break;
-      case 26:       // seen '0x' (hex number)
-         if (((ch >= '0') && (ch <= '9')) ||
-             ((ch >= 'a') && (ch <= 'f')) ||
-             ((ch >= 'A') && (ch <= 'F'))) {
-            tok->str[i++] = ch;
-         }
-         else if ((ch == 'L') || (ch == 'l')) {
-            tok->str[i++] = ch;
-         }
-         else if ((ch == 'U') || (ch == 'u')) {
-            tok->str[i++] = ch;
-         }
-         else {
-            state = 0;
-            ungetc(ch, Src);
-            tok->str[i] = EOS;
-            tok->token = TINTLIT;
-            tok->iValue = strtoul(&tok->str[2], NULL, 16);
-            return (tok->token);
-         }
-         break;
-      case 27:       // seen '.' after decimal digits
-         if ((ch >= '0') && (ch <= '9')) {
-            tok->str[i++] = ch;
-         }
-         else if ((ch == 'e') || (ch == 'E')) {
-            tok->str[i++] = ch;
-            state = 28;
-         }
-         else if ((ch == 'f') || (ch == 'F')) {
-            tok->str[i++] = ch;
-            state = 0;
-            tok->str[i] = EOS;
-            tok->token = TFLOATLIT;
-            tok->fValue = strtod(tok->str, NULL);
-            return (tok->token);
-         }
-         else if ((ch == 'l') || (ch == 'L')) {
-            tok->str[i++] = ch;
-            state = 0;
-            tok->str[i] = EOS;
-            tok->token = TFLOATLIT;
-            tok->fValue = strtod(tok->str, NULL);
-            return (tok->token);
-         }
-         else {
-            state = 0;
-            ungetc(ch, Src);
-            tok->str[i] = EOS;
-            tok->token = TFLOATLIT;
-            tok->fValue = strtod(tok->str, NULL);
-            return (tok->token);
-         }
-         break;
-      case 28:       // seen 'e' or 'E' after decimal digits
-         if ((ch >= '0') && (ch <= '9')) {
-            tok->str[i++] = ch;
-         }
-         else if ((ch == '+') || (ch == '-')) {
-            tok->str[i++] = ch;
-         }
-         else if ((ch == 'f') || (ch == 'F')) {
-            tok->str[i++] = ch;
-            state = 0;
-            tok->str[i] = EOS;
-            tok->token = TFLOATLIT;
-            tok->fValue = strtod(tok->str, NULL);
-            return (tok->token);
-         }
-         else if ((ch == 'l') || (ch == 'L')) {
-            tok->str[i++] = ch;
-            state = 0;
-            tok->str[i] = EOS;
-            tok->token = TFLOATLIT;
-            tok->fValue = strtod(tok->str, NULL);
-            return (tok->token);
-         }
-         else {
-            state = 0;
-            ungetc(ch, Src);
-            tok->str[i] = EOS;
-            tok->token = TFLOATLIT;
-            tok->fValue = strtod(tok->str, NULL);
-            return (tok->token);
-         }
+      }
+      else if (action < A_NAME) {
+         tok->token = action - RETURN;
          break;
-      case 29:       // seen 'x' after '\' in character constant
-         if ((ch >= '0') && (ch <= '9')) {
-            tok->str[i++] = ch;
-            tok->str[i] = EOS;
-            tok->iValue = (tok->iValue << 4) + (ch - '0');
-         }
-         else if ((ch >= 'a') && (ch <= 'f')) {
-            tok->str[i++] = ch;
-            tok->str[i] = EOS;
-            tok->iValue = (tok->iValue << 4) + (ch - 'a') + 10;
-         }
-         else if ((ch >= 'A') && (ch <= 'F')) {
-            tok->str[i++] = ch;
-            tok->str[i] = EOS;
-            tok->iValue = (tok->iValue << 4) + (ch - 'A') + 10;
-         }
-         else {
-            ungetc(ch, Src);
-            state = 23;
-         }
+      }
+      else if (action == A_NAME) {
+         p = ScanName(tok, p);
          break;
-      case 30:       // seen '0' to '7' after '\' in character constant
-         if ((ch >= '0') && (ch <= '7')) {
-            tok->str[i++] = ch;
-            tok->str[i] = EOS;
-            tok->iValue = (tok->iValue << 3) + (ch - '0');
-         }
-         else {
-            ungetc(ch, Src);
-            state = 23;
-         }
+      }
+      else if (action == A_NUMBER) {
+         p = ScanNumber(tok, p);
          break;
-      case 31:       // seen '0' to '7' after '\' in string constant
-         if ((ch >= '0') && (ch <= '7')) {
-            tok->str[i++] = ch;
-            tok->sValue[j] = (tok->sValue[j] << 3) + (ch - '0');
-         }
-         else {
-            ungetc(ch, Src);
-            j++;
-            state = 12;
-         }
+      }
+      else if (action == A_STRING) {
+         p = ScanString(lex, tok, p);
          break;
-      case 32:       // seen 'x' after '\' in string constant
-         if ((ch >= '0') && (ch <= '9')) {
-            tok->str[i++] = ch;
-            tok->sValue[j] = (tok->sValue[j] << 4) + (ch - '0');
-         }
-         else if ((ch >= 'a') && (ch <= 'f')) {
-            tok->str[i++] = ch;
-            tok->sValue[j] = (tok->sValue[j] << 4) + (ch - 'a') + 10;
-         }
-         else if ((ch >= 'A') && (ch <= 'F')) {
-            tok->str[i++] = ch;
-            tok->sValue[j] = (tok->sValue[j] << 4) + (ch - 'A') + 10;
-         }
-         else {
-            ungetc(ch, Src);
-            j++;
-            state = 12;
-         }
+      }
+      else if (action == A_CHAR) {
+         p = ScanChar(lex, tok, p);
          break;
-      case 33:       // seen '.'
-         if (ch == '.') {
-            state = 34;
-            tok->str[i++] = ch;
-         }
-         else {
-            state = 0;
-            ungetc(ch, Src);
-            tok->str[i] = EOS;
-            tok->token = TDOT;
-            return (tok->token);
-         }
+      }
+      else if (p < lex->srcEnd) {     // EOS within the file is ignored
+         p++;
+      }
+      else {
+         start = p;
+         tok->token = TEOF;
          break;
-      case 34:       // seen '..'
-         if (ch == '.') {
-            state = 0;
-            tok->str[i++] = ch;
-            tok->str[i] = EOS;
-            tok->token = TELLIPSIS;
-            return (tok->token);
-         }
-         else {
-            state = 0;
-            ungetc(ch, Src);
-            tok->str[i] = EOS;
-            tok->token = TINVAL;
-            return (tok->token);
+      }
+   }
+   
+   tok->offset = start - lex->srcBuf;
+   lex->srcPtr = p;
+
+   return (tok->token);
+}
+
+
+/* ScanName --- scan an identifier or keyword */
+
+static const unsigned char *ScanName(struct Token *tok, const unsigned char *p)
+{
+   const unsigned char *const start = p;
+   enum eToken token;
+   
+   do {
+      p++;
+   } while ((CharClass[*p] == CL_ALPHA) || (CharClass[*p] == CL_DIGIT));
+   
+   if ((token = lookupKeyword((const char *)start, p - start)) == TNULL) {
+      tok->token = TID;
+      tok->value.atom = Intern((const char *)start, p - start);
+   }
+   else {
+      tok->token = token;
+   }
+   
+   return (p);
+}
+
+
+/* ScanNumber --- scan an integer or floating-point literal */
+
+static const unsigned char *ScanNumber(struct Token *tok, const unsigned char *p)
+{
+   const char *const start = (const char *)p;
+   
+   if (*p == '0') {
+      p++;
+      
+      if ((*p == 'x') || (*p == 'X')) {   // Hex number
+         p++;
+         
+         while (((*p >= '0') && (*p <= '9')) ||
+                ((*p >= 'a') && (*p <= 'f')) ||
+                ((*p >= 'A') && (*p <= 'F')) || IS_INT_SUFFIX(*p)) {
+            p++;
+         }
+         
+         tok->token = TINTLIT;
+         tok->value.i = strtoul(start + 2, NULL, 16);
+         return (p);
+      }
+      
+      while (((*p >= '0') && (*p <= '7')) || IS_INT_SUFFIX(*p)) {   // Octal number
+         p++;
+      }
+      
+      if ((*p != '.') && (*p != 'e') && (*p != 'E')) {
+         tok->token = TINTLIT;
+         tok->value.i = strtoul(start, NULL, 8);
+         return (p);
+      }
+   }
+   else {
+      while ((CharClass[*p] == CL_DIGIT) || IS_INT_SUFFIX(*p)) {   // Decimal number
+         p++;
+      }
+      
+      if ((*p != '.') && (*p != 'e') && (*p != 'E')) {
+         tok->token = TINTLIT;
+         tok->value.i = atoi(start);
+         return (p);
+      }
+   }
+   
+   if (*p == '.') {     // Fraction
+      p++;
+      
+      while (CharClass[*p] == CL_DIGIT) {
+         p++;
+      }
+   }
+   
+   if ((*p == 'e') || (*p == 'E')) {   // Exponent
+      p++;
+      
+      while ((CharClass[*p] == CL_DIGIT) || (*p == '+') || (*p == '-')) {
+         p++;
+      }
+   }
+   
+   if ((*p == 'f') || (*p == 'F') || (*p == 'l') || (*p == 'L')) {
+      p++;
+   }
+   
+   tok->token = TFLOATLIT;
+   tok->value.f = strtod(start, NULL);
+   
+   return (p);
+}
+
+
+/* ScanString --- scan a string literal, decoding it into the string arena */
+
+static const unsigned char *ScanString(struct LexerContext *lex, struct Token *tok, const unsigned char *p)
+{
+   char *sp = lex->strArena + lex->strNext;
+   int ch;
+   
+   tok->value.s.offset = lex->strNext;
+   
+   for (p++; *p != '"'; p++) {
+      if (p >= lex->srcEnd) {
+         tok->token = TEOF;
+         return (p);
+      }
+      else if (*p == '\n') {
+         lex->line++;
+         lex->lineStart = p + 1;
+         *sp++ = *p;
+      }
+      else if (*p != '\\') {
+         *sp++ = *p;
+      }
+      else if (p + 1 >= lex->srcEnd) {
+         tok->token = TEOF;
+         return (p + 1);
+      }
+      else if ((*++p >= '0') && (*p <= '7')) {      // octal escape
+         ch = *p - '0';
+         
+         while ((p[1] >= '0') && (p[1] <= '7')) {
+            ch = (ch << 3) + (*++p - '0');
+         }
+         
+         *sp++ = ch;
+      }
+      else if (*p == 'x') {                        // hex escape
+         ch = 0;
+         
+         while (HexDigit(p[1]) >= 0) {
+            ch = (ch << 4) + HexDigit(*++p);
+         }
+         
+         *sp++ = ch;
+      }
+      else if (EscapeChar[*p] != EOS) {
+         *sp++ = EscapeChar[*p];
+      }
+      else {
+         if (*p == '\n') {
+            lex->line++;
+            lex->lineStart = p + 1;
          }
-         break;
+         
+         *sp++ = *p;
       }
    }
+   
+   *sp++ = EOS;
+   tok->value.s.length = (sp - lex->strArena) - lex->strNext; // Include EOS in the length
+   lex->strNext += tok->value.s.length;
+   tok->token = TSTRLIT;
+   
+   return (p + 1);
+}
 
-   tok->str[0] = ch;
-   tok->str[1] = EOS;
 
-   return (tok->token);
+/* ScanChar --- scan a character constant */
+
+static const unsigned char *ScanChar(struct LexerContext *lex, struct Token *tok, const unsigned char *p)
+{
+   int value;
+   
+   p++;
+   
+   if (p >= lex->srcEnd) {
+      tok->token = TEOF;
+      return (p);
+   }
+   else if (*p != '\\') {
+      if (*p == '\n') {
+         lex->line++;
+         lex->lineStart = p + 1;
+      }
+      
+      value = *p++;
+   }
+   else if (++p >= lex->srcEnd) {
+      tok->token = TEOF;
+      return (p);
+   }
+   else if ((*p >= '0') && (*p <= '7')) {    // octal number
+      value = *p++ - '0';
+      
+      while ((*p >= '0') && (*p <= '7')) {
+         value = (value << 3) + (*p++ - '0');
+      }
+   }
+   else if (*p == 'x') {                     // hex number
+      value = 0;
+      
+      for (p++; HexDigit(*p) >= 0; p++) {
+         value = (value << 4) + HexDigit(*p);
+      }
+   }
+   else if (EscapeChar[*p] != EOS) {
+      value = EscapeChar[*p++];
+   }
+   else {                                    // unrecognised escape
+      value = *p++;
+   }
+   
+   // Look for the closing single quote
+   for ( ; *p != '\''; p++) {
+      if (p >= lex->srcEnd) {
+         tok->token = TEOF;
+         return (p);
+      }
+      else if (*p == '\n') {
+         lex->line++;
+         lex->lineStart = p + 1;
+      }
+   }
+   
+   tok->token = TINTLIT;
+   tok->value.i = value;
+   
+   return (p + 1);
+}
+
+
+/* HexDigit --- return the value of a hex digit, or -1 if it isn't one */
+
+static int HexDigit(const int ch)
+{
+   if ((ch >= '0') && (ch <= '9'))
+      return (ch - '0');
+   else if ((ch >= 'a') && (ch <= 'f'))
+      return (ch - 'a' + 10);
+   else if ((ch >= 'A') && (ch <= 'F'))
+      return (ch - 'A' + 10);
+   else
+      return (-1);
 }
 
 
@@ -25,23 +25,54 @@ enum eToken {
 
 
 struct Token {
-   char sValue[256];
-   int sLength;
-   int/**/iValue;
-   double/*/*/fValue;
    enum/*//*/eToken/***/token;
-   char/* */str[256];
+   int/**/offset;       // Offset of token text in source buffer
+   int length;          // Length of token text
+   int line;
+   int column;
+   union {
+      int atom;         // TID
+      int i;            // TINTLIT
+      double/*/*/f;     // TFLOATLIT
+      struct {
+         int offset;    // Offset of decoded bytes in string arena
+         int length;    // Number of decoded bytes, including EOS
+      } s;              // TSTRLIT
+   } value;
+};
+
+/* Everything the lexical analyser knows about one source file. Each
+ * file being compiled has its own context, so several files may be
+ * tokenised at the same time.
+ */
+struct LexerContext {
+   char srcName[256];
+   unsigned char *srcBuf;              // Whole source file plus EOS sentinel
+   const unsigned char *srcPtr;        // Next unread character
+   const unsigned char *srcEnd;        // Position of the EOS sentinel
+   const unsigned char *lineStart;     // First character of current line
+   int line;
+   char *strArena;                     // Decoded string literals
+   int strNext;
+   FILE *errors;                       // Where to report compile errors
 };
 
 void LexicalInit(void);
 void SetTokenTraceFlag(const bool enabled);
 void SetSyntaxTraceFlag(const bool enabled);
 void PrintSyntax(const char *fmt, ...) __attribute__ ((format (printf, 1, 2)));
-void Error(const char *fmt, ...) __attribute__ ((format (printf, 1, 2)));
-void installkw(const char keyword[], enum eToken token, bool isType);
-bool OpenSourceFile(const char fname[]);
-bool CloseSourceFile(void);
-int GetToken(struct Token *tok);
+void Error(const struct LexerContext *lex, const char *fmt, ...) __attribute__ ((format (printf, 2, 3)));
+bool OpenSourceFile(struct LexerContext *lex, const char fname[], FILE *errors);
+bool CloseSourceFile(struct LexerContext *lex);
+int GetToken(struct LexerContext *lex, struct Token *tok);
 char *tokenAsStr(const struct Token *tok);
-enum eToken lookupKeyword(const char name[]);
-void PrintToken(const struct Token *tok);
+enum eToken lookupKeyword(const char name[], const int len);
+const char *TokenText(const struct LexerContext *lex, const struct Token *tok);
+int TokenLength(const struct Token *tok);
+char *CopyTokenText(const struct LexerContext *lex, const struct Token *tok, char buf[], const int size);
+int TokenAtom(const struct Token *tok);
+int TokenIntValue(const struct Token *tok);
+double TokenFloatValue(const struct Token *tok);
+const char *TokenStringValue(const struct LexerContext *lex, const struct Token *tok);
+int TokenStringLength(const struct Token *tok);
+void PrintToken(const struct LexerContext *lex, const struct Token *tok);
@@ -5,65 +5,228 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "codegen.h"
 #include "lexical.h"
+#include "atom.h"
 
 //#define LEX_TESTER
 
 #define MAXCASES (512)   // Maximum number of case labels in a 'switch'
-
-struct StringConstant Strings[64];
-static int NextStr = 0;
+#define MAXJOBS  (64)    // Maximum number of '-j' worker threads
+#define MAXSTATICS (64)  // Maximum number of 'static' variables declared in inner blocks
+#define MAXPROMOTE (32)  // Maximum number of locals considered for promotion into Y
+#define MAXLOOPNEST (16) // Deepest loop nesting that's tracked when weighting uses
+#define MAXREGPARAMS (2) // Arguments passed in D and X to a '__fastcall' function
+#define MAXPARAMS (16)   // Most parameters a function can have and still call itself in a loop
+#define MAXINLINES (64)  // Most functions in a source file that can be expanded at their calls
+#define LEAFINLINE (8)   // Largest body, in tree nodes, that's expanded without asking
+#define MAXINLINE (32)   // Largest body of an 'inline' function that's expanded
+
+// One source file named on the command line, and what compiling it produced
+struct Job {
+   const char *fname;
+   char *out;           // Buffered standard output
+   size_t outLen;
+   char *err;           // Buffered error messages
+   size_t errLen;
+   bool done;
+};
+
+_Thread_local struct StringConstant Strings[64];
+static _Thread_local int NextStr = 0;
+static _Thread_local struct Symbol Statics[MAXSTATICS];
+static _Thread_local int NextStatic = 0;
+static _Thread_local int FrameDepth = 0;   // Bytes of local variables in scope
+static _Thread_local int Params[MAXPARAMS];   // Atoms of the parameters, those in D and X first
+static _Thread_local int NParams = 0;
+static _Thread_local struct Symbol TailParams[MAXPARAMS];   // Where the parameters ended up
+static _Thread_local int TailLabel = NOLABEL;   // Start of the function's code, after the entry sequence
+static _Thread_local int TailDepth = 0;         // and the size of its frame there
+static _Thread_local int FastcallAtom = NOATOM; // '__fastcall', interned once per compilation-unit
+static bool LexOnly = false;
+static bool Promote = true;   // Set once from the command line, like the optimiser flag
+static bool TailCalls = true;
+static bool Inlining = true;
+static int NRegisters = 1;    // Y for register variables, and W as well on the 6309
+
+static struct Job *Jobs;
+static int NJobs = 0;
+static int NextJob = 0;
+static pthread_mutex_t JobLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t JobDone = PTHREAD_COND_INITIALIZER;
+
+// A function whose body is a single expression, which may be expanded at each call
+struct InlineFunction {
+   int atom;
+   int nParams;
+   struct ExprNode *body;     // With an N_PARAM for each use of a parameter
+};
+
+static _Thread_local struct InlineFunction Inlines[MAXINLINES];
+static _Thread_local int NInlines = 0;
+static _Thread_local bool Capturing = false;       // Keep a copy of the next expression parsed
+static _Thread_local struct ExprNode *Captured = NULL;
+
+// Binary operators, with their precedence: the higher it is, the more tightly they bind
+static const struct {
+   int token;
+   int prec;
+   int kind;
+} BinaryOps[] = {
+   {TLOGOR,   1, N_LOGOR},
+   {TLOGAND,  2, N_LOGAND},
+   {TOR,      3, N_OR},
+   {TEXOR,    4, N_XOR},
+   {TAND,     5, N_AND},
+   {TEQ,      6, N_EQ},
+   {TNE,      6, N_NE},
+   {TLT,      7, N_LT},
+   {TLE,      7, N_LE},
+   {TGT,      7, N_GT},
+   {TGE,      7, N_GE},
+   {TLSHT,    8, N_LSHIFT},
+   {TRSHT,    8, N_RSHIFT},
+   {TPLUS,    9, N_ADD},
+   {TMINUS,   9, N_SUB},
+   {TSTAR,   10, N_MUL},
+   {TDIV,    10, N_DIV},
+   {TMOD,    10, N_MOD}
+};
+
+#define NBINARYOPS (int)(sizeof (BinaryOps) / sizeof (BinaryOps[0]))
 
 
 void initialise(void);
-void parse(const char fname[]);
-void parser(void);
-int ParseDeclaration(struct Token *tok);
-void ParseFunctionBody(struct Token *tok, const struct Symbol *const fn);
-void ParseStatement(struct Token *tok, const struct Symbol *const fn, const int returnLabel, const int breakLabel, const int continueLabel);
-void ParseReturn(struct Token *tok, const struct Symbol *const fn, const int returnLabel);
-void ParseCompoundStatement(struct Token *tok, const struct Symbol *const fn, const int returnLabel, const int breakLabel, const int continueLabel);
-void ParseIf(struct Token *tok, const struct Symbol *const fn, const int returnLabel, const int breakLabel, const int continueLabel);
-void ParseExpression(struct Token *tok);
-void ParseDo(struct Token *tok, const struct Symbol *const fn, const int returnLabel);
-void ParseBreak(struct Token *tok, const int breakLabel);
-void ParseContinue(struct Token *tok, const int continueLabel);
-void ParseGoto(struct Token *tok);
-void ParseWhile(struct Token *tok, const struct Symbol *const fn, const int returnLabel);
-void ParseFor(struct Token *tok, const struct Symbol *const fn, const int returnLabel);
-void ParseSwitch(struct Token *tok, const struct Symbol *const fn, const int returnLabel, const int continueLabel);
-void ParseSemi(struct Token *tok, const char location[]);
-bool ParseConstIntExpr(struct Token *tok, int *value, int *type);
+void parse(const char fname[], FILE *out, FILE *errors);
+void compileAll(const int nThreads);
+void *worker(void *arg);
+void parser(struct LexerContext *lex);
+void lexer(struct LexerContext *lex, FILE *out);
+int ParseDeclaration(struct LexerContext *lex, struct Token *tok);
+int ParseBaseType(struct LexerContext *lex, struct Token *tok, bool *isUnsigned);
+void ParseFunctionBody(struct LexerContext *lex, struct Token *tok, const struct Symbol *const fn, const bool isInline);
+void AddInline(const struct Symbol *const fn, struct ExprNode *body, const bool isInline);
+struct ExprNode *ExpandInline(struct ExprNode *call);
+bool MakeParams(struct ExprNode *e);
+bool IsUnchangeable(const struct ExprNode *e);
+int ParseLocalDeclarations(struct LexerContext *lex, struct Token *tok, int autoSize, int *nRegister);
+int PromoteLocal(const struct LexerContext *lex, const struct Token *tok, int autoSize, int *nRegister);
+bool NamedInBody(const struct LexerContext *lex, const struct Token *tok, const int atom);
+bool IsTailRecursion(const struct ExprNode *e, const struct Symbol *const fn, const struct Symbol *params[]);
+void ParseStatement(struct LexerContext *lex, struct Token *tok, const struct Symbol *const fn, const int returnLabel, const int breakLabel, const int continueLabel);
+void ParseReturn(struct LexerContext *lex, struct Token *tok, const struct Symbol *const fn, const int returnLabel);
+void ParseCompoundStatement(struct LexerContext *lex, struct Token *tok, const struct Symbol *const fn, const int returnLabel, const int breakLabel, const int continueLabel);
+void ParseIf(struct LexerContext *lex, struct Token *tok, const struct Symbol *const fn, const int returnLabel, const int breakLabel, const int continueLabel);
+int ParseExpression(struct LexerContext *lex, struct Token *tok, const bool needValue);
+struct ExprNode *ParseAssignment(struct LexerContext *lex, struct Token *tok);
+struct ExprNode *ParseTernary(struct LexerContext *lex, struct Token *tok);
+struct ExprNode *ParseBinary(struct LexerContext *lex, struct Token *tok, const int minPrec);
+struct ExprNode *ParseUnary(struct LexerContext *lex, struct Token *tok);
+struct ExprNode *ParseSizeof(struct LexerContext *lex, struct Token *tok);
+struct ExprNode *ParsePostfix(struct LexerContext *lex, struct Token *tok);
+struct ExprNode *ParsePrimary(struct LexerContext *lex, struct Token *tok);
+struct ExprNode *ParseCall(struct LexerContext *lex, struct Token *tok, const char name[], const struct Symbol *const fn);
+bool CheckLvalue(struct LexerContext *lex, const struct ExprNode *e, const char what[], const bool derefOK);
+bool IsTypeToken(const int token);
+void ParseTypeName(struct LexerContext *lex, struct Token *tok, int *type, int *pLevel);
+void ParseCondition(struct LexerContext *lex, struct Token *tok, const int label, const bool sense, const char stmt[]);
+void ParseDo(struct LexerContext *lex, struct Token *tok, const struct Symbol *const fn, const int returnLabel);
+void ParseBreak(struct LexerContext *lex, struct Token *tok, const int breakLabel);
+void ParseContinue(struct LexerContext *lex, struct Token *tok, const int continueLabel);
+void ParseGoto(struct LexerContext *lex, struct Token *tok);
+void ParseWhile(struct LexerContext *lex, struct Token *tok, const struct Symbol *const fn, const int returnLabel);
+void ParseFor(struct LexerContext *lex, struct Token *tok, const struct Symbol *const fn, const int returnLabel);
+void ParseSwitch(struct LexerContext *lex, struct Token *tok, const struct Symbol *const fn, const int returnLabel, const int continueLabel);
+void ParseSemi(struct LexerContext *lex, struct Token *tok, const char location[]);
+bool ParseConstIntExpr(struct LexerContext *lex, struct Token *tok, int *value, int *type);
 
 
 int main(const int argc, const char *argv[])
 {
    int i;
+   int nThreads = 1;
+   bool tracing = false;
+   const char *arg;
    
    initialise();
    
+   if ((Jobs = calloc(argc, sizeof (struct Job))) == NULL) {
+      fprintf(stderr, "%s: can't allocate job table\n", argv[0]);
+      exit(EXIT_FAILURE);
+   }
+   
    for (i = 1; i < argc; i++) {
       if (argv[i][0] == '-') {
          switch (argv[i][1]) {
          case 'T':
             SetTokenTraceFlag(true);
+            tracing = true;
             break;
          case 'S':
             SetSyntaxTraceFlag(true);
+            tracing = true;
+            break;
+         case 'L':
+            LexOnly = true;
+            break;
+         case 'O':                        // '-O0' turns off the optimiser
+            SetOptimiseFlag(argv[i][2] != '0');
+            Promote = (argv[i][2] != '0');
+            TailCalls = (argv[i][2] != '0');
+            Inlining = (argv[i][2] != '0');
+            break;
+         case '6':                        // '-6' allows 6309 registers
+            NRegisters = 2;
+            break;
+         case 'p':                        // '-p profile' counts accesses to variables
+            arg = (argv[i][2] != '\0') ? &argv[i][2] : argv[++i];
+            
+            if ((arg == NULL) || (ReadProfile(arg) == false)) {
+               fprintf(stderr, "%s: can't read profile '%s'\n", argv[0], (arg == NULL) ? "" : arg);
+               exit(EXIT_FAILURE);
+            }
+            break;
+         case 'j':                        // Accept '-j4' or '-j 4'
+            arg = (argv[i][2] != '\0') ? &argv[i][2] : argv[++i];
+            
+            if ((arg == NULL) || ((nThreads = atoi(arg)) < 1)) {
+               fprintf(stderr, "%s: '-j' needs a positive number of jobs\n", argv[0]);
+               exit(EXIT_FAILURE);
+            }
+            
+            if (nThreads > MAXJOBS)
+               nThreads = MAXJOBS;
             break;
          default:
-            fprintf(stderr, "Usage: %s [-T] [-S] <filename>\n", argv[0]);
+            fprintf(stderr, "Usage: %s [-T] [-S] [-L] [-O0] [-6] [-p profile] [-j jobs] <filename> ...\n", argv[0]);
             exit(EXIT_FAILURE);
             break;
          }
       }
       else {
-         parse(argv[i]);
+         Jobs[NJobs++].fname = argv[i];
       }
    }
+   
+   // Trace output is written as it happens, so keep it in one piece
+   if (tracing)
+      nThreads = 1;
+   else if (nThreads > NJobs)
+      nThreads = NJobs;
+
+   if (nThreads > 1) {
+      compileAll(nThreads);
+   }
+   else {
+      for (i = 0; i < NJobs; i++)
+         parse(Jobs[i].fname, stdout, stderr);
+   }
 
+   free(Jobs);
+   
    return (0);
 }
 
@@ -72,197 +235,345 @@ int main(const int argc, const char *argv[])
 
 void initialise(void)
 {
-   CodeGenInit();
    LexicalInit();
-   SymTabInit();
 }
 
 
 /* parse --- open, parse and translate a single source code file */
 
-void parse(const char fname[])
+void parse(const char fname[], FILE *out, FILE *errors)
 {
-   if (OpenSourceFile(fname) == false)
+   struct LexerContext lex;
+   
+   // Each compilation-unit starts with empty tables and label numbers
+   CodeGenInit();
+   AtomInit();
+   SymTabInit();
+   FastcallAtom = Intern("__fastcall", strlen("__fastcall"));
+   NextStr = 0;
+   NextStatic = 0;
+   
+   while (NInlines > 0) {
+      FreeTree(Inlines[--NInlines].body);
+   }
+   
+   if (OpenSourceFile(&lex, fname, errors) == false)
       return;
       
+   if (LexOnly) {
+      lexer(&lex, out);
+      CloseSourceFile(&lex);
+      return;
+   }
+   
    if (OpenAssemblerFile(fname) == false) {
-      CloseSourceFile();
+      CloseSourceFile(&lex);
       return;
    }
    
-   parser();
+   parser(&lex);
 
    CloseAssemblerFile();
-   CloseSourceFile();
+   CloseSourceFile(&lex);
+}
+
+
+/* compileAll --- translate all the source files on a pool of worker threads */
+
+void compileAll(const int nThreads)
+{
+   pthread_t tid[MAXJOBS];
+   int nStarted;
+   int i;
+   
+   for (nStarted = 0; nStarted < nThreads; nStarted++)
+      if (pthread_create(&tid[nStarted], NULL, worker, NULL) != 0)
+         break;
+   
+   if (nStarted == 0)            // No threads at all, so do it ourselves
+      worker(NULL);
+   
+   // Report each file's output and errors in command-line order, as soon
+   // as that file and all the ones before it are finished
+   for (i = 0; i < NJobs; i++) {
+      pthread_mutex_lock(&JobLock);
+      
+      while (Jobs[i].done == false)
+         pthread_cond_wait(&JobDone, &JobLock);
+      
+      pthread_mutex_unlock(&JobLock);
+      
+      fwrite(Jobs[i].out, 1, Jobs[i].outLen, stdout);
+      fflush(stdout);
+      fwrite(Jobs[i].err, 1, Jobs[i].errLen, stderr);
+      
+      free(Jobs[i].out);
+      free(Jobs[i].err);
+   }
+   
+   for (i = 0; i < nStarted; i++)
+      pthread_join(tid[i], NULL);
+}
+
+
+/* worker --- take source files from the job list until there are none left */
+
+void *worker(void *arg)
+{
+   struct Job *job;
+   FILE *out;
+   FILE *errors;
+   
+   for (;;) {
+      pthread_mutex_lock(&JobLock);
+      job = (NextJob < NJobs) ? &Jobs[NextJob++] : NULL;
+      pthread_mutex_unlock(&JobLock);
+      
+      if (job == NULL)
+         break;
+      
+      out = open_memstream(&job->out, &job->outLen);
+      errors = open_memstream(&job->err, &job->errLen);
+      
+      if ((out == NULL) || (errors == NULL)) {
+         fprintf(stderr, "%s: can't allocate output buffers\n", job->fname);
+         exit(EXIT_FAILURE);
+      }
+      
+      parse(job->fname, out, errors);
+      
+      fclose(out);
+      fclose(errors);
+      
+      pthread_mutex_lock(&JobLock);
+      job->done = true;
+      pthread_cond_broadcast(&JobDone);
+      pthread_mutex_unlock(&JobLock);
+   }
+   
+   return (NULL);
 }
 
 
 /* parser --- parse and translate a single compilation-unit */
 
-void parser(void)
+void parser(struct LexerContext *lex)
 {
    struct Token tok;
 
 #ifdef LEX_TESTER
-   while (GetToken(&tok) != TEOF)
-      PrintToken(&tok);
+   while (GetToken(lex, &tok) != TEOF)
+      PrintToken(lex, &tok);
 #else
-   GetToken(&tok);
+   GetToken(lex, &tok);
 
-   while (ParseDeclaration(&tok) != EOF)
+   while (ParseDeclaration(lex, &tok) != EOF)
       ;
 #endif
 }
 
 
+/* lexer --- tokenise a single compilation-unit and report lexing throughput */
+
+void lexer(struct LexerContext *lex, FILE *out)
+{
+   struct Token tok;
+   long int nTokens = 0L;
+   struct timespec start, end;
+   double secs;
+   
+   // Time just this thread, since other files may be compiling alongside
+   clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+
+   while (GetToken(lex, &tok) != TEOF)
+      nTokens++;
+   
+   clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+   secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+   
+   fprintf(out, "%s: %ld tokens in %.3f seconds", lex->srcName, nTokens, secs);
+   
+   if (secs > 0.0) {
+      fprintf(out, " (%.0f tokens/second)", nTokens / secs);
+   }
+   
+   fprintf(out, "\n");
+}
+
+
 /* ParseDeclaration --- parse a top-level declaration */
 
-int ParseDeclaration(struct Token *tok)
+int ParseDeclaration(struct LexerContext *lex, struct Token *tok)
 {
    struct Symbol sym;
    int type;
    int iValue;
    int iType;
    int paramSize = 0;
+   int nParams = 0;
+   bool isUnsigned = false;
+   bool fastCall = false;
+   bool isInline = false;
    
    type = 0;
    
-   sym.name[0] = '\0';
+   sym.atom = NOATOM;
+   sym.name = "";
    sym.storageClass = SCEXTERN;
    sym.type = T_INT;
    sym.pLevel = 0;
    sym.label = NOLABEL;
    sym.fpOffset = 0;
+   sym.reg = R_Y;
+   sym.regParams = 0;
    sym.readOnly = false;
    
+   // '__fastcall' asks for a function's first two arguments in D and X, rather than on the stack
+   while ((tok->token == TINLINE) ||
+          ((tok->token == TID) && (TokenAtom(tok) == FastcallAtom))) {
+      if (tok->token == TINLINE) {
+         PrintSyntax("<inline>");
+         isInline = true;
+      }
+      else {
+         PrintSyntax("<__fastcall>");
+         fastCall = true;
+      }
+      
+      GetToken(lex, tok);
+   }
+   
    switch (tok->token) {
    case TEOF:
       return (EOF);
    case TSEMI:
-      GetToken(tok);
+      GetToken(lex, tok);
       break;
    case TVOID:
    case TINT:
    case TCHAR:
    case TFLOAT:
    case TDOUBLE:
+   case TUNSIGNED:
       PrintSyntax("<type>");
-      type = tok->token;
-
-      GetToken(tok);
+      type = ParseBaseType(lex, tok, &isUnsigned);
 
       while (tok->token == TSTAR) {
          PrintSyntax("<'*'>");
          sym.pLevel++;
-         GetToken(tok);
+         GetToken(lex, tok);
       }
       
       if (tok->token == TID) {
-         PrintSyntax("<id:%s>", tok->str);
-         strncpy(sym.name, tok->str, MAXNAME);
-         GetToken(tok);
+         PrintSyntax("<id:%.*s>", TokenLength(tok), TokenText(lex, tok));
+         sym.atom = TokenAtom(tok);
+         sym.name = AtomName(sym.atom);
+         GetToken(lex, tok);
       }
       else {
-         Error("Missing identifier in declaration");
+         Error(lex, "Missing identifier in declaration");
       }
 
       switch (tok->token) {
       case TASSIGN:  // Scalar initialiser
          PrintSyntax("<'='>");
-         GetToken(tok);
+         GetToken(lex, tok);
 
          if (sym.pLevel == 0) {
             switch (type) {
             case TCHAR:
-               sym.type = T_CHAR;
-               if (ParseConstIntExpr(tok, &iValue, &iType)) {
+               sym.type = isUnsigned ? T_UCHAR : T_CHAR;
+               if (ParseConstIntExpr(lex, tok, &iValue, &iType)) {
                   EmitExternScalar(&sym, iValue, 0.0);
                }
                else {
-                  Error("Expected integer constant after '='");
+                  Error(lex, "Expected integer constant after '='");
                }
                break;
             case TINT:
-               sym.type = T_INT;
-               if (ParseConstIntExpr(tok, &iValue, &iType)) {
+               sym.type = isUnsigned ? T_UINT : T_INT;
+               if (ParseConstIntExpr(lex, tok, &iValue, &iType)) {
                   EmitExternScalar(&sym, iValue, 0.0);
                }
                else {
-                  Error("Expected integer constant after '='");
+                  Error(lex, "Expected integer constant after '='");
                }
                break;
             case TFLOAT:
                sym.type = T_FLOAT;
-               EmitExternScalar(&sym, 0, tok->fValue);
-               GetToken(tok);
+               EmitExternScalar(&sym, 0, TokenFloatValue(tok));
+               GetToken(lex, tok);
                break;
             case TDOUBLE:
                sym.type = T_DOUBLE;
-               EmitExternScalar(&sym, 0, tok->fValue);
-               GetToken(tok);
+               EmitExternScalar(&sym, 0, TokenFloatValue(tok));
+               GetToken(lex, tok);
                break;
             }
          }
          else {
-            EmitExternScalar(&sym, tok->iValue, 0.0);
-            GetToken(tok);
+            EmitExternScalar(&sym, TokenIntValue(tok), 0.0);
+            GetToken(lex, tok);
          }
          
          if (AddExternSymbol(&sym) == false) {
-            Error("Symbol '%s' is already declared", sym.name);
+            Error(lex, "Symbol '%s' is already declared", sym.name);
          }
          
-         ParseSemi(tok, "in declaration");
+         ParseSemi(lex, tok, "in declaration");
          break;
       case TOSQBRK:  // Array
          PrintSyntax("[");
-         GetToken(tok);
-         if (ParseConstIntExpr(tok, &iValue, &iType)) {
+         GetToken(lex, tok);
+         if (ParseConstIntExpr(lex, tok, &iValue, &iType)) {
             if (tok->token == TCSQBRK) {
                PrintSyntax("]");
-               GetToken(tok);
+               GetToken(lex, tok);
             }
             else {
-               Error("Expected ']' after array dimension");
+               Error(lex, "Expected ']' after array dimension");
             }
          }
          else {
-            Error("Expected integer constant after '['");
+            Error(lex, "Expected integer constant after '['");
          }
 
-         ParseSemi(tok, "in array declaration");
+         ParseSemi(lex, tok, "in array declaration");
          break;
       case TOPAREN:  // Function
          PrintSyntax("(");
-         GetToken(tok);
+         GetToken(lex, tok);
          paramSize = 0;
          
          // Function's formal parameters
          while ((tok->token == TINT) || (tok->token == TCHAR) ||
                 (tok->token == TFLOAT) || (tok->token == TDOUBLE) ||
-                (tok->token == TVOID) || (tok->token == TCONST)) {
+                (tok->token == TVOID) || (tok->token == TCONST) ||
+                (tok->token == TUNSIGNED)) {
             struct Symbol param;
             int type;
+            bool isUnsigned;
             
             PrintSyntax("<formal_parameter>");
             
             param.storageClass = SCAUTO;
-            param.name[0] = '\0';
+            param.atom = NOATOM;
+            param.name = "";
             param.type = T_INT;
             param.pLevel = 0;
             param.label = NOLABEL;
             param.fpOffset = 0;
+            param.reg = R_Y;
+            param.regParams = 0;
             param.readOnly = false;
             
             if (tok->token == TCONST) {
-               GetToken(tok);
+               GetToken(lex, tok);
                
                param.readOnly = true;
             }
             
-            type = tok->token;   // Yikes, we're assuming that the next token is a valid type!
-            
-            GetToken(tok);
+            type = ParseBaseType(lex, tok, &isUnsigned);
             
             if (type == TVOID) { // 'void' must be alone with no identifier following
                break;
@@ -271,57 +582,80 @@ int ParseDeclaration(struct Token *tok)
             while (tok->token == TSTAR) {
                PrintSyntax("<'*'>");
                param.pLevel++;
-               GetToken(tok);
+               GetToken(lex, tok);
             }
             
             if (tok->token == TID) {
-               PrintSyntax("<id:%s>", tok->str);
-               strncpy(param.name, tok->str, MAXNAME);
+               PrintSyntax("<id:%.*s>", TokenLength(tok), TokenText(lex, tok));
+               param.atom = TokenAtom(tok);
+               param.name = AtomName(param.atom);
 
+               // Parameters are pushed as words, so a char sits in the low byte
                if (param.pLevel == 0) {
                   switch (type) {
                   case TCHAR:
-                     param.type = T_CHAR;
+                     param.type = isUnsigned ? T_UCHAR : T_CHAR;
+                     param.fpOffset = paramSize + 1;
                      paramSize += 2;
                      break;
                   case TINT:
-                     param.type = T_INT;
+                     param.type = isUnsigned ? T_UINT : T_INT;
+                     param.fpOffset = paramSize;
                      paramSize += 2;
                      break;
                   case TFLOAT:
                      param.type = T_FLOAT;
+                     param.fpOffset = paramSize;
                      paramSize += 4;
                      break;
                   case TDOUBLE:
                      param.type = T_DOUBLE;
+                     param.fpOffset = paramSize;
                      paramSize += 8;
                      break;
                   }
                }
                else {
                   param.type = T_INT;
+                  param.fpOffset = paramSize;
                   paramSize += 2;
                }
-
-               param.fpOffset = paramSize;
+               
+               // Only 16-bit and char arguments fit in D and X, and only until one doesn't
+               if (fastCall && (sym.regParams == nParams) && (sym.regParams < MAXREGPARAMS) &&
+                   ((param.pLevel > 0) || (type == TCHAR) || (type == TINT))) {
+                  param.fpOffset = 0;     // ParseFunctionBody() finds it a place in the frame
+                  paramSize -= 2;
+                  sym.regParams++;
+               }
             }
             else {
-               Error("Expected identifier in parameter declaration");
+               Error(lex, "Expected identifier in parameter declaration");
+            }
+            
+            if (nParams < MAXPARAMS) {
+               Params[nParams] = param.atom;
             }
             
-            AddLocalSymbol(&param);
+            nParams++;
+            
+            if (AddLocalSymbol(&param) == false) {
+               Error(lex, "Parameter '%s' is already declared", param.name);
+            }
             
             PrintSyntax("\n");
-            GetToken(tok);
+            GetToken(lex, tok);
             
             if (tok->token == TCOMMA) {
-               GetToken(tok);
+               GetToken(lex, tok);
             }
             else if (tok->token != TCPAREN) {
-               Error("Missing comma in parameter list");
+               Error(lex, "Missing comma in parameter list");
             }
          }
          
+         NParams = nParams;
+         
          if (tok->token == TCPAREN) {
             PrintSyntax(")");
 
@@ -334,7 +668,7 @@ int ParseDeclaration(struct Token *tok)
                   sym.type = T_INT;
                   break;
                case TINT:
-                  sym.type = T_INT;
+                  sym.type = isUnsigned ? T_UINT : T_INT;
                   break;
                case TFLOAT:
                   sym.type = T_FLOAT;
@@ -349,41 +683,49 @@ int ParseDeclaration(struct Token *tok)
             }
          }
          else {
-            Error("Malformed function declaration");
+            Error(lex, "Malformed function declaration");
          }
 
-         GetToken(tok);
+         GetToken(lex, tok);
 
          sym.readOnly = true;
          
          if (AddExternSymbol(&sym) == false) {
             // Functions may already have prototypes or K&R-style declarations
-            //Error("Symbol '%s' is already declared", sym.name);
+            //Error(lex, "Symbol '%s' is already declared", sym.name);
+            const struct Symbol *const decl = LookUpExternSymbol(sym.atom);
+            
+            if ((decl != NULL) && (decl->regParams != sym.regParams)) {
+               Error(lex, "Function '%s' is declared with a different calling convention", sym.name);
+            }
          }
 
          if (tok->token == TOBRACE) {
             PrintSyntax("<function_definition>\n");
-            ParseFunctionBody(tok, &sym);
+            ParseFunctionBody(lex, tok, &sym, isInline);
          }
          else {
             PrintSyntax("<function_prototype>");
-            ParseSemi(tok, "in function prototype");
+            ParseSemi(lex, tok, "in function prototype");
+            
+            // With no body, the parameters' names go out of scope here
+            ForgetLocalSymbols();
          }
          
          sym.readOnly = false;
 
          break;
       case TSEMI:    // Uninitialised scalar
-         GetToken(tok);
+         GetToken(lex, tok);
          
          if (sym.pLevel == 0) {
             switch (type) {
             case TCHAR:
-               sym.type = T_CHAR;
+               sym.type = isUnsigned ? T_UCHAR : T_CHAR;
                EmitExternScalar(&sym, 0, 0.0);
                break;
             case TINT:
-               sym.type = T_INT;
+               sym.type = isUnsigned ? T_UINT : T_INT;
                EmitExternScalar(&sym, 0, 0.0);
                break;
             case TFLOAT:
@@ -402,17 +744,17 @@ int ParseDeclaration(struct Token *tok)
          }
 
          if (AddExternSymbol(&sym) == false) {
-            Error("Symbol '%s' is already declared", sym.name);
+            Error(lex, "Symbol '%s' is already declared", sym.name);
          }
          break;
       default:
-         Error("Unexpected symbol '%s' in declaration", tok->str);
+         Error(lex, "Unexpected symbol '%.*s' in declaration", TokenLength(tok), TokenText(lex, tok));
          break;
       }
       
       break;
    default:
-      Error("Unexpected symbol '%s' in declaration", tok->str);
+      Error(lex, "Unexpected symbol '%.*s' in declaration", TokenLength(tok), TokenText(lex, tok));
       break;
    }
 
@@ -422,79 +764,343 @@ int ParseDeclaration(struct Token *tok)
 }
 
 
+/* ParseBaseType --- parse a type name such as 'int' or 'unsigned char' and return its token */
+
+int ParseBaseType(struct LexerContext *lex, struct Token *tok, bool *isUnsigned)
+{
+   int type;
+   
+   *isUnsigned = false;
+   
+   if (tok->token == TUNSIGNED) {
+      PrintSyntax("<unsigned>");
+      *isUnsigned = true;
+      GetToken(lex, tok);
+      
+      if ((tok->token != TCHAR) && (tok->token != TINT)) {
+         return (TINT);    // Plain 'unsigned' means 'unsigned int'
+      }
+   }
+   
+   type = tok->token;   // Yikes, we're assuming that the next token is a valid type!
+   
+   GetToken(lex, tok);
+   
+   return (type);
+}
+
+
 /* ParseFunctionBody --- parse the body of a function */
 
-void ParseFunctionBody(struct Token *tok, const struct Symbol *const fn)
+void ParseFunctionBody(struct LexerContext *lex, struct Token *tok, const struct Symbol *const fn, const bool isInline)
 {
    int autoSize = 0;
    int nRegister = 0;
+   int nStatements = 0;
+   int nParamSyms;
+   bool noLocals;
    int i;
    const int returnLabel = AllocLabel('R');
    
    NextStr = 0;
 
-   GetToken(tok);
+   GetToken(lex, tok);
+   
+   // Arguments that arrive in D and X are kept in the frame, unless the body never names them
+   for (i = 0; i < fn->regParams; i++) {
+      struct Symbol *param = LookUpLocalSymbol(Params[i]);
+      
+      if ((param != NULL) && NamedInBody(lex, tok, param->atom)) {
+         autoSize += ((param->type == T_CHAR) || (param->type == T_UCHAR)) ? 1 : 2;
+         param->fpOffset = -autoSize;
+      }
+   }
+   
+   // Function's local variables, including any 'static' ones, which are emitted straight away
+   nParamSyms = CountLocalSymbols();
+   autoSize = ParseLocalDeclarations(lex, tok, autoSize, &nRegister);
+   noLocals = (CountLocalSymbols() == nParamSyms);
+   
+   if (Promote && (nRegister < NRegisters)) {
+      autoSize = PromoteLocal(lex, tok, autoSize, &nRegister);
+   }
+   
+   FrameDepth = autoSize;
+   
+   // Function entry sequence
+   EmitFunctionEntry(fn->name, autoSize, nRegister);
+   
+   for (i = 0; i < fn->regParams; i++) {
+      const struct Symbol *const param = LookUpLocalSymbol(Params[i]);
+      
+      if ((param != NULL) && ((param->fpOffset < 0) || (param->storageClass == SCREGISTER))) {
+         EmitRegisterParam(param, i);
+      }
+   }
+   
+   // A call to itself just before returning can jump back to here instead
+   TailLabel = NOLABEL;
+   
+   if (TailCalls && (NParams <= MAXPARAMS)) {
+      for (i = 0; (i < NParams) && (LookUpLocalSymbol(Params[i]) != NULL); i++) {
+         TailParams[i] = *LookUpLocalSymbol(Params[i]);
+      }
+      
+      if (i == NParams) {
+         TailLabel = AllocLabel('T');
+         TailDepth = autoSize;
+         EmitLabel(TailLabel);
+      }
+   }
+
+   // A body that's only 'return e;' or 'e;' may be expanded at each call as well
+   Capturing = Inlining && noLocals && (NParams <= MAXPARAMS) && ((tok->token == TRETURN) || (tok->token == TID));
+   Captured = NULL;
+
+   // Function's executable code
+   while (tok->token != TCBRACE) {
+      ParseStatement(lex, tok, fn, returnLabel, NOLABEL, NOLABEL);
+      nStatements++;
+   }
+   
+   GetToken(lex, tok);
+   
+   if ((nStatements == 1) && (Captured != NULL)) {
+      AddInline(fn, Captured, isInline);
+   }
+   else {
+      FreeTree(Captured);
+   }
+   
+   Capturing = false;
+   Captured = NULL;
+   
+   // Function exit sequence
+   EmitFunctionExit(returnLabel, nRegister);
+   
+   for (i = 0; i < NextStr; i++) {
+      EmitStaticCharArray(&Strings[i], "<anon>");
+   }
+   
+   for (i = 0; i < NextStatic; i++) {
+      EmitExternScalar(&Statics[i], 0, 0.0);
+   }
+   
+   NextStr = 0;
+   NextStatic = 0;
+   ForgetLocalSymbols();
+}
+
+
+/* AddInline --- keep the body of a function to expand at each call, if it's small enough */
+
+void AddInline(const struct Symbol *const fn, struct ExprNode *body, const bool isInline)
+{
+   struct InlineFunction *in = &Inlines[NInlines];
+   
+   // Unless asked, only expand a leaf function whose code is no bigger than a call
+   if ((NInlines == MAXINLINES) || (CountNodes(body) > (isInline ? MAXINLINE : LEAFINLINE)) ||
+       ((isInline == false) && HasCall(body)) || (MakeParams(body) == false)) {
+      FreeTree(body);
+      return;
+   }
+   
+   in->atom = fn->atom;
+   in->nParams = NParams;
+   in->body = body;
+   NInlines++;
+}
+
+
+/* MakeParams --- put an N_PARAM in place of each use of a parameter, or return false if one is changed */
+
+bool MakeParams(struct ExprNode *e)
+{
+   int i;
+   
+   if (e == NULL) {
+      return (true);
+   }
+   
+   switch (e->kind) {
+   case N_VAR:
+      // With no local variables, anything that isn't static or extern is a parameter
+      if ((e->sym->storageClass == SCAUTO) || (e->sym->storageClass == SCREGISTER)) {
+         for (i = 0; (i < NParams) && (Params[i] != e->sym->atom); i++)
+            ;
+         
+         if ((i == NParams) || ((e->pLevel == 0) && (e->type != T_CHAR) && (e->type != T_UCHAR) &&
+                                (e->type != T_INT) && (e->type != T_UINT))) {
+            return (false);
+         }
+         
+         e->kind = N_PARAM;
+         e->value = i;
+         e->sym = NULL;
+      }
+      break;
+   case N_ADDR:
+   case N_ASSIGN:
+   case N_PREINC:
+   case N_PREDEC:
+   case N_POSTINC:
+   case N_POSTDEC:
+      if ((e->left->kind == N_VAR) && ((e->left->sym->storageClass == SCAUTO) || (e->left->sym->storageClass == SCREGISTER))) {
+         return (false);
+      }
+      break;
+   }
+   
+   return (MakeParams(e->left) && MakeParams(e->right) && MakeParams(e->third));
+}
+
+
+/* ExpandInline --- return the body of a function in place of a call to it, or NULL if that can't be done */
+
+struct ExprNode *ExpandInline(struct ExprNode *call)
+{
+   const struct InlineFunction *in = NULL;
+   struct ExprNode *args[MAXPARAMS];
+   const struct ExprNode *arg;
+   struct ExprNode *e;
+   int i;
+   
+   if ((Inlining == false) || (call->sym == NULL)) {
+      return (NULL);
+   }
+   
+   for (i = 0; (i < NInlines) && (in == NULL); i++) {
+      if (Inlines[i].atom == call->sym->atom) {
+         in = &Inlines[i];
+      }
+   }
+   
+   if (in == NULL) {
+      return (NULL);
+   }
+   
+   // The arguments of a call are each evaluated once, before the body,
+   // so only those without side effects can go where the parameters are.
+   // Anything more than a single load mustn't be evaluated twice, and if
+   // the body changes anything, an argument mustn't be read after it does.
+   for (i = 0, arg = call->left; arg != NULL; i++, arg = arg->right) {
+      if ((i == in->nParams) || HasSideEffects(arg->left)) {
+         return (NULL);
+      }
+      
+      if (HasSideEffects(in->body) && (IsUnchangeable(arg->left) == false)) {
+         return (NULL);
+      }
+      
+      if ((CountParam(in->body, i) > 1) && (arg->left->kind != N_CONST) && (arg->left->kind != N_VAR) &&
+          (arg->left->kind != N_ADDR) && (arg->left->kind != N_STRING)) {
+         return (NULL);
+      }
+      
+      args[i] = arg->left;
+   }
+   
+   if (i != in->nParams) {
+      return (NULL);
+   }
+   
+   e = SubstituteParams(in->body, args);
+   
+   // Just like a 'return', the value is converted to the function's type
+   if ((call->type != T_VOID) && ((e->type != call->type) || (e->pLevel != call->pLevel))) {
+      e = NewCast(e, call->type, call->pLevel);
+   }
+   
+   return (e);
+}
+
+
+/* IsUnchangeable --- return true if nothing an inline body does can change the value of an argument */
+
+bool IsUnchangeable(const struct ExprNode *e)
+{
+   switch (e->kind) {
+   case N_CONST:
+   case N_STRING:
+      return (true);
+   case N_ADDR:
+      return (e->sym->storageClass != SCAUTO);        // A fixed address
+   case N_VAR:
+      return (e->sym->storageClass == SCREGISTER);    // No pointer can reach it
+   }
    
-   // Function's local variables
+   return (false);
+}
+
+
+/* ParseLocalDeclarations --- parse the local variable declarations at the start of a block */
+
+int ParseLocalDeclarations(struct LexerContext *lex, struct Token *tok, int autoSize, int *nRegister)
+{
    while ((tok->token == TINT) || (tok->token == TCHAR) ||
           (tok->token == TFLOAT) || (tok->token == TDOUBLE) ||
           (tok->token == TSTATIC) || (tok->token == TAUTO) ||
-          (tok->token == TREGISTER) ||(tok->token == TCONST)) {
+          (tok->token == TREGISTER) || (tok->token == TCONST) ||
+          (tok->token == TUNSIGNED)) {
       struct Symbol sym;
       int type;
       bool isRegister = false;
+      bool isUnsigned;
       
       PrintSyntax("<declaration>");
       
       sym.storageClass = SCAUTO;
-      sym.name[0] = '\0';
+      sym.atom = NOATOM;
+      sym.name = "";
       sym.type = T_INT;
       sym.pLevel = 0;
       sym.label = NOLABEL;
       sym.fpOffset = 0;
+      sym.reg = R_Y;
+      sym.regParams = 0;
       sym.readOnly = false;
       
       if (tok->token == TSTATIC) {           // Accept 'static' storage class
          PrintSyntax("<static>");
-         GetToken(tok);
+         GetToken(lex, tok);
          sym.storageClass = SCSTATIC;
       }
       else if (tok->token == TCONST) {       // Accept 'const' attribute
          PrintSyntax("<const>");
-         GetToken(tok);
+         GetToken(lex, tok);
          sym.readOnly = true;
       }
       else if (tok->token == TAUTO) {        // Ignore 'auto' storage class
          PrintSyntax("<auto>");
-         GetToken(tok);
+         GetToken(lex, tok);
       }
       else if (tok->token == TREGISTER) {    // Accept 'register' storage class
          PrintSyntax("<register>");
-         GetToken(tok);
+         GetToken(lex, tok);
          isRegister = true;
       }
       
-      type = tok->token;   // Yikes, we're assuming that the next token is a valid type!
-      
-      GetToken(tok);
+      type = ParseBaseType(lex, tok, &isUnsigned);
 
       while (tok->token == TSTAR) {
          PrintSyntax("<'*'>");
          sym.pLevel++;
-         GetToken(tok);
+         GetToken(lex, tok);
       }
          
       // Decide whether to accept the 'register' storage class
-      if (isRegister && (sym.storageClass == SCAUTO)) {
-         if (((type == TCHAR) || (type == TINT)) && (nRegister < 1)) {
+      if (isRegister && (sym.storageClass == SCAUTO) && (nRegister != NULL)) {
+         // Only Y: W is left for PromoteLocal(), which can check that nothing overwrites it
+         if (((type == TCHAR) || (type == TINT)) && (*nRegister < 1)) {
             sym.storageClass = SCREGISTER;
-            nRegister++;
+            (*nRegister)++;
          }
       }
       
       if (tok->token == TID) {
-         PrintSyntax("<id:%s>", tok->str);
-         strncpy(sym.name, tok->str, MAXNAME);
+         PrintSyntax("<id:%.*s>", TokenLength(tok), TokenText(lex, tok));
+         sym.atom = TokenAtom(tok);
+         sym.name = AtomName(sym.atom);
 
          if (sym.storageClass == SCSTATIC) {
             sym.label = AllocLabel('S');
@@ -502,10 +1108,10 @@ void ParseFunctionBody(struct Token *tok, const struct Symbol *const fn)
             if (sym.pLevel == 0) {
                switch (type) {
                case TCHAR:
-                  sym.type = T_CHAR;
+                  sym.type = isUnsigned ? T_UCHAR : T_CHAR;
                   break;
                case TINT:
-                  sym.type = T_INT;
+                  sym.type = isUnsigned ? T_UINT : T_INT;
                   break;
                case TFLOAT:
                   sym.type = T_FLOAT;
@@ -519,16 +1125,25 @@ void ParseFunctionBody(struct Token *tok, const struct Symbol *const fn)
                sym.type = T_INT;
             }
          
-            EmitExternScalar(&sym, 0, 0.0);
+            // At the top of a function, emit it now; inside a block, the code has started, so wait for the end
+            if (nRegister != NULL) {
+               EmitExternScalar(&sym, 0, 0.0);
+            }
+            else if (NextStatic < MAXSTATICS) {
+               Statics[NextStatic++] = sym;
+            }
+            else {
+               Error(lex, "Too many 'static' variables in blocks");
+            }
          }
          else if (sym.storageClass == SCREGISTER) {
             if (sym.pLevel == 0) {
                switch (type) {
                case TCHAR:
-                  sym.type = T_CHAR;
+                  sym.type = isUnsigned ? T_UCHAR : T_CHAR;
                   break;
                case TINT:
-                  sym.type = T_INT;
+                  sym.type = isUnsigned ? T_UINT : T_INT;
                   break;
                case TFLOAT:
                   sym.type = T_FLOAT;
@@ -546,11 +1161,11 @@ void ParseFunctionBody(struct Token *tok, const struct Symbol *const fn)
             if (sym.pLevel == 0) {
                switch (type) {
                case TCHAR:
-                  sym.type = T_CHAR;
+                  sym.type = isUnsigned ? T_UCHAR : T_CHAR;
                   autoSize += 1;
                   break;
                case TINT:
-                  sym.type = T_INT;
+                  sym.type = isUnsigned ? T_UINT : T_INT;
                   autoSize += 2;
                   break;
                case TFLOAT:
@@ -572,79 +1187,282 @@ void ParseFunctionBody(struct Token *tok, const struct Symbol *const fn)
          }
       }
       else {
-         Error("Expected identifier in local variable declaration");
+         Error(lex, "Expected identifier in local variable declaration");
       }
       
-      AddLocalSymbol(&sym);
+      if (AddLocalSymbol(&sym) == false) {
+         Error(lex, "Symbol '%s' is already declared in this block", sym.name);
+      }
       
       PrintSyntax("\n");
-      GetToken(tok);
+      GetToken(lex, tok);
       
-      ParseSemi(tok, "in local variable declaration");
-   }
-   
-   // Function entry sequence
-   EmitFunctionEntry(fn->name, autoSize, nRegister);
-
-   // Function's executable code
-   while (tok->token != TCBRACE) {
-      ParseStatement(tok, fn, returnLabel, NOLABEL, NOLABEL);
-   }
-   
-   GetToken(tok);
-   
-   // Function exit sequence
-   EmitFunctionExit(returnLabel, nRegister);
-   
-   for (i = 0; i < NextStr; i++) {
-      EmitStaticCharArray(&Strings[i], "<anon>");
+      ParseSemi(lex, tok, "in local variable declaration");
    }
    
-   NextStr = 0;
-   ForgetLocalSymbols();
+   return (autoSize);
 }
 
 
-/* ParseStatement --- parse a single statement */
+/* PromoteLocal --- put the most heavily used local variable into Y, and return the new frame size */
 
-void ParseStatement(struct Token *tok, const struct Symbol *const fn, const int returnLabel, const int breakLabel, const int continueLabel)
+int PromoteLocal(const struct LexerContext *lex, const struct Token *tok, int autoSize, int *nRegister)
 {
-   PrintSyntax("<statement> ");
+   struct LexerContext scan = *lex;    // Read ahead without disturbing the parser
+   struct Token t = *tok;
+   struct Symbol *locals[MAXPROMOTE];
+   int weight[MAXPROMOTE];
+   bool addressTaken[MAXPROMOTE];
+   int nLocals = 0;
+   struct {
+      int braces;
+      int parens;
+   } loops[MAXLOOPNEST];
+   int nLoops = 0;
+   int braces = 0;
+   int parens = 0;
+   int prev = TNULL;
+   int beforeParen = TNULL;
+   int castParens = -1;
+   bool afterCast = false;
+   bool unaryAnd = false;
+   bool usesQ = false;
+   struct Symbol *sym;
+   int best = -1;
+   int size;
+   int i;
    
-   switch (tok->token) {
-   case TRETURN:
-      ParseReturn(tok, fn, returnLabel);
-      break;
-   case TIF:
-      ParseIf(tok, fn, returnLabel, breakLabel, continueLabel);
+   // Count uses in the body, up to its closing brace. A use inside a
+   // loop counts eight times as much as one in the enclosing code.
+   while ((t.token != TEOF) && (braces >= 0)) {
+      // A type name straight after '(' makes a cast, unless it's 'sizeof (type)'
+      if ((prev == TOPAREN) && (beforeParen != TSIZEOF) && IsTypeToken(t.token))
+         castParens = parens;
+      
+      switch (t.token) {
+      case TOBRACE:
+         braces++;
+         break;
+      case TCBRACE:
+         braces--;
+         // Fall through
+      case TSEMI:
+         // A loop ends with the '}' of its body, or the ';' of a simple
+         // statement, at the same level of nesting as its keyword
+         while ((nLoops > 0) && (loops[nLoops - 1].braces >= braces) && (loops[nLoops - 1].parens == parens))
+            nLoops--;
+         break;
+      case TOPAREN:
+         beforeParen = prev;
+         parens++;
+         break;
+      case TCPAREN:
+         afterCast = (parens == castParens);
+         
+         if (afterCast)
+            castParens = -1;
+         
+         parens--;
+         break;
+      case TFOR:
+      case TWHILE:
+      case TDO:
+         if (nLoops < MAXLOOPNEST) {
+            loops[nLoops].braces = braces;
+            loops[nLoops].parens = parens;
+            nLoops++;
+         }
+         break;
+      case TAND:
+         // '&' is the address-of operator unless it follows an operand,
+         // and a cast's ')' isn't the end of one
+         switch (prev) {
+         case TCPAREN:
+            unaryAnd = afterCast;
+            break;
+         case TID:
+         case TINTLIT:
+         case TFLOATLIT:
+         case TSTRLIT:
+         case TCSQBRK:
+         case TINC:
+         case TDEC:
+            unaryAnd = false;
+            break;
+         default:
+            unaryAnd = true;
+            break;
+         }
+         break;
+      case TFLOATLIT:
+         usesQ = true;
+         break;
+      case TID:
+         if ((sym = LookUpLocalSymbol(TokenAtom(&t))) == NULL)
+            sym = LookUpExternSymbol(TokenAtom(&t));
+         
+         if (sym == NULL)
+            break;
+         
+         // Long and floating-point values are loaded into Q, which overwrites W
+         switch (sym->type) {
+         case T_LONG:
+         case T_ULONG:
+         case T_FLOAT:
+         case T_DOUBLE:
+            usesQ = true;
+            break;
+         }
+         
+         if ((sym->storageClass != SCAUTO) || (sym->fpOffset >= 0))
+            break;
+         
+         for (i = 0; (i < nLocals) && (locals[i] != sym); i++)
+            ;
+         
+         if (i == nLocals) {
+            if (nLocals == MAXPROMOTE)
+               break;
+            
+            locals[i] = sym;
+            weight[i] = 0;
+            addressTaken[i] = false;
+            nLocals++;
+         }
+         
+         weight[i] += 1 << (3 * ((nLoops < 3) ? nLoops : 3));
+         
+         if ((prev == TAND) && unaryAnd)
+            addressTaken[i] = true;
+         
+         break;
+      default:
+         break;
+      }
+      
+      prev = t.token;
+      GetToken(&scan, &t);
+   }
+   
+   // Y and W hold 16 bits, and are only worth saving and restoring
+   // for a variable used in a loop. Only Y can be used as a pointer.
+   while (*nRegister < NRegisters) {
+      const int reg = (*nRegister == 0) ? R_Y : R_W;
+      
+      best = -1;
+      
+      for (i = 0; i < nLocals; i++) {
+         if ((locals[i]->storageClass != SCAUTO) || addressTaken[i] || (weight[i] < 8))
+            continue;
+         
+         if ((reg == R_W) && ((locals[i]->pLevel > 0) || usesQ))
+            continue;
+         
+         switch (locals[i]->type) {
+         case T_CHAR:
+         case T_UCHAR:
+         case T_INT:
+         case T_UINT:
+            if ((best < 0) || (weight[i] > weight[best]))
+               best = i;
+            break;
+         }
+      }
+      
+      if (best < 0)
+         break;
+      
+      sym = locals[best];
+      size = ((sym->type == T_CHAR) || (sym->type == T_UCHAR)) ? 1 : 2;
+      
+      // Close up the gap in the frame, including any locals past the
+      // ones counted here
+      CloseUpLocalSymbols(sym->fpOffset, size);
+      
+      sym->storageClass = SCREGISTER;
+      sym->reg = reg;
+      sym->fpOffset = 0;
+      autoSize -= size;
+      (*nRegister)++;
+   }
+   
+   // A caller may have a variable in W, so a function that loads Q
+   // has to save it, along with Y, as if it had one of its own
+   if (usesQ && (NRegisters > 1))
+      *nRegister = NRegisters;
+   
+   return (autoSize);
+}
+
+
+/* NamedInBody --- return true if an identifier appears anywhere in the body of a function */
+
+bool NamedInBody(const struct LexerContext *lex, const struct Token *tok, const int atom)
+{
+   struct LexerContext scan = *lex;    // Read ahead without disturbing the parser
+   struct Token t = *tok;
+   int braces = 0;
+   
+   while ((t.token != TEOF) && (braces >= 0)) {
+      if ((t.token == TID) && (TokenAtom(&t) == atom))
+         return (true);
+      else if (t.token == TOBRACE)
+         braces++;
+      else if (t.token == TCBRACE)
+         braces--;
+      
+      GetToken(&scan, &t);
+   }
+   
+   return (false);
+}
+
+
+/* ParseStatement --- parse a single statement */
+
+void ParseStatement(struct LexerContext *lex, struct Token *tok, const struct Symbol *const fn, const int returnLabel, const int breakLabel, const int continueLabel)
+{
+   PrintSyntax("<statement> ");
+   
+   switch (tok->token) {
+   case TRETURN:
+      ParseReturn(lex, tok, fn, returnLabel);
+      break;
+   case TIF:
+      ParseIf(lex, tok, fn, returnLabel, breakLabel, continueLabel);
       break;
    case TDO:
-      ParseDo(tok, fn, returnLabel);
+      ParseDo(lex, tok, fn, returnLabel);
       break;
    case TFOR:
-      ParseFor(tok, fn, returnLabel);
+      ParseFor(lex, tok, fn, returnLabel);
       break;
    case TWHILE:
-      ParseWhile(tok, fn, returnLabel);
+      ParseWhile(lex, tok, fn, returnLabel);
       break;
    case TGOTO:
-      ParseGoto(tok);
+      ParseGoto(lex, tok);
       break;
    case TCONTINUE:
-      ParseContinue(tok, continueLabel);
+      ParseContinue(lex, tok, continueLabel);
       break;
    case TBREAK:
-      ParseBreak(tok, breakLabel);
+      ParseBreak(lex, tok, breakLabel);
       break;
    case TSWITCH:
-      ParseSwitch(tok, fn, returnLabel, continueLabel);
+      ParseSwitch(lex, tok, fn, returnLabel, continueLabel);
       break;
    case TOBRACE:
-      ParseCompoundStatement(tok, fn, returnLabel, breakLabel, continueLabel);
+      ParseCompoundStatement(lex, tok, fn, returnLabel, breakLabel, continueLabel);
+      break;
+   case TCPAREN:
+      // An expression would stop here without using it up, so skip it
+      Error(lex, "Unexpected ')'");
+      GetToken(lex, tok);
       break;
    default:
-      ParseExpression(tok);
-      ParseSemi(tok, "after expression");
+      ParseExpression(lex, tok, false);
+      ParseSemi(lex, tok, "after expression");
       break;
    }
 }
@@ -652,74 +1470,154 @@ void ParseStatement(struct Token *tok, const struct Symbol *const fn, const int
 
 /* ParseReturn --- parse a 'return' statement */
 
-void ParseReturn(struct Token *tok, const struct Symbol *const fn, const int returnLabel)
+void ParseReturn(struct LexerContext *lex, struct Token *tok, const struct Symbol *const fn, const int returnLabel)
 {
    PrintSyntax("<return> ");
-   GetToken(tok);
+   GetToken(lex, tok);
 
    if (tok->token == TSEMI) {
       PrintSyntax("\n");
       
       if (fn->type != T_VOID) {
-         Error("non-void function %s returns no value", fn->name);
+         Error(lex, "non-void function %s returns no value", fn->name);
       }
    }
    else {
-      ParseExpression(tok);
+      const struct Symbol *params[MAXPARAMS];
+      struct ExprNode *e;
+      
+      PrintSyntax("<expression>");
+      
+      e = ParseAssignment(lex, tok);
       
       if (fn->type == T_VOID) {
-         Error("void function %s returns a value", fn->name);
+         Error(lex, "void function %s returns a value", fn->name);
+      }
+      
+      if (Capturing) {
+         Captured = CopyTree(e);
+         Capturing = false;
+      }
+      
+      // 'return f(...)' inside 'f' passes the new arguments and starts again
+      if (IsTailRecursion(e, fn, params)) {
+         EmitTailRecursion(e, params);
+         
+         if (FrameDepth != TailDepth) {
+            EmitStackDepth(TailDepth, "Deallocate block's local variables");
+         }
+         
+         EmitJump(TailLabel, "tail call");
+         FreeTree(e);
+         ParseSemi(lex, tok, "at end of 'return'");
+         return;
       }
+      
+      EmitExpression(e, true);
+      FreeTree(e);
+      
+      PrintSyntax("\n");
    }
    
    EmitJump(returnLabel, "return");
 
-   ParseSemi(tok, "at end of 'return'");
+   ParseSemi(lex, tok, "at end of 'return'");
+}
+
+
+/* IsTailRecursion --- return true if an expression is a call that the current function can make by jumping to its start */
+
+bool IsTailRecursion(const struct ExprNode *e, const struct Symbol *const fn, const struct Symbol *params[])
+{
+   const struct ExprNode *arg = e->left;
+   const struct Symbol *param;
+   int i;
+   
+   if ((TailLabel == NOLABEL) || (e->kind != N_CALL) || (e->sym == NULL) || (e->sym->atom != fn->atom)) {
+      return (false);
+   }
+   
+   // Each argument has to replace a parameter that's a word on the stack, or in a register
+   for (i = 0; (i < NParams) && (arg != NULL); i++, arg = arg->right) {
+      param = &TailParams[i];
+      
+      if ((param->pLevel == 0) && (param->type != T_CHAR) && (param->type != T_UCHAR) &&
+          (param->type != T_INT) && (param->type != T_UINT)) {
+         return (false);
+      }
+      
+      // A '__fastcall' parameter that's never used has nowhere to go
+      if ((i < fn->regParams) && (param->storageClass == SCAUTO) && (param->fpOffset == 0)) {
+         params[i] = NULL;
+      }
+      else {
+         params[i] = param;
+      }
+   }
+   
+   return ((i == NParams) && (arg == NULL));
 }
 
 
 /* ParseCompoundStatement --- parse a compound statement */
 
-void ParseCompoundStatement(struct Token *tok, const struct Symbol *const fn, const int returnLabel, const int breakLabel, const int continueLabel)
+void ParseCompoundStatement(struct LexerContext *lex, struct Token *tok, const struct Symbol *const fn, const int returnLabel, const int breakLabel, const int continueLabel)
 {
+   const int outerDepth = FrameDepth;
+   
    PrintSyntax("<compound_statement>\n");
 
-   GetToken(tok);
+   GetToken(lex, tok);
+   
+   EnterScope();
+   
+   // Block's own variables go below those of the enclosing blocks
+   FrameDepth = ParseLocalDeclarations(lex, tok, outerDepth, NULL);
+   
+   if (FrameDepth != outerDepth) {
+      EmitStackDepth(FrameDepth, "Allocate block's local variables");
+   }
    
    while (tok->token != TCBRACE) {
-      ParseStatement(tok, fn, returnLabel, breakLabel, continueLabel);
+      ParseStatement(lex, tok, fn, returnLabel, breakLabel, continueLabel);
+   }
+   
+   if (FrameDepth != outerDepth) {
+      EmitStackDepth(outerDepth, "Deallocate block's local variables");
    }
+   
+   FrameDepth = outerDepth;
+   
+   LeaveScope();
 
-   GetToken(tok); /* Skip the closing curly bracket */
+   GetToken(lex, tok); /* Skip the closing curly bracket */
 }
 
 
 /* ParseIf --- parse an 'if' statement */
 
-void ParseIf(struct Token *tok, const struct Symbol *const fn, const int returnLabel, const int breakLabel, const int continueLabel)
+void ParseIf(struct LexerContext *lex, struct Token *tok, const struct Symbol *const fn, const int returnLabel, const int breakLabel, const int continueLabel)
 {
    const int elseLabel = AllocLabel('E');
    
    PrintSyntax("<if> ");
-   GetToken(tok);
+   GetToken(lex, tok);
    
    if (tok->token == TOPAREN) {
-      GetToken(tok);
-      ParseExpression(tok);
+      GetToken(lex, tok);
+      ParseCondition(lex, tok, elseLabel, false, "if");
       
       if (tok->token == TCPAREN) {
-         EmitCompareIntConstant(0, "if: test");
-         EmitBranchIfEqual(elseLabel, "if: branch");
-         GetToken(tok);
-         ParseStatement(tok, fn, returnLabel, breakLabel, continueLabel);
+         GetToken(lex, tok);
+         ParseStatement(lex, tok, fn, returnLabel, breakLabel, continueLabel);
          
          if (tok->token == TELSE) {
             const int endifLabel = AllocLabel('I');
 
-            GetToken(tok);
+            GetToken(lex, tok);
             EmitJump(endifLabel, "if: jump to endif");
             EmitLabel(elseLabel);
-            ParseStatement(tok, fn, returnLabel, breakLabel, continueLabel);
+            ParseStatement(lex, tok, fn, returnLabel, breakLabel, continueLabel);
             EmitLabel(endifLabel);
          }
          else {
@@ -727,147 +1625,568 @@ void ParseIf(struct Token *tok, const struct Symbol *const fn, const int returnL
          }
       }
       else {
-         Error("Expected ')' after <expression> in 'if'");
+         Error(lex, "Expected ')' after <expression> in 'if'");
       }
    }
    else {
-      Error("Expected '(' after 'if'");
+      Error(lex, "Expected '(' after 'if'");
    }
 }
 
 
-/* ParseExpression --- parse a single expression */
+/* ParseExpression --- parse an expression and generate code for it, returning the type of its value */
 
-void ParseExpression(struct Token *tok)
+int ParseExpression(struct LexerContext *lex, struct Token *tok, const bool needValue)
 {
+   struct ExprNode *e;
+   int type;
+   
    PrintSyntax("<expression>");
    
-   if (tok->token == TOPAREN) {
-      PrintSyntax("(");
-      GetToken(tok);
-      ParseExpression(tok);
-      if (tok->token == TCPAREN) {
-         GetToken(tok);
-         PrintSyntax(")");
+   // May be empty, as in 'for (;;)' or a null statement
+   if ((tok->token == TSEMI) || (tok->token == TCPAREN)) {
+      return (T_VOID);
+   }
+   
+   e = ParseAssignment(lex, tok);
+   type = (e->pLevel > 0) ? T_UINT : e->type;
+   
+   if (Capturing) {
+      Captured = CopyTree(e);
+      Capturing = false;
+   }
+   
+   EmitExpression(e, needValue);
+   FreeTree(e);
+   
+   PrintSyntax("\n");
+   
+   return (type);
+}
+
+
+/* ParseAssignment --- parse an assignment expression and return its tree */
+
+struct ExprNode *ParseAssignment(struct LexerContext *lex, struct Token *tok)
+{
+   // Each assignment operator, and the operator that it applies
+   static const struct {
+      int token;
+      int kind;
+   } assignOps[] = {
+      {TASSIGN, N_ASSIGN},
+      {TPLUSAB, N_ADD},
+      {TMINUSAB, N_SUB},
+      {TTIMESAB, N_MUL},
+      {TDIVAB, N_DIV},
+      {TMODAB, N_MOD},
+      {TANDAB, N_AND},
+      {TORAB, N_OR},
+      {TEXORAB, N_XOR},
+      {TLSHTAB, N_LSHIFT},
+      {TRSHTAB, N_RSHIFT}
+   };
+   const int nOps = sizeof (assignOps) / sizeof (assignOps[0]);
+   struct ExprNode *left = ParseTernary(lex, tok);
+   struct ExprNode *right;
+   int i;
+   
+   for (i = 0; (i < nOps) && (assignOps[i].token != tok->token); i++)
+      ;
+   
+   if (i == nOps) {
+      return (left);
+   }
+   
+   PrintSyntax("<assignment>");
+   GetToken(lex, tok);
+   
+   right = ParseAssignment(lex, tok);    // Assignment groups right-to-left
+   
+   if (CheckLvalue(lex, left, "Assignment to", true) == false) {
+      FreeTree(right);
+      return (left);
+   }
+   
+   // 'a += b' is 'a = a + b', so 'a' mustn't change anything
+   if (assignOps[i].kind != N_ASSIGN) {
+      if (HasSideEffects(left)) {
+         Error(lex, "Compound assignment to an expression with side effects");
       }
-      else {
-         Error("Expected ')' after expression");
+      
+      right = NewNode(assignOps[i].kind, CopyTree(left), right);
+   }
+   
+   return (NewNode(N_ASSIGN, left, right));
+}
+
+
+/* ParseTernary --- parse a conditional expression, 'a ? b : c', or anything that binds more tightly */
+
+struct ExprNode *ParseTernary(struct LexerContext *lex, struct Token *tok)
+{
+   struct ExprNode *cond = ParseBinary(lex, tok, 1);
+   struct ExprNode *ifTrue;
+   
+   if (tok->token != TQUEST) {
+      return (cond);
+   }
+   
+   PrintSyntax("<?:>");
+   GetToken(lex, tok);
+   
+   ifTrue = ParseAssignment(lex, tok);
+   
+   if (tok->token == TCOLON) {
+      GetToken(lex, tok);
+   }
+   else {
+      Error(lex, "Expected ':' in conditional expression");
+   }
+   
+   return (NewConditional(cond, ifTrue, ParseTernary(lex, tok)));
+}
+
+
+/* ParseBinary --- parse binary operators of at least a given precedence, by precedence climbing */
+
+struct ExprNode *ParseBinary(struct LexerContext *lex, struct Token *tok, const int minPrec)
+{
+   struct ExprNode *left = ParseUnary(lex, tok);
+   int i;
+   
+   for (;;) {
+      for (i = 0; (i < NBINARYOPS) && (BinaryOps[i].token != tok->token); i++)
+         ;
+      
+      if ((i == NBINARYOPS) || (BinaryOps[i].prec < minPrec)) {
+         return (left);
       }
+      
+      PrintSyntax("<binop>");
+      GetToken(lex, tok);
+      
+      // Operators of the same precedence group left-to-right
+      left = NewNode(BinaryOps[i].kind, left, ParseBinary(lex, tok, BinaryOps[i].prec + 1));
    }
-   else if (tok->token == TINTLIT) {
-      LoadIntConstant(tok->iValue, 'D', tok->str);
-      GetToken(tok);
+}
+
+
+/* ParseUnary --- parse a unary expression */
+
+struct ExprNode *ParseUnary(struct LexerContext *lex, struct Token *tok)
+{
+   struct ExprNode *e;
+   int kind;
+   
+   switch (tok->token) {
+   case TMINUS:
+      kind = N_NEG;
+      break;
+   case TNOT:
+      kind = N_COM;
+      break;
+   case TLOGNOT:
+      kind = N_NOT;
+      break;
+   case TPLUS:
+      PrintSyntax("<unary>");
+      GetToken(lex, tok);
+      return (ParseUnary(lex, tok));
+   case TINC:
+   case TDEC:
+      kind = (tok->token == TINC) ? N_PREINC : N_PREDEC;
+      PrintSyntax("<unary>");
+      GetToken(lex, tok);
+      e = ParseUnary(lex, tok);
+      
+      if (CheckLvalue(lex, e, "inc/dec", false)) {
+         e = NewNode(kind, e, NULL);
+      }
+      
+      return (e);
+   case TSTAR:
+      PrintSyntax("<unary>");
+      GetToken(lex, tok);
+      e = ParseUnary(lex, tok);
+      
+      if (e->pLevel == 0) {
+         Error(lex, "Indirection through something that isn't a pointer");
+         return (e);
+      }
+      
+      return (NewNode(N_DEREF, e, NULL));
+   case TAND:
+      PrintSyntax("<unary>");
+      GetToken(lex, tok);
+      e = ParseUnary(lex, tok);
+      
+      if (e->kind != N_VAR) {
+         Error(lex, "Address of something that isn't a variable");
+      }
+      else if (e->sym->storageClass == SCREGISTER) {
+         Error(lex, "Address of register variable %s", e->sym->name);
+      }
+      else {
+         e = NewNode(N_ADDR, e, NULL);
+      }
+      
+      return (e);
+   case TSIZEOF:
+      return (ParseSizeof(lex, tok));
+   default:
+      return (ParsePostfix(lex, tok));
    }
-   else if (tok->token == TID) {
-      struct Symbol tmp;
-      struct Symbol *stp = NULL;
+   
+   PrintSyntax("<unary>");
+   GetToken(lex, tok);
+   
+   return (NewNode(kind, ParseUnary(lex, tok), NULL));
+}
+
+
+/* ParseSizeof --- parse 'sizeof' and return the size as a constant */
+
+struct ExprNode *ParseSizeof(struct LexerContext *lex, struct Token *tok)
+{
+   struct ExprNode *e;
+   int type;
+   int pLevel;
+   
+   PrintSyntax("<sizeof>");
+   GetToken(lex, tok);
+   
+   if (tok->token == TOPAREN) {
+      GetToken(lex, tok);
       
-      tmp.storageClass = SCEXTERN;
-      strncpy(tmp.name, tok->str, sizeof (tmp.name));
-      tmp.type = T_INT;
-      tmp.pLevel = 0;
-      tmp.label = 0;
-      tmp.fpOffset = 0;
-      tmp.readOnly = false;
+      if (IsTypeToken(tok->token)) {
+         ParseTypeName(lex, tok, &type, &pLevel);
+      }
+      else {
+         e = ParseAssignment(lex, tok);
+         type = e->type;
+         pLevel = e->pLevel;
+         FreeTree(e);
+      }
       
-      if ((stp = LookUpLocalSymbol(tok->str)) == NULL) {
-         stp = LookUpExternSymbol(tok->str);
-         
-         if (stp == NULL) {
-            Error("Undeclared identifier: %s", tok->str);
-         }
+      if (tok->token == TCPAREN) {
+         GetToken(lex, tok);
+      }
+      else {
+         Error(lex, "Expected ')' after 'sizeof'");
       }
+   }
+   else {
+      // No code is generated for the operand
+      e = ParseUnary(lex, tok);
+      type = e->type;
+      pLevel = e->pLevel;
+      FreeTree(e);
+   }
+   
+   return (NewConstant(ObjectSize(type, pLevel), T_UINT));
+}
 
-      GetToken(tok);
 
-      if ((tok->token == TINC) || (tok->token == TDEC)) {
-         if (stp->readOnly) {
-            Error("inc/dec 'const' object %s", stp->name);
-         }
-         else {
-            LoadScalar(stp);
+/* ParsePostfix --- parse a primary expression followed by '++', '--' or a subscript */
 
-            if (tok->token == TINC) {
-               EmitIncScalar(stp, 1);
-            }
-            else if (tok->token == TDEC) {
-               EmitIncScalar(stp, -1);
-            }
+struct ExprNode *ParsePostfix(struct LexerContext *lex, struct Token *tok)
+{
+   struct ExprNode *e = ParsePrimary(lex, tok);
+   struct ExprNode *index;
+   int kind;
+   
+   for (;;) {
+      if ((tok->token == TINC) || (tok->token == TDEC)) {
+         kind = (tok->token == TINC) ? N_POSTINC : N_POSTDEC;
+         PrintSyntax("<postfix>");
+         GetToken(lex, tok);
+         
+         if (CheckLvalue(lex, e, "inc/dec", false)) {
+            e = NewNode(kind, e, NULL);
          }
-
-         GetToken(tok);
       }
-      else if (tok->token == TOPAREN) {
-         int stackedBytes = 0;
+      else if (tok->token == TOSQBRK) {
+         PrintSyntax("[");
+         GetToken(lex, tok);
          
-         GetToken(tok);
-
-         if (tok->token == TCPAREN) {
-            EmitCallFunction(tmp.name, "call function no actual parameters");
-            GetToken(tok);
+         index = ParseAssignment(lex, tok);
+         
+         if (tok->token == TCSQBRK) {
+            PrintSyntax("]");
+            GetToken(lex, tok);
          }
          else {
-            do {
-               ParseExpression(tok);
-               
-               if (tok->token == TCOMMA) {
-                  GetToken(tok);
-               }
-               
-               // TODO: actual parameters other than 2 bytes long
-               Emit("pshs", "d", "<actual parameter>");
-               stackedBytes += 2;
-            } while (tok->token != TCPAREN);
-         
-            EmitCallFunction(tmp.name, "call function with parameters");
-            GetToken(tok);
-            //Error("Expected ')' in function call");
+            Error(lex, "Expected ']' after subscript");
          }
          
-         EmitStackCleanup(stackedBytes);
-      }
-      else if (tok->token == TASSIGN) {
-         GetToken(tok);
-         ParseExpression(tok);
-         if (stp->readOnly) {
-            Error("Assignment to 'const' object %s", stp->name);
+         // 'p[i]' is '*(p + i)'
+         e = NewNode(N_ADD, e, index);
+         
+         if (e->pLevel == 0) {
+            Error(lex, "Subscript of something that isn't a pointer");
          }
          else {
-            StoreScalar(stp);
+            e = NewNode(N_DEREF, e, NULL);
          }
       }
       else {
-         LoadScalar(stp);
+         return (e);
       }
    }
-   else if (tok->token == TSTRLIT) {
-      const int strLit = AllocLabel('S');
+}
+
+
+/* ParsePrimary --- parse a constant, variable, function call or bracketed expression */
+
+struct ExprNode *ParsePrimary(struct LexerContext *lex, struct Token *tok)
+{
+   struct ExprNode *e;
+   struct Symbol *stp;
+   const char *name;
+   int type;
+   int pLevel;
+   int atom;
+   char suffix;
+   
+   switch (tok->token) {
+   case TINTLIT:
+      // Too big for 'int', but fits in 'unsigned int'
+      e = NewConstant(TokenIntValue(tok), (TokenIntValue(tok) > 32767) ? T_UINT : T_INT);
+      e->text = TokenText(lex, tok);
+      e->textLength = TokenLength(tok);
       
-      Strings[NextStr].label = strLit;
-      strncpy(Strings[NextStr].str, tok->str, 256);
-      memcpy(Strings[NextStr].sValue, tok->sValue, tok->sLength);
-      Strings[NextStr].sLength = tok->sLength;
+      GetToken(lex, tok);
+      return (e);
+   case TFLOATLIT:
+      // No floating-point code is generated yet, so keep just the type and the integer part
+      suffix = TokenText(lex, tok)[TokenLength(tok) - 1];
+      e = NewConstant((int)TokenFloatValue(tok), ((suffix == 'f') || (suffix == 'F')) ? T_FLOAT : T_DOUBLE);
+      e->text = TokenText(lex, tok);
+      e->textLength = TokenLength(tok);
+      
+      GetToken(lex, tok);
+      return (e);
+   case TSTRLIT:
+      e = NewString(AllocLabel('S'));
+      e->text = TokenText(lex, tok);
+      e->textLength = TokenLength(tok);
+      
+      Strings[NextStr].label = e->value;
+      Strings[NextStr].str = TokenText(lex, tok);
+      Strings[NextStr].strLength = TokenLength(tok);
+      Strings[NextStr].sValue = TokenStringValue(lex, tok);
+      Strings[NextStr].sLength = TokenStringLength(tok);
       NextStr++;
       
-      LoadLabelAddr(strLit, tok->str);
-      GetToken(tok);
+      GetToken(lex, tok);
+      return (e);
+   case TID:
+      atom = TokenAtom(tok);
+      name = AtomName(atom);
+      
+      if ((stp = LookUpLocalSymbol(atom)) == NULL) {
+         stp = LookUpExternSymbol(atom);
+         
+         if (stp == NULL) {
+            Error(lex, "Undeclared identifier: %s", name);
+         }
+      }
+      
+      GetToken(lex, tok);
+      
+      if (tok->token == TOPAREN) {
+         return (ParseCall(lex, tok, name, stp));
+      }
+      
+      if (stp == NULL) {
+         return (NewConstant(0, T_INT));
+      }
+      
+      return (NewVariable(stp));
+   case TOPAREN:
+      PrintSyntax("(");
+      GetToken(lex, tok);
+      
+      if (IsTypeToken(tok->token)) {
+         PrintSyntax("<cast>");
+         ParseTypeName(lex, tok, &type, &pLevel);
+         
+         if (tok->token == TCPAREN) {
+            GetToken(lex, tok);
+         }
+         else {
+            Error(lex, "Expected ')' after type name in cast");
+         }
+         
+         return (NewCast(ParseUnary(lex, tok), type, pLevel));
+      }
+      
+      e = ParseAssignment(lex, tok);
+      
+      if (tok->token == TCPAREN) {
+         GetToken(lex, tok);
+         PrintSyntax(")");
+      }
+      else {
+         Error(lex, "Expected ')' after expression");
+      }
+      
+      return (e);
+   default:
+      Error(lex, "Expected an expression");
+      
+      // Leave anything that ends a statement or block for the caller
+      if ((tok->token != TSEMI) && (tok->token != TCBRACE) && (tok->token != TEOF)) {
+         GetToken(lex, tok);
+      }
+      
+      return (NewConstant(0, T_INT));
+   }
+}
+
+
+/* ParseCall --- parse the actual parameters of a function call */
+
+struct ExprNode *ParseCall(struct LexerContext *lex, struct Token *tok, const char name[], const struct Symbol *const fn)
+{
+   struct ExprNode *call = NewCall(name, fn);
+   struct ExprNode **next = &call->left;
+   struct ExprNode *inlined;
+   
+   PrintSyntax("<call>");
+   GetToken(lex, tok);
+   
+   while ((tok->token != TCPAREN) && (tok->token != TSEMI) && (tok->token != TEOF)) {
+      *next = NewNode(N_ARG, ParseAssignment(lex, tok), NULL);
+      next = &(*next)->right;
+      
+      if (tok->token == TCOMMA) {
+         GetToken(lex, tok);
+      }
+      else if (tok->token != TCPAREN) {
+         Error(lex, "Expected ',' or ')' in function call");
+         break;
+      }
    }
-   else if (tok->token == TCOMMA) {
+   
+   if (tok->token == TCPAREN) {
+      GetToken(lex, tok);
    }
-   else if (tok->token == TCPAREN) {
+   
+   if ((inlined = ExpandInline(call)) != NULL) {
+      FreeTree(call);
+      return (inlined);
    }
-   else {
-      Emit("nop", "", "<expression>");
-      GetToken(tok);
+   
+   return (call);
+}
+
+
+/* CheckLvalue --- report an error unless an expression is an object that may be changed */
+
+bool CheckLvalue(struct LexerContext *lex, const struct ExprNode *e, const char what[], const bool derefOK)
+{
+   if ((e->kind == N_DEREF) && derefOK) {
+      return (true);
    }
    
-   PrintSyntax("\n");
+   if (e->kind != N_VAR) {
+      Error(lex, "%s something that isn't a variable", what);
+      return (false);
+   }
+   
+   if (e->sym->readOnly) {
+      Error(lex, "%s 'const' object %s", what, e->sym->name);
+      return (false);
+   }
+   
+   return (true);
+}
+
+
+/* IsTypeToken --- return true if a token can start a type name, as in a cast */
+
+bool IsTypeToken(const int token)
+{
+   switch (token) {
+   case TINT:
+   case TCHAR:
+   case TSHORT:
+   case TLONG:
+   case TUNSIGNED:
+   case TFLOAT:
+   case TDOUBLE:
+   case TVOID:
+   case TCONST:
+      return (true);
+   }
+   
+   return (false);
+}
+
+
+/* ParseTypeName --- parse a type name, as in a cast, e.g. 'unsigned char *' */
+
+void ParseTypeName(struct LexerContext *lex, struct Token *tok, int *type, int *pLevel)
+{
+   bool isUnsigned;
+   
+   while (tok->token == TCONST) {
+      GetToken(lex, tok);
+   }
+   
+   switch (ParseBaseType(lex, tok, &isUnsigned)) {
+   case TCHAR:
+      *type = isUnsigned ? T_UCHAR : T_CHAR;
+      break;
+   case TSHORT:
+      *type = isUnsigned ? T_USHORT : T_SHORT;
+      break;
+   case TLONG:
+      *type = isUnsigned ? T_ULONG : T_LONG;
+      break;
+   case TFLOAT:
+      *type = T_FLOAT;
+      break;
+   case TDOUBLE:
+      *type = T_DOUBLE;
+      break;
+   case TVOID:
+      *type = T_VOID;
+      break;
+   default:
+      *type = isUnsigned ? T_UINT : T_INT;
+      break;
+   }
+   
+   for (*pLevel = 0; tok->token == TSTAR; (*pLevel)++) {
+      GetToken(lex, tok);
+   }
+}
+
+
+/* ParseCondition --- parse the test in an 'if' or loop and branch to 'label' if it's 'sense' */
+
+void ParseCondition(struct LexerContext *lex, struct Token *tok, const int label, const bool sense, const char stmt[])
+{
+   struct ExprNode *e = NULL;
+   
+   PrintSyntax("<condition>");
+   
+   // Missing altogether in 'for (;;)', where it's always true
+   if (tok->token != TSEMI) {
+      e = ParseAssignment(lex, tok);
+   }
+   
+   EmitCondition(e, label, sense, stmt);
+   FreeTree(e);
 }
 
 
 /* ParseDo --- parse a 'do' statement */
 
-void ParseDo(struct Token *tok, const struct Symbol *const fn, const int returnLabel)
+void ParseDo(struct LexerContext *lex, struct Token *tok, const struct Symbol *const fn, const int returnLabel)
 {
    const int blabel = AllocLabel('b');
    const int clabel = AllocLabel('c');
@@ -876,35 +2195,32 @@ void ParseDo(struct Token *tok, const struct Symbol *const fn, const int returnL
    PrintSyntax("<do>\n");
    EmitLabel(dlabel);
 
-   GetToken(tok);
-   ParseStatement(tok, fn, returnLabel, blabel, clabel);
+   GetToken(lex, tok);
+   ParseStatement(lex, tok, fn, returnLabel, blabel, clabel);
 
    if (tok->token != TWHILE) {
-      Error("Expected 'while' after 'do'");
+      Error(lex, "Expected 'while' after 'do'");
    }
    else {
       PrintSyntax("<while> ");
-      GetToken(tok);
+      GetToken(lex, tok);
       
       if (tok->token == TOPAREN) {
          EmitLabel(clabel);
       
-         GetToken(tok);
-         ParseExpression(tok);
-         
-         EmitCompareIntConstant(0, "do-while: test");
-         EmitBranchNotEqual(dlabel, "do-while: branch");
+         GetToken(lex, tok);
+         ParseCondition(lex, tok, dlabel, true, "do-while");
 
          if (tok->token == TCPAREN) {
-            GetToken(tok);
-            ParseSemi(tok, "after 'do'-'while'");
+            GetToken(lex, tok);
+            ParseSemi(lex, tok, "after 'do'-'while'");
          }
          else {
-            Error("Expected ')' after 'do'-'while'");
+            Error(lex, "Expected ')' after 'do'-'while'");
          }
       }
       else {
-         Error("Expected '(' after 'do'-'while'");
+         Error(lex, "Expected '(' after 'do'-'while'");
       }
    }
    
@@ -914,90 +2230,98 @@ void ParseDo(struct Token *tok, const struct Symbol *const fn, const int returnL
 
 /* ParseBreak --- parse a 'break' statement and check that it's valid */
 
-void ParseBreak(struct Token *tok, const int breakLabel)
+void ParseBreak(struct LexerContext *lex, struct Token *tok, const int breakLabel)
 {
    PrintSyntax("<break>\n");
-   GetToken(tok);
+   GetToken(lex, tok);
    
    if (breakLabel == NOLABEL) {
-      Error("'break' not inside a loop or 'switch'");
+      Error(lex, "'break' not inside a loop or 'switch'");
    }
    else {
       EmitJump(breakLabel, "break");
    }
    
-   ParseSemi(tok, "after 'break'");
+   ParseSemi(lex, tok, "after 'break'");
 }
 
 
 /* ParseContinue --- parse a 'continue' statement and check that it's valid */
 
-void ParseContinue(struct Token *tok, const int continueLabel)
+void ParseContinue(struct LexerContext *lex, struct Token *tok, const int continueLabel)
 {
    PrintSyntax("<continue>\n");
-   GetToken(tok);
+   GetToken(lex, tok);
    
    if (continueLabel == NOLABEL) {
-      Error("'continue' not inside a loop");
+      Error(lex, "'continue' not inside a loop");
    }
    else {
       EmitJump(continueLabel, "continue");
    }
    
-   ParseSemi(tok, "after 'continue'");
+   ParseSemi(lex, tok, "after 'continue'");
 }
 
 
 /* ParseGoto --- parse and ignore a 'goto' statement */
 
-void ParseGoto(struct Token *tok)
+void ParseGoto(struct LexerContext *lex, struct Token *tok)
 {
    PrintSyntax("<goto>\n");
-   GetToken(tok);
+   GetToken(lex, tok);
    
    if (tok->token == TID) {
-      GetToken(tok); /* Ignore target label */
+      GetToken(lex, tok); /* Ignore target label */
       
-      ParseSemi(tok, "after 'goto'");
+      ParseSemi(lex, tok, "after 'goto'");
    }
    else {
-      Error("Expected label name after 'goto'");
+      Error(lex, "Expected label name after 'goto'");
    }
 }
 
 
 /* ParseWhile --- parse a 'while' statement */
 
-void ParseWhile(struct Token *tok, const struct Symbol *const fn, const int returnLabel)
+void ParseWhile(struct LexerContext *lex, struct Token *tok, const struct Symbol *const fn, const int returnLabel)
 {
    const int blabel = AllocLabel('b');
    const int clabel = AllocLabel('c');
+   const int slabel = AllocLabel('s');
+   int testCode, endTest;
    
    PrintSyntax("<while> ");
-   GetToken(tok);
+   GetToken(lex, tok);
    
    if (tok->token == TOPAREN) {
+      // The test is moved below the statement once that's been parsed,
+      // so that each time round the loop there's one conditional branch
+      EmitJump(clabel, "while: jump to test");
+      
+      testCode = MarkCode();
       EmitLabel(clabel);
 
-      GetToken(tok);
+      GetToken(lex, tok);
       
-      ParseExpression(tok);
+      ParseCondition(lex, tok, slabel, true, "while");
       
-      EmitCompareIntConstant(0, "while: test");
-      EmitBranchIfEqual(blabel, "while: exit");
+      endTest = MarkCode();
 
       if (tok->token == TCPAREN) {
-         GetToken(tok);
+         GetToken(lex, tok);
          
-         ParseStatement(tok, fn, returnLabel, blabel, clabel);
-         EmitJump(clabel, "while: loop");
+         EmitLabel(slabel);
+         ParseStatement(lex, tok, fn, returnLabel, blabel, clabel);
       }
       else {
-         Error("Expected ')' after 'while'");
+         Error(lex, "Expected ')' after 'while'");
       }
+      
+      MoveCode(testCode, endTest);
    }
    else {
-      Error("Expected '(' after 'while'");
+      Error(lex, "Expected '(' after 'while'");
    }
 
    EmitLabel(blabel);
@@ -1006,52 +2330,56 @@ void ParseWhile(struct Token *tok, const struct Symbol *const fn, const int retu
 
 /* ParseFor --- parse a 'for' statement */
 
-void ParseFor(struct Token *tok, const struct Symbol *const fn, const int returnLabel)
+void ParseFor(struct LexerContext *lex, struct Token *tok, const struct Symbol *const fn, const int returnLabel)
 {
    const int blabel = AllocLabel('b');
    const int clabel = AllocLabel('c');
    const int slabel = AllocLabel('s');
    const int tlabel = AllocLabel('t');
+   int testCode, incCode, endInc;
 
    PrintSyntax("<for> ");
-   GetToken(tok);
+   GetToken(lex, tok);
 
    if (tok->token == TOPAREN) {
-      GetToken(tok);
+      GetToken(lex, tok);
+      
+      ParseExpression(lex, tok, false);      // Initialisation
       
-      ParseExpression(tok);      // Initialisation
+      ParseSemi(lex, tok, "in 'for'");
       
-      ParseSemi(tok, "in 'for'");
+      // Test and increment are both moved below the statement, as in 'while'
+      EmitJump(tlabel, "for: jump to test");
       
+      testCode = MarkCode();
       EmitLabel(tlabel);
 
-      ParseExpression(tok);      // Test
-
-      EmitCompareIntConstant(0, "for: test");
-      EmitBranchIfEqual(blabel, "for: exit");
-      EmitJump(slabel, "for: jump to statement");
+      ParseCondition(lex, tok, slabel, true, "for");
 
-      ParseSemi(tok, "in 'for'");
+      ParseSemi(lex, tok, "in 'for'");
 
+      incCode = MarkCode();
       EmitLabel(clabel);
 
-      ParseExpression(tok);      // Increment
-
-      EmitJump(tlabel, "for: jump back to test");
+      ParseExpression(lex, tok, false);      // Increment
+      
+      endInc = MarkCode();
 
       if (tok->token == TCPAREN) {
-         GetToken(tok);
+         GetToken(lex, tok);
          
          EmitLabel(slabel);
-         ParseStatement(tok, fn, returnLabel, blabel, clabel);
-         EmitJump(clabel, "for: loop");
+         ParseStatement(lex, tok, fn, returnLabel, blabel, clabel);
       }
       else {
-         Error("Expected ')' after 'for'");
+         Error(lex, "Expected ')' after 'for'");
       }
+      
+      MoveCode(incCode, endInc);
+      MoveCode(testCode, incCode);
    }
    else {
-      Error("Expected '(' after 'for'");
+      Error(lex, "Expected '(' after 'for'");
    }
 
    EmitLabel(blabel);
@@ -1060,7 +2388,7 @@ void ParseFor(struct Token *tok, const struct Symbol *const fn, const int return
 
 /* ParseSwitch --- parse a 'switch' statement */
 
-void ParseSwitch(struct Token *tok, const struct Symbol *const fn, const int returnLabel, const int continueLabel)
+void ParseSwitch(struct LexerContext *lex, struct Token *tok, const struct Symbol *const fn, const int returnLabel, const int continueLabel)
 {
    const int blabel = AllocLabel('b');
    const int jlabel = AllocLabel('J'); // Label for jump over labelled_compound_statement to compare/branch chain
@@ -1070,55 +2398,65 @@ void ParseSwitch(struct Token *tok, const struct Symbol *const fn, const int ret
    int iType = 0;
    int nCases = 0;
    int i;
-   struct {
-      int match;
-      int label;
-   } cases[MAXCASES];
+   struct SwitchCase cases[MAXCASES];
 
    PrintSyntax("<switch> ");
-   GetToken(tok);
+   GetToken(lex, tok);
 
    if (tok->token == TOPAREN) {
-      GetToken(tok);
+      GetToken(lex, tok);
       
-      ParseExpression(tok);
+      ParseExpression(lex, tok, true);
       
       EmitJump(jlabel, "switch: jump to compares");
          
       if (tok->token == TCPAREN) {
-         GetToken(tok);
+         GetToken(lex, tok);
 
          PrintSyntax("<labelled_compound_statement>\n");
 
          if (tok->token == TOBRACE) {
-            GetToken(tok);
+            GetToken(lex, tok);
             
             while (tok->token != TCBRACE) {
                if (tok->token == TCASE) {
-                  GetToken(tok);
+                  GetToken(lex, tok);
 
-                  if (ParseConstIntExpr(tok, &iValue, &iType)) {
+                  if (ParseConstIntExpr(lex, tok, &iValue, &iType)) {
                      PrintSyntax("<case> %d: ", iValue);
-                     cases[nCases].match = iValue;
+                     
+                     for (i = 0; i < nCases; i++) {
+                        if (cases[i].match == iValue) {
+                           Error(lex, "Duplicate 'case %d' in 'switch'", iValue);
+                           break;
+                        }
+                     }
 
                      if (tok->token == TCOLON) {
-                        GetToken(tok);
-                        clabel = AllocLabel('C');  // TODO: check case numbers are unique
-                        cases[nCases].label = clabel;
-                        nCases++;
+                        GetToken(lex, tok);
+                        clabel = AllocLabel('C');
                         EmitLabel(clabel);
+                        
+                        if (nCases >= MAXCASES) {
+                           Error(lex, "More than %d 'case' labels in 'switch'", MAXCASES);
+                        }
+                        else if (i == nCases) {
+                           cases[nCases].match = iValue;
+                           cases[nCases].label = clabel;
+                           nCases++;
+                        }
                      }
                      else {
-                        Error("Expected ':' after 'case'");
+                        Error(lex, "Expected ':' after 'case'");
                      }
                   }
                   else {
-                     Error("Expected integer constant after 'case'");
+                     Error(lex, "Expected integer constant after 'case'");
                   }
                }
                else if (tok->token == TDEFAULT) {
                   PrintSyntax("<default> ");
-                  GetToken(tok);
+                  GetToken(lex, tok);
                   
                   if (tok->token == TCOLON) {
                      if (dlabel == blabel) {
@@ -1126,46 +2464,39 @@ void ParseSwitch(struct Token *tok, const struct Symbol *const fn, const int ret
                         EmitLabel(dlabel);
                      }
                      else {
-                        Error("Multiple 'default:' labels in 'switch'");
+                        Error(lex, "Multiple 'default:' labels in 'switch'");
                      }
                      
-                     GetToken(tok);
+                     GetToken(lex, tok);
                   }
                   else {
-                     Error("Expected ':' after 'default'");
+                     Error(lex, "Expected ':' after 'default'");
                   }
                }
                else {
-                  ParseStatement(tok, fn, returnLabel, blabel, continueLabel);
+                  ParseStatement(lex, tok, fn, returnLabel, blabel, continueLabel);
                }
             }
 
-            GetToken(tok); /* Skip the closing curly bracket */
+            GetToken(lex, tok); /* Skip the closing curly bracket */
          }
          else {
-            Error("Expected '{' after 'switch'");
+            Error(lex, "Expected '{' after 'switch'");
          }
       }
       else {
-         Error("Expected ')' after 'switch'");
+         Error(lex, "Expected ')' after 'switch'");
       }
    }
    else {
-      Error("Expected '(' after 'switch'");
+      Error(lex, "Expected '(' after 'switch'");
    }
 
    EmitJump(blabel, "switch: jump over compares");
 
    EmitLabel(jlabel);
-
-   for (i = 0; i < nCases; i++) {
-      EmitCompareIntConstant(cases[i].match, "switch: compare");
-      EmitBranchIfEqual(cases[i].label, "switch: branch to code");
-   }
    
-   if (dlabel != blabel) {
-      EmitJump(dlabel, "switch: default");
-   }
+   EmitSwitch(cases, nCases, dlabel, blabel);
    
    EmitLabel(blabel);
 }
@@ -1173,74 +2504,36 @@ void ParseSwitch(struct Token *tok, const struct Symbol *const fn, const int ret
 
 /* ParseSemi --- parse a semicolon */
 
-void ParseSemi(struct Token *tok, const char location[])
+void ParseSemi(struct LexerContext *lex, struct Token *tok, const char location[])
 {
    if (tok->token == TSEMI) {
-      GetToken(tok);
+      GetToken(lex, tok);
    }
    else {
-      Error("Missing semicolon %s", location);
+      Error(lex, "Missing semicolon %s", location);
    }
 }
 
 
 /* ParseConstIntExpr --- parse a constant integer expression, e.g. after a 'case' */
 
-bool ParseConstIntExpr(struct Token *tok, int *value, int *type)
+bool ParseConstIntExpr(struct LexerContext *lex, struct Token *tok, int *value, int *type)
 {
-   bool ret = true;
+   struct ExprNode *e;
+   bool ret = false;
    
    PrintSyntax("<const_int_expr>");
    
-   if (tok->token == TOPAREN) {
-      GetToken(tok);
-      ret = ParseConstIntExpr(tok, value, type);
-      if (tok->token == TCPAREN) {
-         GetToken(tok);
-      }
-      else {
-         Error("Expected ')' in constant expression");
-         ret = false;
-      }
-   }
-   else if (tok->token == TINTLIT) {
-      *value = tok->iValue;
+   // Operators on constants are worked out as the tree is built
+   e = ParseTernary(lex, tok);
+   
+   if (e->kind == N_CONST) {
+      *value = e->value;
       *type = TINT;
-      GetToken(tok);
-   }
-   else {
-      ret = false;
-   }
-      
-   if ((tok->token == TPLUS) || (tok->token == TMINUS) ||
-       (tok->token == TSTAR) || (tok->token == TDIV) ||
-       (tok->token == TMOD)) {
-      const int op = tok->token;
-      int rhsValue;
-      int rhsType;
-      
-      PrintSyntax("<binop>");
-      GetToken(tok);
-      ret = ParseConstIntExpr(tok, &rhsValue, &rhsType);
-      switch (op) {
-      case TPLUS:
-         *value += rhsValue;
-         break;
-      case TMINUS:
-         *value -= rhsValue;
-         break;
-      case TSTAR: 
-         *value *= rhsValue;
-         break;
-      case TDIV:
-         *value /= rhsValue;
-         break;
-      case TMOD:
-         *value %= rhsValue;
-         break;
-      }
+      ret = true;
    }
    
+   FreeTree(e);
+   
    return (ret);
 }
-
@@ -0,0 +1,118 @@
+/* symbench --- benchmark the symbol table routines         2026-10-17 */
+/* Copyright (c) 2022 John Honniball. All rights reserved              */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "symtab.h"
+#include "atom.h"
+
+#define DEFSYMS     (4000)
+#define DEFLOOKUPS  (4000000L)
+#define NAMELEN     (32)
+
+
+/* elapsed --- return the number of seconds since 'start' */
+
+static double elapsed(const struct timespec *start)
+{
+   struct timespec now;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+
+   return ((now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9);
+}
+
+
+int main(const int argc, const char *argv[])
+{
+   const int nSyms = (argc > 1) ? atoi(argv[1]) : DEFSYMS;
+   const long int nLookUps = (argc > 2) ? atol(argv[2]) : DEFLOOKUPS;
+   struct Symbol sym;
+   char (*names)[NAMELEN];
+   int *lens;
+   struct timespec start;
+   double secs;
+   long int i;
+   long int nFound = 0L;
+
+   if ((nSyms < 1) || (nLookUps < 1L)) {
+      fprintf(stderr, "Usage: %s [nSymbols] [nLookUps]\n", argv[0]);
+      exit(EXIT_FAILURE);
+   }
+
+   // Names of all the globals, then the same number of undeclared names
+   names = malloc(nSyms * 2 * sizeof (names[0]));
+   lens = malloc(nSyms * 2 * sizeof (lens[0]));
+   
+   if ((names == NULL) || (lens == NULL)) {
+      fprintf(stderr, "%s: can't allocate %d names\n", argv[0], nSyms * 2);
+      exit(EXIT_FAILURE);
+   }
+
+   for (i = 0; i < nSyms; i++) {
+      lens[i] = snprintf(names[i], NAMELEN, "global%ld", i);
+      lens[nSyms + i] = snprintf(names[nSyms + i], NAMELEN, "local%ld", i);
+   }
+
+   AtomInit();
+   SymTabInit();
+
+   sym.storageClass = SCEXTERN;
+   sym.type = T_INT;
+   sym.pLevel = 0;
+   sym.label = 0;
+   sym.fpOffset = 0;
+   sym.reg = R_Y;
+   sym.regParams = 0;
+   sym.readOnly = false;
+
+   clock_gettime(CLOCK_MONOTONIC, &start);
+
+   for (i = 0; i < nSyms; i++) {
+      sym.atom = Intern(names[i], lens[i]);
+      sym.name = AtomName(sym.atom);
+
+      if (AddExternSymbol(&sym) == false) {
+         fprintf(stderr, "%s: symbol '%s' rejected\n", argv[0], sym.name);
+         exit(EXIT_FAILURE);
+      }
+   }
+
+   secs = elapsed(&start);
+   printf("%d symbols added in %.3f seconds\n", nSyms, secs);
+
+   clock_gettime(CLOCK_MONOTONIC, &start);
+
+   // Every other look-up misses, as a reference to a local variable
+   // would. Each one interns the name first, just as the lexer does.
+   for (i = 0; i < nLookUps; i++) {
+      const int n = ((i & 1) * nSyms) + ((i * 7919) % nSyms);
+      
+      if (LookUpExternSymbol(Intern(names[n], lens[n])) != NULL)
+         nFound++;
+   }
+
+   secs = elapsed(&start);
+   printf("%ld look-ups (%ld found) in %.3f seconds", nLookUps, nFound, secs);
+
+   if (secs > 0.0) {
+      printf(" (%.0f look-ups/second)", nLookUps / secs);
+   }
+
+   printf("\n");
+
+   if (nFound != (nLookUps + 1) / 2) {
+      fprintf(stderr, "%s: expected %ld symbols to be found\n", argv[0], (nLookUps + 1) / 2);
+      exit(EXIT_FAILURE);
+   }
+
+   free(names);
+   free(lens);
+   SymTabInit();
+   AtomInit();
+
+   return (0);
+}
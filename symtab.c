@@ -3,22 +3,123 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "symtab.h"
+#include "atom.h"
 
-#define MAXSYMS   (256)
+#define MAXSYMS       (256)   // Initial size of local symbol stack
+#define MINATOMSLOTS  (256)   // Initial size of tables indexed by atom
+#define SYMBLOCKSIZE  (256)   // Number of 'extern' symbols allocated at once
 
-static int NextSym = 0;
-static struct Symbol SymTab[MAXSYMS];
-static int NextLocalSym = 0;
-static struct Symbol LocalSymTab[MAXSYMS];
+// Storage for 'extern' symbols. Blocks are never moved, so pointers
+// returned by LookUpExternSymbol() stay valid as the table grows.
+struct SymBlock {
+   struct SymBlock *next;
+   int nUsed;
+   struct Symbol sym[SYMBLOCKSIZE];
+};
 
+// Local symbols are kept on a stack, innermost block on top. Each entry
+// links to the declaration it hides, so the head for an atom is the
+// innermost declaration and leaving a block only has to restore the
+// heads of the entries above its start. Entries move when the stack
+// grows, so pointers from LookUpLocalSymbol() last until the next add.
+struct LocalEntry {
+   struct Symbol sym;
+   int scope;                 // Nesting depth of the block that declared it
+   int next;                  // Older entry with the same atom, or -1
+};
 
-/* SymTabInit --- initialise this module */
+// Per-thread, so that each worker compiling a file has its own symbols
+static _Thread_local struct Symbol **ExternByAtom = NULL;
+static _Thread_local struct SymBlock *SymBlocks = NULL;
+static _Thread_local int *LocalByAtom = NULL;   // Innermost entry, or -1
+static _Thread_local int NAtomSlots = 0;
+static _Thread_local int NextLocalSym = 0;
+static _Thread_local int NLocalSlots = 0;
+static _Thread_local struct LocalEntry *LocalStack = NULL;
+static _Thread_local int ScopeLevel = 0;
+
+
+/* SymTabInit --- initialise this module for a new compilation-unit */
 
 void SymTabInit(void)
 {
+   struct SymBlock *blk;
+   
+   while ((blk = SymBlocks) != NULL) {
+      SymBlocks = blk->next;
+      free(blk);
+   }
+   
+   free(ExternByAtom);
+   free(LocalByAtom);
+   ExternByAtom = NULL;
+   LocalByAtom = NULL;
+   NAtomSlots = 0;
+   NextLocalSym = 0;
+   ScopeLevel = 0;
+}
+
+
+/* outOfMemory --- report failure to allocate space for a symbol and give up */
+
+static void outOfMemory(const struct Symbol *const sym)
+{
+   fprintf(stderr, "Out of memory for symbol '%s'\n", sym->name);
+   exit(EXIT_FAILURE);
+}
+
+
+/* growAtomTabs --- make sure the tables indexed by atom have room for 'atom' */
+
+static void growAtomTabs(const struct Symbol *const sym)
+{
+   struct Symbol **ext;
+   int *loc;
+   int n;
+   int i;
+   
+   for (n = (NAtomSlots == 0) ? MINATOMSLOTS : NAtomSlots; n <= sym->atom; n *= 2)
+      ;
+   
+   if ((ext = realloc(ExternByAtom, n * sizeof (struct Symbol *))) == NULL)
+      outOfMemory(sym);
+   
+   ExternByAtom = ext;
+   
+   if ((loc = realloc(LocalByAtom, n * sizeof (int))) == NULL)
+      outOfMemory(sym);
+   
+   LocalByAtom = loc;
+   
+   for (i = NAtomSlots; i < n; i++) {
+      ExternByAtom[i] = NULL;
+      LocalByAtom[i] = -1;
+   }
+   
+   NAtomSlots = n;
+}
+
+
+/* newExternSymbol --- allocate space for one more 'extern' symbol */
+
+static struct Symbol *newExternSymbol(void)
+{
+   struct SymBlock *blk;
+   
+   if ((SymBlocks == NULL) || (SymBlocks->nUsed == SYMBLOCKSIZE)) {
+      if ((blk = malloc(sizeof (struct SymBlock))) == NULL)
+         return (NULL);
+      
+      blk->next = SymBlocks;
+      blk->nUsed = 0;
+      SymBlocks = blk;
+   }
+   
+   return (&SymBlocks->sym[SymBlocks->nUsed++]);
 }
 
 
@@ -26,23 +127,27 @@ void SymTabInit(void)
 
 bool AddExternSymbol(const struct Symbol *const sym)
 {
-   int i;
+   struct Symbol *ext;
    
-   for (i = 0; i < NextSym; i++) {
-      if (strcmp(SymTab[i].name, sym->name) == 0) {
-         return (false);
-      }
+   // Nameless, after a syntax error, so nothing could ever find it
+   if (sym->atom == NOATOM) {
+      return (true);
+   }
+   
+   if (sym->atom >= NAtomSlots) {
+      growAtomTabs(sym);
+   }
+   
+   if (ExternByAtom[sym->atom] != NULL) {
+      return (false);
    }
 
-   SymTab[NextSym].storageClass = sym->storageClass;
-   strncpy(SymTab[NextSym].name, sym->name, MAXNAME);
-   SymTab[NextSym].type = sym->type;
-   SymTab[NextSym].pLevel = sym->pLevel;
-   SymTab[NextSym].label = sym->label;
-   SymTab[NextSym].fpOffset = sym->fpOffset;
-   SymTab[NextSym].readOnly = sym->readOnly;
+   if ((ext = newExternSymbol()) == NULL) {
+      outOfMemory(sym);
+   }
    
-   NextSym++;
+   *ext = *sym;
+   ExternByAtom[sym->atom] = ext;
    
    return (true);
 }
@@ -50,39 +155,56 @@ bool AddExternSymbol(const struct Symbol *const sym)
 
 /* LookUpExternSymbol --- look for a symbol in the table of 'extern's */
 
-struct Symbol *LookUpExternSymbol(const char name[])
+struct Symbol *LookUpExternSymbol(const int atom)
 {
-   int i;
-   
-   for (i = 0; i < NextSym; i++) {
-      if (strcmp(SymTab[i].name, name) == 0) {
-         return (&SymTab[i]);
-      }
+   if ((atom < 0) || (atom >= NAtomSlots)) {
+      return (NULL);
    }
 
-   return (NULL);
+   return (ExternByAtom[atom]);
 }
 
 
-/* AddLocalSymbol --- add a symbol to the table of local variables */
+/* AddLocalSymbol --- add a symbol to the innermost scope of local variables */
 
 bool AddLocalSymbol(const struct Symbol *const sym)
 {
-   int i;
+   struct LocalEntry *ent;
+   int head;
    
-   for (i = 0; i < NextLocalSym; i++) {
-      if (strcmp(LocalSymTab[i].name, sym->name) == 0) {
-         return (false);
+   // Nameless, after a syntax error, so nothing could ever find it
+   if (sym->atom == NOATOM) {
+      return (true);
+   }
+   
+   if (sym->atom >= NAtomSlots) {
+      growAtomTabs(sym);
+   }
+   
+   head = LocalByAtom[sym->atom];
+   
+   if ((head >= 0) && (LocalStack[head].scope == ScopeLevel)) {
+      return (false);
+   }
+   
+   if (NextLocalSym == NLocalSlots) {
+      const int n = (NLocalSlots == 0) ? MAXSYMS : NLocalSlots * 2;
+      
+      if ((ent = realloc(LocalStack, n * sizeof (struct LocalEntry))) == NULL) {
+         outOfMemory(sym);
       }
+      
+      LocalStack = ent;
+      NLocalSlots = n;
    }
+   
+   ent = &LocalStack[NextLocalSym];
 
-   LocalSymTab[NextLocalSym].storageClass = sym->storageClass;
-   strncpy(LocalSymTab[NextLocalSym].name, sym->name, MAXNAME);
-   LocalSymTab[NextLocalSym].type = sym->type;
-   LocalSymTab[NextLocalSym].pLevel = sym->pLevel;
-   LocalSymTab[NextLocalSym].label = sym->label;
-   LocalSymTab[NextLocalSym].fpOffset = sym->fpOffset;
-   LocalSymTab[NextLocalSym].readOnly = sym->readOnly;
+   ent->sym = *sym;
+   ent->scope = ScopeLevel;
+   ent->next = head;
+   
+   LocalByAtom[sym->atom] = NextLocalSym;
    
    NextLocalSym++;
    
@@ -90,19 +212,62 @@ bool AddLocalSymbol(const struct Symbol *const sym)
 }
 
 
-/* LookUpLocalSymbol --- look for a symbol in the table of local variables */
+/* LookUpLocalSymbol --- look for the innermost visible local variable */
+
+struct Symbol *LookUpLocalSymbol(const int atom)
+{
+   if ((atom < 0) || (atom >= NAtomSlots) || (LocalByAtom[atom] < 0)) {
+      return (NULL);
+   }
+
+   return (&LocalStack[LocalByAtom[atom]].sym);
+}
+
+
+/* CountLocalSymbols --- return how many local variables are visible, parameters included */
 
-struct Symbol *LookUpLocalSymbol(const char name[])
+int CountLocalSymbols(void)
+{
+   return (NextLocalSym);
+}
+
+
+/* CloseUpLocalSymbols --- move each automatic local below 'fpOffset' up the frame by 'size' bytes */
+
+void CloseUpLocalSymbols(const int fpOffset, const int size)
 {
    int i;
    
    for (i = 0; i < NextLocalSym; i++) {
-      if (strcmp(LocalSymTab[i].name, name) == 0) {
-         return (&LocalSymTab[i]);
+      if ((LocalStack[i].sym.storageClass == SCAUTO) && (LocalStack[i].sym.fpOffset < fpOffset)) {
+         LocalStack[i].sym.fpOffset += size;
       }
    }
+}
+
+
+/* EnterScope --- start a new block of local variables */
+
+void EnterScope(void)
+{
+   ScopeLevel++;
+}
+
+
+/* LeaveScope --- forget the local variables declared in the innermost block */
 
-   return (NULL);
+void LeaveScope(void)
+{
+   const struct LocalEntry *ent;
+   
+   while ((NextLocalSym > 0) && (LocalStack[NextLocalSym - 1].scope >= ScopeLevel)) {
+      ent = &LocalStack[--NextLocalSym];
+      LocalByAtom[ent->sym.atom] = ent->next;
+   }
+   
+   if (ScopeLevel > 0) {
+      ScopeLevel--;
+   }
 }
 
 
@@ -110,6 +275,6 @@ struct Symbol *LookUpLocalSymbol(const char name[])
 
 void ForgetLocalSymbols(void)
 {
-   NextLocalSym = 0;
+   ScopeLevel = 0;
+   LeaveScope();
 }
-
@@ -1,25 +1,31 @@
 /* symtab --- symbol table routines                         2022-08-27 */
 /* Copyright (c) 2022 John Honniball. All rights reserved              */
 
-#define MAXNAME   (32)
-
 enum eStorageClass {SCAUTO, SCEXTERN, SCREGISTER, SCSTATIC};
 enum eType {T_CHAR, T_UCHAR, T_SHORT, T_USHORT, T_INT, T_UINT,
             T_LONG, T_ULONG, T_FLOAT, T_DOUBLE, T_VOID};
+enum eRegister {R_Y, R_W};
 
 struct Symbol {
    int storageClass;
-   char name[MAXNAME];
+   int atom;               // Interned name
+   const char *name;       // Text of the name, for messages and assembler labels
    int type;
    int pLevel;
    int label;
    int fpOffset;
+   int reg;                // Which register holds an SCREGISTER variable
+   int regParams;          // Leading arguments that a function takes in D and X
    bool readOnly;
 };
 
 void SymTabInit(void);
 bool AddExternSymbol(const struct Symbol *const sym);
-struct Symbol *LookUpExternSymbol(const char name[]);
+struct Symbol *LookUpExternSymbol(const int atom);
 bool AddLocalSymbol(const struct Symbol *const sym);
-struct Symbol *LookUpLocalSymbol(const char name[]);
+struct Symbol *LookUpLocalSymbol(const int atom);
+int CountLocalSymbols(void);
+void CloseUpLocalSymbols(const int fpOffset, const int size);
+void EnterScope(void);
+void LeaveScope(void);
 void ForgetLocalSymbols(void);
@@ -0,0 +1,31 @@
+/* direct --- test globals and statics placed in the direct page    2026-10-17 */
+
+void putchar();
+
+int Count;
+char Flag = 3;
+int Cold = 7;
+
+void Tick(void)
+{
+   static int calls;
+
+   calls++;
+   Count = Count + calls;
+}
+
+
+void main(void)
+{
+   int i;
+
+   for (i = 0; i < 5; i++) {
+      Tick();
+      Flag++;
+   }
+
+   putchar('a' + Count - 15);
+   putchar(Flag + 'b' - 8);
+   putchar(Cold + 'c' - 7);
+   putchar('\n');    // output: abc
+}
@@ -0,0 +1,23 @@
+/* longname --- test identifiers longer than 32 characters   2026-10-17 */
+
+void putchar();
+
+int TheWellermanCameToBringUsSugarAndTea;
+int TheWellermanCameToBringUsSugarAndRum;
+
+void main(void)
+{
+   int soonMayTheWellermanComeToBringUsSugarAndTea;
+   int soonMayTheWellermanComeToBringUsSugarAndRum;
+
+   TheWellermanCameToBringUsSugarAndTea = 't';
+   TheWellermanCameToBringUsSugarAndRum = 'r';
+   soonMayTheWellermanComeToBringUsSugarAndTea = 'T';
+   soonMayTheWellermanComeToBringUsSugarAndRum = 'R';
+
+   putchar(TheWellermanCameToBringUsSugarAndTea);
+   putchar(TheWellermanCameToBringUsSugarAndRum);
+   putchar(soonMayTheWellermanComeToBringUsSugarAndTea);
+   putchar(soonMayTheWellermanComeToBringUsSugarAndRum);
+   putchar('\n');    // output: trTR
+}
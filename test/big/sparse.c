@@ -0,0 +1,60 @@
+/* sparse --- test a 'switch' statement with widely spaced cases  2026-10-17 */
+
+void putchar();
+
+void main(void)
+{
+   int ship;
+   int rum;
+
+   ship = 0;
+   
+   for (rum = 10; rum ; rum--) {
+      switch (ship) {
+      case 0:
+         putchar('a');  // output: a
+         ship--;
+         break;
+      case -1:
+         putchar('b');  // output: b
+         ship = 9;
+         break;
+      case -1000:
+         putchar('!');  // Never reached
+         break;
+      case 9:
+         putchar('c');  // output: c
+         ship = 99;
+         break;
+      case 99:
+         putchar('d');  // output: d
+         ship = 500;
+         break;
+      case 500:
+         putchar('e');  // output: e
+         ship = 4096;
+         break;
+      case 4096:
+         putchar('f');  // output: f
+         ship = 12345;
+         break;
+      case 12345:
+         putchar('g');  // output: g
+         ship = 30000;
+         break;
+      case 30000:
+         putchar('h');  // output: h
+         ship = 32767;
+         break;
+      case 32767:
+         putchar('i');  // output: i
+         ship = 1;
+         break;
+      default:
+         putchar('?');  // output: ?
+         break;
+      }
+      
+      putchar('\n');
+   }
+}
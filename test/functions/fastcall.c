@@ -0,0 +1,53 @@
+/* fastcall --- test functions that take their first arguments in D and X    2026-10-17 */
+
+void putchar();
+
+__fastcall int Add(int a, int b);
+
+__fastcall int Add(int a, int b)
+{
+   return (a + b);
+}
+
+
+__fastcall int Times(char c, int n, int k)
+{
+   int i;
+   int s;
+
+   s = 0;
+
+   for (i = 0; i < n; i++)
+      s = s + k;
+
+   return (s + c);
+}
+
+
+__fastcall void Show(int ch)
+{
+   putchar(ch);
+}
+
+
+__fastcall int Ignore(int a, int b)
+{
+   return (7);
+}
+
+
+void main(void)
+{
+   int x;
+   int *p;
+
+   x = 3;
+   p = &x;
+
+   Show(Add('a', 0));
+   Show(Add(x, 'b' - 3));
+   Show(Add(*p, Add(1, 'b')));
+   Show(Times('d' - 12, 3, 4));
+   Show('a' + Ignore(1, 2) - 2);
+   putchar('\n');    // output: abfdf
+}
@@ -0,0 +1,48 @@
+/* frame --- test parameters and locals addressed without a frame pointer    2026-10-17 */
+
+void putchar();
+
+int Pick(int a, int b, int c)
+{
+   return (b);
+}
+
+
+int Mix(char ch, int n)
+{
+   int x;
+   int y;
+
+   x = n + 1;
+   y = Pick(x, ch, n) + Pick(n, x, y);
+
+   {
+      int z;
+
+      z = y - x;
+
+      if (z > 0) {
+         int w;
+
+         w = z + Pick(ch, z, w);
+         y = w;
+      }
+   }
+
+   return (y + n);
+}
+
+
+void Leaf(void)
+{
+   putchar('c');
+}
+
+
+void main(void)
+{
+   putchar('a' + Mix(0, 0) - 1);
+   putchar(Mix('b', 1) - 99);
+   Leaf();
+   putchar('\n');    // output: abc
+}
@@ -0,0 +1,121 @@
+/* inline --- test small functions expanded in place of their calls    2026-10-17 */
+
+void putchar();
+
+int Count;
+
+int Twice(int n)
+{
+   return (n + n);
+}
+
+
+char Upper(char ch)
+{
+   return (ch - 32);
+}
+
+
+inline int Clamp(int v, int lo, int hi)
+{
+   return ((v < lo) ? lo : ((v > hi) ? hi : v));
+}
+
+
+int Bump(int n)
+{
+   Count = Count + n;
+}
+
+
+int Next(void)
+{
+   Count++;
+   return (Count);
+}
+
+
+inline void Show(int ch)
+{
+   putchar(ch);
+}
+
+
+int AddTen(void)
+{
+   Count = Count + 10;
+   return (1);
+}
+
+
+inline int AfterBump(int a)
+{
+   return (AddTen() + a);
+}
+
+
+int SetCount(int a)
+{
+   return ((Count = 5) + a);
+}
+
+
+int Zero(void)
+{
+   static int n;
+
+   return (n);
+}
+
+
+int AddZero(int a)
+{
+   int b;
+   int c;
+
+   b = a;
+   c = Zero();
+
+   return (c + b);
+}
+
+
+void main(void)
+{
+   int a;
+
+   a = 3;
+
+   putchar('a' + Twice(0));
+   putchar(Twice(a) + 'c' - 6);
+   putchar(Upper('e') + 32);
+   putchar('\n');    // output: ace
+
+   putchar(Clamp(a + 'f', 'a', 'z') - 3);
+   putchar(Clamp(a, 'g', 'z'));
+   putchar(Clamp(Twice(a) + 200, 'a', 'h'));
+   putchar('\n');    // output: fgh
+
+   Count = 0;
+   Bump(2);
+   Bump(a);
+   putchar('0' + Count);
+   putchar('0' + Twice(Next()) - 8);
+   putchar('0' + Count);
+   Show(Twice(a) + 'b' - 6);
+   Show(a + 'a');
+   putchar('\n');    // output: 546bd
+
+   // The argument is read before the body changes it
+   Count = 1;
+   putchar('a' + AfterBump(Count));
+   Count = 1;
+   putchar('a' + SetCount(Count));
+   putchar('a' + AfterBump(a) + SetCount(2));
+   putchar('\n');    // output: cgl
+
+   // A function with a 'static' variable is called, not expanded
+   putchar(AddZero('m'));
+   putchar('n' + Zero());
+   putchar('\n');    // output: mn
+}
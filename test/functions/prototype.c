@@ -0,0 +1,37 @@
+/* prototype --- test locals that reuse a prototype's parameter names  2026-10-17 */
+
+void putchar(int c);
+void PutPair(int c, int n);
+int Sum(int a, int b);
+
+void PutPair(int n, int c)
+{
+   putchar(n);
+   putchar(c);
+}
+
+
+int Sum(int a, int b)
+{
+   return (a + b);
+}
+
+
+void main(void)
+{
+   int c;
+   int n;
+   int a;
+
+   c = 'a';
+   n = 'b';
+   a = 1;
+
+   putchar(c);
+   putchar(n);
+   putchar('\n');    // output: ab
+
+   PutPair(n, c);
+   putchar(Sum(c, a) + a);
+   putchar('\n');    // output: bac
+}
@@ -0,0 +1,30 @@
+/* regw --- test a variable in the 6309's W register kept across calls    2026-10-17 */
+// flags: -6
+
+void putchar();
+
+float Fg;
+
+int Touch(int a)
+{
+   Fg = Fg;
+   return (a);
+}
+
+
+void main(void)
+{
+   int i;
+   int n;
+
+   n = 0;
+
+   for (i = 0; i < 4; i++) {
+      n = n + Touch(1);
+      n++;
+   }
+
+   putchar('0' + n);
+   putchar('0' + i);
+   putchar('\n');    // output: 84
+}
@@ -0,0 +1,69 @@
+/* tailcall --- test calls made just before returning    2026-10-17 */
+
+void putchar();
+
+int Sum(int n, int acc)
+{
+   if (n == 0)
+      return (acc);
+
+   return (Sum(n - 1, acc + n));
+}
+
+
+__fastcall int Count(int n, int acc)
+{
+   if (n == 0)
+      return (acc);
+
+   {
+      int k;
+
+      k = n - 1;
+      return (Count(k, acc + 1));
+   }
+}
+
+
+int Eight(void)
+{
+   return (8);
+}
+
+
+__fastcall int Twice(int a)
+{
+   return (a + a);
+}
+
+
+int Pick(int x)
+{
+   if (x > 100)
+      return (Eight());
+
+   return (Twice(x));
+}
+
+
+__fastcall void Shout(char c)
+{
+   putchar(c);
+}
+
+
+void Hello(char c)
+{
+   Shout(c);
+}
+
+
+void main(void)
+{
+   putchar('0' + Sum(3, 0));
+   putchar('0' + Count(900, 0) / 100);
+   putchar('0' + Pick(2));
+   putchar('0' + Pick(200));
+   Hello('x');
+   putchar('\n');    // output: 6948x
+}
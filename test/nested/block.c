@@ -0,0 +1,54 @@
+/* block --- test local variables declared in nested blocks  2026-10-17 */
+
+void putchar();
+
+void main(void)
+{
+   int ship;
+   int rum;
+
+   ship = 'a';
+
+   {
+      int ship;      // Hides the outer 'ship'
+
+      ship = 'b';
+
+      {
+         int ship;   // Hides both outer ones
+         static int whale;
+
+         ship = 'c';
+         whale = 'w';
+         putchar(ship);
+         putchar(whale);
+      }
+
+      putchar(ship);
+   }
+
+   putchar(ship);
+   putchar('\n');    // output: cwba
+
+   rum = 3;
+   while (rum) {
+      int tea;
+
+      tea = 't';
+      putchar(tea);
+      rum--;
+
+      if (rum) {
+         int sugar;
+
+         sugar = 's';
+         putchar(sugar);
+         continue;   // Leaves the block without deallocating it
+      }
+
+      break;
+   }
+
+   putchar(ship);
+   putchar('\n');    // output: tststa
+}
@@ -0,0 +1,34 @@
+/* continue --- test 'continue' in 'for' and 'while' loops  2026-10-17 */
+
+void putchar();
+
+void main(void)
+{
+   int ship;
+   int rum;
+
+   for (ship = 3; ship ; ship--) {
+      putchar('f');
+      rum = ship;
+      rum--;
+      
+      if (rum)
+         continue;   // Still runs the decrement and the test
+      
+      putchar('!');
+   }
+   
+   rum = 3;
+   
+   while (rum) {
+      rum--;
+      putchar('w');
+      
+      if (rum)
+         continue;   // Still runs the test
+      
+      putchar('.');
+   }
+   
+   putchar('\n');    // output: fff!www.
+}
@@ -0,0 +1,56 @@
+/* expression --- test arithmetic, bitwise and shift operators built as trees    2026-10-17 */
+
+void putchar();
+
+int Ten = 10;
+
+int Three(void)
+{
+   return (3);
+}
+
+
+void main(void)
+{
+   int a;
+   int b;
+   int c;
+   unsigned int u;
+   char ch;
+
+   a = 7;
+   b = 3;
+   c = -20;
+
+   putchar('a' + a - b * 2 - 1);
+   putchar('a' + (a - b) * 2 - 7);
+   putchar('a' + a / b + a % b);
+   putchar('a' + c / b + 9);
+   putchar('a' + c % b + 6);
+   putchar('\n');    // output: abdde
+
+   putchar('a' + (a & 6) + (b | 8) - 15);
+   putchar('a' + (a ^ b));
+   putchar('a' + (1 << b) - 8);
+   putchar('a' + (c >> 2) + 8);
+   putchar('a' + ~a + 10);
+   putchar('a' + -c - 18);
+   putchar('\n');    // output: ceadcc
+
+   u = 40000;
+   putchar('a' + (u > 30000));
+   putchar('a' + (c < a) + (a < c) * 2);
+   putchar('a' + (u >> 14));
+   putchar('a' + u / 10000);
+   putchar('\n');    // output: bbce
+
+   ch = 'x';
+   ch = ch - 20;
+   putchar(ch);
+   putchar(a > b ? 'e' : 'z');
+   putchar('a' + Ten * Three() - Three() * (Ten - 2) - 1);
+   putchar('a' + (a = b + 2) + a - 5);
+   putchar('a' + a++ + ++b - 9);
+   putchar('a' + a + b);
+   putchar('\n');    // output: deffak
+}
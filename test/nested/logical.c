@@ -0,0 +1,78 @@
+/* logical --- test '&&' and '||' in conditions and as values   2026-10-17 */
+
+void putchar();
+
+int Calls;
+
+int Touch(int v)
+{
+   Calls++;
+   return (v);
+}
+
+
+void main(void)
+{
+   int a;
+   int b;
+   int n;
+
+   a = 3;
+   b = 0;
+
+   if (a && b)
+      putchar('!');
+
+   if (a || b)
+      putchar('a');
+
+   if ((a > 2) && (b == 0))
+      putchar('b');
+
+   if ((a < 2) || (b != 0))
+      putchar('!');
+
+   if (!(a && b))
+      putchar('c');
+
+   if (!((a == 3) || b) || (a == 3 && b == 0 && a != b))
+      putchar('d');
+
+   putchar('\n');    // output: abcd
+
+   Calls = 0;
+
+   if (b && Touch(1))
+      putchar('!');
+
+   if (a || Touch(1))
+      putchar('e');
+
+   if (Touch(a) && Touch(b))
+      putchar('!');
+
+   putchar('0' + Calls);
+   putchar('\n');    // output: e2
+
+   n = 0;
+
+   while ((n < 10) && (n != 4))
+      n++;
+
+   putchar('0' + n);
+
+   for (n = 0; (n < 3) || (n == 5); n++)
+      putchar('f');
+
+   putchar('\n');    // output: 4fff
+
+   n = (a && b);
+   putchar('0' + n);
+
+   n = (a || b);
+   putchar('0' + n);
+
+   n = (a && (b || 7)) + (a || 0) + (0 && a);
+   putchar('0' + n);
+   putchar('\n');    // output: 012
+}
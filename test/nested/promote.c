@@ -0,0 +1,54 @@
+/* promote --- test automatic promotion of locals into Y        2026-10-17 */
+
+void putchar();
+
+void Show(int *p)
+{
+   putchar(*p);
+}
+
+
+void Cast(void)
+{
+   int x;
+   int k;
+
+   // 'x' is the busiest, but a cast hides where its address is taken
+   for (k = 0; k < 3; k++) {
+      x = 'f' + k;
+      Show((int *)&x);
+      x = x + 1;
+   }
+
+   putchar(x);
+}
+
+
+void main(void)
+{
+   int i;
+   int *p;
+   char c;
+   int n;
+
+   n = 0;
+   p = &i;
+
+   // 'i' is the busiest, but its address is taken, so 'c' gets Y
+   for (i = 0; i < 4; i++) {
+      for (c = 'a'; c < 'e'; c++)
+         putchar(c);
+      
+      *p = *p + 0;
+      n++;
+   }
+
+   putchar('\n');    // output: abcdabcdabcdabcd
+
+   putchar('0' + n);
+   putchar('0' + i);
+   putchar('\n');    // output: 44
+
+   Cast();
+   putchar('\n');    // output: fghi
+}
@@ -0,0 +1,23 @@
+/* promotew --- test promotion of a second local into the 6309's W register    2026-10-17 */
+// flags: -6
+
+void putchar();
+
+void main(void)
+{
+   int i;
+   int j;
+
+   // 'i' and 'j' go in Y and W
+   for (i = 0; i < 3; i++) {
+      for (j = 0; j < 4; j++) {
+         putchar('a' + i + j);
+      }
+   }
+
+   putchar('\n');    // output: abcdbcdecdef
+
+   putchar('0' + i);
+   putchar('0' + j);
+   putchar('\n');    // output: 34
+}
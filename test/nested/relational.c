@@ -0,0 +1,71 @@
+/* relational --- test relational operators in conditions      2026-10-17 */
+
+void putchar();
+
+void main(void)
+{
+   int lo;
+   int hi;
+   unsigned int big;
+   unsigned small;
+
+   lo = 3;
+   hi = 40000;    // Negative when signed
+   big = 40000;
+   small = 3;
+
+   if (lo < 5)
+      putchar('a');
+   
+   if (lo > 5)
+      putchar('!');
+   
+   if (lo <= 3)
+      putchar('b');
+   
+   if (lo >= 4)
+      putchar('!');
+   
+   if (lo == 3)
+      putchar('c');
+   
+   if (lo != 3)
+      putchar('!');
+   
+   putchar('\n');    // output: abc
+   
+   if (hi < lo)
+      putchar('d');
+   
+   if (lo < hi)
+      putchar('!');
+   
+   if (big > small)
+      putchar('e');
+   
+   if (big < small)
+      putchar('!');
+   
+   if (big >= 32768)
+      putchar('f');
+   
+   if (small <= big)
+      putchar('g');
+   
+   putchar('\n');    // output: defg
+   
+   for (lo = 0; lo < 4; lo++)
+      putchar('h');
+   
+   while (lo > 0) {
+      putchar('w');
+      lo--;
+   }
+   
+   do {
+      putchar('d');
+      lo++;
+   } while (lo <= 2);
+   
+   putchar('\n');    // output: hhhhwwwwddd
+}
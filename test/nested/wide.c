@@ -0,0 +1,92 @@
+/* wide --- test promotion in a function with more locals than are counted    2026-10-17 */
+
+void putchar();
+
+int Wide(void)
+{
+   int i;
+   int v1;
+   int v2;
+   int v3;
+   int v4;
+   int v5;
+   int v6;
+   int v7;
+   int v8;
+   int v9;
+   int v10;
+   int v11;
+   int v12;
+   int v13;
+   int v14;
+   int v15;
+   int v16;
+   int v17;
+   int v18;
+   int v19;
+   int v20;
+   int v21;
+   int v22;
+   int v23;
+   int v24;
+   int v25;
+   int v26;
+   int v27;
+   int v28;
+   int v29;
+   int v30;
+   int v31;
+   int v32;
+   int v33;
+   int v34;
+
+   for (i = 0; i < 3; i++)
+      putchar('a' + i);
+
+   v1 = 1;
+   v2 = 2;
+   v3 = 3;
+   v4 = 4;
+   v5 = 5;
+   v6 = 6;
+   v7 = 7;
+   v8 = 8;
+   v9 = 9;
+   v10 = 10;
+   v11 = 11;
+   v12 = 12;
+   v13 = 13;
+   v14 = 14;
+   v15 = 15;
+   v16 = 16;
+   v17 = 17;
+   v18 = 18;
+   v19 = 19;
+   v20 = 20;
+   v21 = 21;
+   v22 = 22;
+   v23 = 23;
+   v24 = 24;
+   v25 = 25;
+   v26 = 26;
+   v27 = 27;
+   v28 = 28;
+   v29 = 29;
+   v30 = 30;
+   v31 = 31;
+   v32 = 32;
+
+   v33 = i;
+   v34 = 'e';
+   putchar('d');
+   putchar(v34);
+   putchar(v33 + 'c');
+   return (v1 + v2 + v32);
+}
+
+
+void main(void)
+{
+   putchar(Wide() + 'g' - 35);
+   putchar('\n');    // output: abcdefg
+}
@@ -15,9 +15,14 @@ def runtest(testClass, name, path):
     
     output = ""
     expectations = 0
+    flags = []
 
     with open(src, "r") as srcFile:
         for line in srcFile:
+            match = FLAGS_EXPECT.match(line)
+            if match:
+                flags += match.group(1).split()
+            
             if line[0:2] != "//":
                 match = OUTPUT_EXPECT.search(line)
                 if match:
@@ -30,7 +35,7 @@ def runtest(testClass, name, path):
     
     #print("Expected output: '" + output + "'", expectations)
     
-    args = ["../parser", src]
+    args = ["../parser"] + flags + [src]
     #print(" ".join(args))
 
     lNum = 0
@@ -58,7 +63,8 @@ def runtest(testClass, name, path):
         
     # check here for a file called 'core'
 
-    args = ["/home/john/bin/asm6809", "--6809", "-H", "-o", hex, "-l", lst, asm]
+    cpu = "--6309" if "-6" in flags else "--6809"
+    args = ["/home/john/bin/asm6809", cpu, "-H", "-o", hex, "-l", lst, asm]
     #print(" ".join(args))
     
     with Popen(args, stderr=PIPE) as assembler:
@@ -98,6 +104,7 @@ def runtest(testClass, name, path):
 
 
 OUTPUT_EXPECT = re.compile(r'// output: ?(.*)')
+FLAGS_EXPECT = re.compile(r'// flags: ?(.*)')
 
 with open("results.html", "w") as html:
     html.write("<HTML>\n")
@@ -0,0 +1,621 @@
+/* tree --- expression trees                                2026-10-17 */
+/* Copyright (c) 2022 John Honniball. All rights reserved              */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "symtab.h"
+#include "tree.h"
+
+
+/* newNode --- allocate an empty node of a given kind */
+
+static struct ExprNode *newNode(const int kind)
+{
+   struct ExprNode *e;
+
+   if ((e = malloc(sizeof (*e))) == NULL) {
+      fprintf(stderr, "Out of memory for expression tree\n");
+      exit(EXIT_FAILURE);
+   }
+
+   e->kind = kind;
+   e->type = T_INT;
+   e->pLevel = 0;
+   e->value = 0;
+   e->text = NULL;
+   e->textLength = 0;
+   e->sym = NULL;
+   e->name = NULL;
+   e->left = NULL;
+   e->right = NULL;
+   e->third = NULL;
+   e->need = 0;
+
+   return (e);
+}
+
+
+/* promote --- return the type of a value after the integer promotions */
+
+static int promote(const int type)
+{
+   switch (type) {
+   case T_CHAR:
+   case T_UCHAR:
+   case T_SHORT:
+      return (T_INT);
+   case T_USHORT:
+      return (T_UINT);
+   }
+
+   return (type);
+}
+
+
+/* arithmetic --- return the type of the result of an arithmetic operator */
+
+static int arithmetic(const struct ExprNode *const l, const struct ExprNode *const r)
+{
+   // Only 16-bit arithmetic so far, so 'long' and floating-point are ignored
+   return ((IsUnsignedNode(l) || IsUnsignedNode(r)) ? T_UINT : T_INT);
+}
+
+
+/* scale --- multiply an integer by the size of the object that a pointer points to */
+
+static struct ExprNode *scale(struct ExprNode *n, const struct ExprNode *const ptr)
+{
+   const int size = ObjectSize(ptr->type, ptr->pLevel - 1);
+
+   if (size == 1) {
+      return (n);
+   }
+
+   return (NewNode(N_MUL, n, NewConstant(size, T_INT)));
+}
+
+
+/* fold --- work out the value of an operator applied to constants, or return false */
+
+static bool fold(const struct ExprNode *const e, int *value)
+{
+   const int a = e->left->value;
+   const int b = (e->right != NULL) ? e->right->value : 0;
+   const bool isUnsigned = IsUnsignedNode(e->left) || ((e->right != NULL) && IsUnsignedNode(e->right));
+
+   // Arithmetic is done with host 'int', but operators whose result
+   // depends on the width of 'int' see the 16-bit values of their operands
+   const unsigned int ua = a & 0xffff;
+   const unsigned int ub = b & 0xffff;
+   const int sa = (short int)a;
+   const int sb = (short int)b;
+
+   switch (e->kind) {
+   case N_NEG:
+      *value = -a;
+      break;
+   case N_COM:
+      *value = ~a;
+      break;
+   case N_NOT:
+      *value = (ua == 0);
+      break;
+   case N_ADD:
+      *value = a + b;
+      break;
+   case N_SUB:
+      *value = a - b;
+      break;
+   case N_MUL:
+      *value = a * b;
+      break;
+   case N_DIV:
+      if (ub == 0) {
+         return (false);   // Leave it to fail at run-time
+      }
+
+      *value = isUnsigned ? (int)(ua / ub) : sa / sb;
+      break;
+   case N_MOD:
+      if (ub == 0) {
+         return (false);
+      }
+
+      *value = isUnsigned ? (int)(ua % ub) : sa % sb;
+      break;
+   case N_AND:
+      *value = a & b;
+      break;
+   case N_OR:
+      *value = a | b;
+      break;
+   case N_XOR:
+      *value = a ^ b;
+      break;
+   case N_LSHIFT:
+      if (ub > 15) {
+         return (false);
+      }
+
+      *value = (int)(ua << ub);
+      break;
+   case N_RSHIFT:
+      if (ub > 15) {
+         return (false);
+      }
+
+      *value = IsUnsignedNode(e->left) ? (int)(ua >> ub) : sa >> ub;
+      break;
+   case N_EQ:
+      *value = (ua == ub);
+      break;
+   case N_NE:
+      *value = (ua != ub);
+      break;
+   case N_LT:
+      *value = isUnsigned ? (ua < ub) : (sa < sb);
+      break;
+   case N_LE:
+      *value = isUnsigned ? (ua <= ub) : (sa <= sb);
+      break;
+   case N_GT:
+      *value = isUnsigned ? (ua > ub) : (sa > sb);
+      break;
+   case N_GE:
+      *value = isUnsigned ? (ua >= ub) : (sa >= sb);
+      break;
+   case N_LOGAND:
+      *value = (ua != 0) && (ub != 0);
+      break;
+   case N_LOGOR:
+      *value = (ua != 0) || (ub != 0);
+      break;
+   default:
+      return (false);
+   }
+
+   return (true);
+}
+
+
+/* NewNode --- make a node for an operator, giving it a type and folding constants */
+
+struct ExprNode *NewNode(const int kind, struct ExprNode *left, struct ExprNode *right)
+{
+   struct ExprNode *e;
+   struct ExprNode *tmp;
+   int value;
+
+   // Keep the pointer on the left of 'n + p'
+   if ((kind == N_ADD) && (left->pLevel == 0) && (right->pLevel > 0)) {
+      tmp = left;
+      left = right;
+      right = tmp;
+   }
+
+   // '0 && x' and '1 || x' are known without evaluating 'x'
+   if (((kind == N_LOGAND) || (kind == N_LOGOR)) && (left->kind == N_CONST) &&
+       (((left->value & 0xffff) != 0) == (kind == N_LOGOR))) {
+      FreeTree(left);
+      FreeTree(right);
+
+      return (NewConstant(kind == N_LOGOR, T_INT));
+   }
+
+   // 'x && 1' and 'x || 0' just test 'x', and 'x && 0' and 'x || 1' needn't
+   if (((kind == N_LOGAND) || (kind == N_LOGOR)) && (right->kind == N_CONST)) {
+      if (((right->value & 0xffff) != 0) != (kind == N_LOGOR)) {
+         FreeTree(right);
+
+         return (NewNode(N_NE, left, NewConstant(0, T_INT)));
+      }
+      else if (HasSideEffects(left) == false) {
+         FreeTree(left);
+         FreeTree(right);
+
+         return (NewConstant(kind == N_LOGOR, T_INT));
+      }
+   }
+
+   e = newNode(kind);
+   e->left = left;
+   e->right = right;
+
+   switch (kind) {
+   case N_DEREF:
+      e->type = left->type;
+      e->pLevel = left->pLevel - 1;
+      break;
+   case N_ADDR:
+      e->type = left->type;
+      e->pLevel = left->pLevel + 1;
+      e->sym = left->sym;
+      break;
+   case N_NEG:
+   case N_COM:
+      e->type = promote(left->type);
+      break;
+   case N_PREINC:
+   case N_PREDEC:
+   case N_POSTINC:
+   case N_POSTDEC:
+   case N_ASSIGN:
+      e->type = left->type;
+      e->pLevel = left->pLevel;
+      break;
+   case N_ADD:
+      if (left->pLevel > 0) {
+         e->right = scale(right, left);
+         e->type = left->type;
+         e->pLevel = left->pLevel;
+      }
+      else {
+         e->type = arithmetic(left, right);
+      }
+      break;
+   case N_SUB:
+      if ((left->pLevel > 0) && (right->pLevel > 0)) {
+         // Difference between pointers, counted in objects. It's always
+         // an exact multiple, so a shift divides even when it's negative.
+         const int size = ObjectSize(left->type, left->pLevel - 1);
+         int shift;
+
+         e->type = T_INT;
+
+         for (shift = 0; (1 << shift) < size; shift++)
+            ;
+
+         if (shift > 0) {
+            return (NewNode(N_RSHIFT, e, NewConstant(shift, T_INT)));
+         }
+      }
+      else if (left->pLevel > 0) {
+         e->right = scale(right, left);
+         e->type = left->type;
+         e->pLevel = left->pLevel;
+      }
+      else {
+         e->type = arithmetic(left, right);
+      }
+      break;
+   case N_MUL:
+   case N_DIV:
+   case N_MOD:
+   case N_AND:
+   case N_OR:
+   case N_XOR:
+      e->type = arithmetic(left, right);
+      break;
+   case N_LSHIFT:
+   case N_RSHIFT:
+      e->type = promote(left->type);
+      break;
+   }
+
+   // Operators applied to constants are worked out now
+   if ((e->left != NULL) && (e->left->kind == N_CONST) &&
+       ((e->right == NULL) || (e->right->kind == N_CONST)) && fold(e, &value)) {
+      FreeTree(e->left);
+      FreeTree(e->right);
+
+      e->kind = N_CONST;
+      e->value = value;
+      e->left = NULL;
+      e->right = NULL;
+   }
+
+   return (e);
+}
+
+
+/* NewConstant --- make a node for an integer constant */
+
+struct ExprNode *NewConstant(const int value, const int type)
+{
+   struct ExprNode *e = newNode(N_CONST);
+
+   e->value = value;
+   e->type = type;
+
+   return (e);
+}
+
+
+/* NewVariable --- make a node for a scalar variable */
+
+struct ExprNode *NewVariable(const struct Symbol *const sym)
+{
+   struct ExprNode *e = newNode(N_VAR);
+
+   e->sym = sym;
+   e->type = sym->type;
+   e->pLevel = sym->pLevel;
+
+   return (e);
+}
+
+
+/* NewString --- make a node for the address of a string literal */
+
+struct ExprNode *NewString(const int label)
+{
+   struct ExprNode *e = newNode(N_STRING);
+
+   e->value = label;
+   e->type = T_CHAR;
+   e->pLevel = 1;
+
+   return (e);
+}
+
+
+/* NewCall --- make a node for a call to a function, with no arguments as yet */
+
+struct ExprNode *NewCall(const char name[], const struct Symbol *const fn)
+{
+   struct ExprNode *e = newNode(N_CALL);
+
+   e->name = name;
+   e->sym = fn;
+
+   // An undeclared function is assumed to return 'int'
+   if (fn != NULL) {
+      e->type = fn->type;
+      e->pLevel = fn->pLevel;
+   }
+
+   return (e);
+}
+
+
+/* NewConditional --- make a node for 'cond ? ifTrue : ifFalse' */
+
+struct ExprNode *NewConditional(struct ExprNode *cond, struct ExprNode *ifTrue, struct ExprNode *ifFalse)
+{
+   struct ExprNode *e;
+
+   if (cond->kind == N_CONST) {
+      const bool isTrue = ((cond->value & 0xffff) != 0);
+
+      FreeTree(cond);
+
+      if (isTrue) {
+         FreeTree(ifFalse);
+         return (ifTrue);
+      }
+      else {
+         FreeTree(ifTrue);
+         return (ifFalse);
+      }
+   }
+
+   e = newNode(N_COND);
+   e->left = cond;
+   e->right = ifTrue;
+   e->third = ifFalse;
+
+   if (ifTrue->pLevel > 0) {
+      e->type = ifTrue->type;
+      e->pLevel = ifTrue->pLevel;
+   }
+   else if (ifFalse->pLevel > 0) {
+      e->type = ifFalse->type;
+      e->pLevel = ifFalse->pLevel;
+   }
+   else {
+      e->type = arithmetic(ifTrue, ifFalse);
+   }
+
+   return (e);
+}
+
+
+/* NewCast --- make a node to convert a value to another type */
+
+struct ExprNode *NewCast(struct ExprNode *e, const int type, const int pLevel)
+{
+   struct ExprNode *cast;
+
+   if ((e->kind == N_CONST) && (pLevel == 0)) {
+      switch (type) {
+      case T_CHAR:
+         e->value = (signed char)e->value;
+         break;
+      case T_UCHAR:
+         e->value &= 0xff;
+         break;
+      case T_SHORT:
+      case T_INT:
+         e->value = (short int)e->value;
+         break;
+      case T_USHORT:
+      case T_UINT:
+         e->value &= 0xffff;
+         break;
+      }
+
+      e->type = type;
+      e->pLevel = 0;
+
+      return (e);
+   }
+
+   cast = newNode(N_CAST);
+   cast->left = e;
+   cast->type = type;
+   cast->pLevel = pLevel;
+
+   return (cast);
+}
+
+
+/* CopyTree --- make a copy of a whole tree */
+
+struct ExprNode *CopyTree(const struct ExprNode *e)
+{
+   struct ExprNode *copy;
+
+   if (e == NULL) {
+      return (NULL);
+   }
+
+   copy = newNode(e->kind);
+
+   *copy = *e;
+   copy->left = CopyTree(e->left);
+   copy->right = CopyTree(e->right);
+   copy->third = CopyTree(e->third);
+
+   return (copy);
+}
+
+
+/* FreeTree --- free a whole tree */
+
+void FreeTree(struct ExprNode *e)
+{
+   if (e != NULL) {
+      FreeTree(e->left);
+      FreeTree(e->right);
+      FreeTree(e->third);
+      free(e);
+   }
+}
+
+
+/* HasSideEffects --- return true if evaluating a tree might change anything */
+
+bool HasSideEffects(const struct ExprNode *e)
+{
+   if (e == NULL) {
+      return (false);
+   }
+
+   switch (e->kind) {
+   case N_CALL:
+   case N_PREINC:
+   case N_PREDEC:
+   case N_POSTINC:
+   case N_POSTDEC:
+   case N_ASSIGN:
+      return (true);
+   }
+
+   return (HasSideEffects(e->left) || HasSideEffects(e->right) || HasSideEffects(e->third));
+}
+
+
+/* HasCall --- return true if evaluating a tree calls a function */
+
+bool HasCall(const struct ExprNode *e)
+{
+   if (e == NULL) {
+      return (false);
+   }
+   
+   return ((e->kind == N_CALL) || HasCall(e->left) || HasCall(e->right) || HasCall(e->third));
+}
+
+
+/* CountNodes --- return the number of nodes in a tree, as a measure of how much code it needs */
+
+int CountNodes(const struct ExprNode *e)
+{
+   if (e == NULL) {
+      return (0);
+   }
+   
+   return (1 + CountNodes(e->left) + CountNodes(e->right) + CountNodes(e->third));
+}
+
+
+/* CountParam --- return the number of times the body of an inline function uses one of its parameters */
+
+int CountParam(const struct ExprNode *e, const int param)
+{
+   if (e == NULL) {
+      return (0);
+   }
+   
+   return (((e->kind == N_PARAM) && (e->value == param)) +
+           CountParam(e->left, param) + CountParam(e->right, param) + CountParam(e->third, param));
+}
+
+
+/* SubstituteParams --- copy the body of an inline function, with the arguments of a call in place of its parameters */
+
+struct ExprNode *SubstituteParams(const struct ExprNode *e, struct ExprNode *const args[])
+{
+   struct ExprNode *copy;
+   
+   if (e == NULL) {
+      return (NULL);
+   }
+   
+   // Each argument is converted to the type of its parameter, as it would be for a call
+   if (e->kind == N_PARAM) {
+      copy = CopyTree(args[e->value]);
+      
+      if ((copy->type != e->type) || (copy->pLevel != e->pLevel)) {
+         copy = NewCast(copy, e->type, e->pLevel);
+      }
+      
+      return (copy);
+   }
+   
+   copy = newNode(e->kind);
+   
+   *copy = *e;
+   copy->left = SubstituteParams(e->left, args);
+   copy->right = SubstituteParams(e->right, args);
+   copy->third = SubstituteParams(e->third, args);
+   
+   return (copy);
+}
+
+
+/* IsUnsignedType --- return true if a value of this type is compared as unsigned */
+
+bool IsUnsignedType(const int type)
+{
+   // 'char' and 'unsigned char' are promoted to 'int', but 'unsigned short'
+   // is the same size as 'int' and so becomes 'unsigned int'
+   return ((type == T_USHORT) || (type == T_UINT) || (type == T_ULONG));
+}
+
+
+/* IsUnsignedNode --- return true if the value of a node is compared as unsigned */
+
+bool IsUnsignedNode(const struct ExprNode *e)
+{
+   // Pointers compare as unsigned, just like 'unsigned int'
+   return ((e->pLevel > 0) || IsUnsignedType(e->type));
+}
+
+
+/* ObjectSize --- return the size in bytes of an object of a given type */
+
+int ObjectSize(const int type, const int pLevel)
+{
+   if (pLevel > 0) {
+      return (2);
+   }
+
+   switch (type) {
+   case T_SHORT:
+   case T_USHORT:
+   case T_INT:
+   case T_UINT:
+      return (2);
+   case T_LONG:
+   case T_ULONG:
+   case T_FLOAT:
+      return (4);
+   case T_DOUBLE:
+      return (8);
+   }
+
+   return (1);    // 'char', and 'void' as GCC does
+}
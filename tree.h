@@ -0,0 +1,56 @@
+/* tree --- expression trees                                2026-10-17 */
+/* Copyright (c) 2022 John Honniball. All rights reserved              */
+
+// Kinds of node in an expression tree
+enum eNodeKind {
+   N_CONST,             // Integer constant
+   N_STRING,            // Address of a string literal
+   N_VAR,               // Scalar variable
+   N_ADDR,              // Address of a variable, '&x'
+   N_DEREF,             // Object that a pointer points to, '*p'
+   N_CALL,              // Function call, with its arguments in a list of N_ARG
+   N_ARG,               // One actual parameter, and the rest of the list
+   N_PARAM,             // Parameter in the body of an inline function, replaced by its argument
+   N_CAST,              // Conversion to another type
+   N_NEG, N_COM, N_NOT, // Unary '-', '~' and '!'
+   N_PREINC, N_PREDEC, N_POSTINC, N_POSTDEC,
+   N_ASSIGN,
+   N_ADD, N_SUB, N_MUL, N_DIV, N_MOD,
+   N_AND, N_OR, N_XOR, N_LSHIFT, N_RSHIFT,
+   N_EQ, N_NE, N_LT, N_LE, N_GT, N_GE,
+   N_LOGAND, N_LOGOR,   // '&&' and '||', which may not evaluate their right-hand operands
+   N_COND               // 'a ? b : c'
+};
+
+struct ExprNode {
+   int kind;
+   int type;                  // Type of the value, or of the object for N_VAR and N_DEREF
+   int pLevel;
+   int value;                 // Value of N_CONST, or label of N_STRING
+   const char *text;          // Source text of a literal, for comments, or NULL
+   int textLength;
+   const struct Symbol *sym;  // Variable for N_VAR and N_ADDR, or function for N_CALL
+   const char *name;          // Name of the function for N_CALL
+   struct ExprNode *left;     // Only operand, or first one
+   struct ExprNode *right;
+   struct ExprNode *third;    // Value if false, for N_COND
+   int need;                  // Sethi-Ullman number, set by the code generator
+};
+
+struct ExprNode *NewNode(const int kind, struct ExprNode *left, struct ExprNode *right);
+struct ExprNode *NewConstant(const int value, const int type);
+struct ExprNode *NewVariable(const struct Symbol *const sym);
+struct ExprNode *NewString(const int label);
+struct ExprNode *NewCall(const char name[], const struct Symbol *const fn);
+struct ExprNode *NewConditional(struct ExprNode *cond, struct ExprNode *ifTrue, struct ExprNode *ifFalse);
+struct ExprNode *NewCast(struct ExprNode *e, const int type, const int pLevel);
+struct ExprNode *CopyTree(const struct ExprNode *e);
+void FreeTree(struct ExprNode *e);
+bool HasSideEffects(const struct ExprNode *e);
+bool HasCall(const struct ExprNode *e);
+int CountNodes(const struct ExprNode *e);
+int CountParam(const struct ExprNode *e, const int param);
+struct ExprNode *SubstituteParams(const struct ExprNode *e, struct ExprNode *const args[]);
+bool IsUnsignedType(const int type);
+bool IsUnsignedNode(const struct ExprNode *e);
+int ObjectSize(const int type, const int pLevel);